@@ -27,6 +27,12 @@ SOFTWARE.
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include "noise.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define NOISE_SSE2
+#include <emmintrin.h>
+#endif
 
 #define F2 0.3660254037844386f
 #define G2 0.21132486540518713f
@@ -42,7 +48,7 @@ const static float GRAD3[16][3] = {
     { 1, 0,-1}, {-1, 0,-1}, { 0,-1, 1}, { 0, 1, 1}
 };
 
-static unsigned char PERM[] = {
+static NoiseContext default_noise = {{
     151, 160, 137,  91,  90,  15, 131,  13,
     201,  95,  96,  53, 194, 233,   7, 225,
     140,  36, 103,  30,  69, 142,   8,  99,
@@ -107,26 +113,57 @@ static unsigned char PERM[] = {
     127,   4, 150, 254, 138, 236, 205,  93,
     222, 114,  67,  29,  24,  72, 243, 141,
     128, 195,  78,  66, 215,  61, 156, 180
-};
+}};
 
-void seed(unsigned int x) {
-    srand(x);
+// The example rand() from the C standard, so that a seed gives the same
+// world everywhere, and seeding one context does not disturb another.
+#define NOISE_RAND_MAX 32767
+
+static int noise_rand(unsigned long *next) {
+    *next = (*next * 1103515245 + 12345) & 0xffffffff;
+    return (int) ((*next / 65536) % 32768);
+}
+
+void noise_seed(NoiseContext *noise, unsigned int x) {
+    unsigned char *perm = noise->perm;
+    unsigned long next = x;
     for (int i = 0; i < 256; i++) {
-        PERM[i] = i;
+        perm[i] = i;
     }
     for (int i = 255; i > 0; i--) {
         int j;
         int n = i + 1;
-        while (n <= (j = rand() / (RAND_MAX / n)));
-        unsigned char a = PERM[i];
-        unsigned char b = PERM[j];
-        PERM[i] = b;
-        PERM[j] = a;
+        while (n <= (j = noise_rand(&next) / (NOISE_RAND_MAX / n)));
+        unsigned char a = perm[i];
+        unsigned char b = perm[j];
+        perm[i] = b;
+        perm[j] = a;
     }
-    memcpy(PERM + 256, PERM, sizeof(unsigned char) * 256);
+    memcpy(perm + 256, perm, sizeof(unsigned char) * 256);
+}
+
+void noise_default(NoiseContext *noise) {
+    *noise = default_noise;
 }
 
-float noise2(float x, float y) {
+NoiseContext *noise_create(unsigned int x) {
+    NoiseContext *noise = malloc(sizeof(NoiseContext));
+    if (noise) {
+        noise_seed(noise, x);
+    }
+    return noise;
+}
+
+void noise_destroy(NoiseContext *noise) {
+    free(noise);
+}
+
+void seed(unsigned int x) {
+    noise_seed(&default_noise, x);
+}
+
+static float noise2(const NoiseContext *noise, float x, float y) {
+    const unsigned char *perm = noise->perm;
     int i1, j1, I, J, c;
     float s = (x + y) * F2;
     float i = floorf(x + s);
@@ -134,7 +171,7 @@ float noise2(float x, float y) {
     float t = (i + j) * G2;
 
     float xx[3], yy[3], f[3];
-    float noise[3] = {0.0f, 0.0f, 0.0f};
+    float n[3] = {0.0f, 0.0f, 0.0f};
     int g[3];
 
     xx[0] = x - (i - t);
@@ -150,9 +187,9 @@ float noise2(float x, float y) {
 
     I = (int) i & 255;
     J = (int) j & 255;
-    g[0] = PERM[I + PERM[J]] % 12;
-    g[1] = PERM[I + i1 + PERM[J + j1]] % 12;
-    g[2] = PERM[I + 1 + PERM[J + 1]] % 12;
+    g[0] = perm[I + perm[J]] % 12;
+    g[1] = perm[I + i1 + perm[J + j1]] % 12;
+    g[2] = perm[I + 1 + perm[J + 1]] % 12;
 
     for (c = 0; c <= 2; c++) {
         f[c] = 0.5f - xx[c]*xx[c] - yy[c]*yy[c];
@@ -160,17 +197,18 @@ float noise2(float x, float y) {
     
     for (c = 0; c <= 2; c++) {
         if (f[c] > 0) {
-            noise[c] = f[c] * f[c] * f[c] * f[c] *
+            n[c] = f[c] * f[c] * f[c] * f[c] *
                 (GRAD3[g[c]][0] * xx[c] + GRAD3[g[c]][1] * yy[c]);
         }
     }
     
-    return (noise[0] + noise[1] + noise[2]) * 70.0f;
+    return (n[0] + n[1] + n[2]) * 70.0f;
 }
 
-float noise3(float x, float y, float z) {
+static float noise3(const NoiseContext *noise, float x, float y, float z) {
+    const unsigned char *perm = noise->perm;
     int c, o1[3], o2[3], g[4], I, J, K;
-    float f[4], noise[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    float f[4], n[4] = {0.0f, 0.0f, 0.0f, 0.0f};
     float s = (x + y + z) * F3;
     float i = floorf(x + s);
     float j = floorf(y + s);
@@ -216,10 +254,10 @@ float noise3(float x, float y, float z) {
     I = (int) i & 255; 
     J = (int) j & 255; 
     K = (int) k & 255;
-    g[0] = PERM[I + PERM[J + PERM[K]]] % 12;
-    g[1] = PERM[I + o1[0] + PERM[J + o1[1] + PERM[o1[2] + K]]] % 12;
-    g[2] = PERM[I + o2[0] + PERM[J + o2[1] + PERM[o2[2] + K]]] % 12;
-    g[3] = PERM[I + 1 + PERM[J + 1 + PERM[K + 1]]] % 12; 
+    g[0] = perm[I + perm[J + perm[K]]] % 12;
+    g[1] = perm[I + o1[0] + perm[J + o1[1] + perm[o1[2] + K]]] % 12;
+    g[2] = perm[I + o2[0] + perm[J + o2[1] + perm[o2[2] + K]]] % 12;
+    g[3] = perm[I + 1 + perm[J + 1 + perm[K + 1]]] % 12; 
 
     for (c = 0; c <= 3; c++) {
         f[c] = 0.6f - pos[c][0] * pos[c][0] - pos[c][1] * pos[c][1] -
@@ -228,45 +266,294 @@ float noise3(float x, float y, float z) {
     
     for (c = 0; c <= 3; c++) {
         if (f[c] > 0) {
-            noise[c] = f[c] * f[c] * f[c] * f[c] * DOT3(pos[c], GRAD3[g[c]]);
+            n[c] = f[c] * f[c] * f[c] * f[c] * DOT3(pos[c], GRAD3[g[c]]);
         }
     }
     
-    return (noise[0] + noise[1] + noise[2] + noise[3]) * 32.0f;
+    return (n[0] + n[1] + n[2] + n[3]) * 32.0f;
 }
 
-float simplex2(
-    float x, float y,
+float noise_simplex2(
+    const NoiseContext *noise, float x, float y,
     int octaves, float persistence, float lacunarity)
 {
     float freq = 1.0f;
     float amp = 1.0f;
     float max = 1.0f;
-    float total = noise2(x, y);
+    float total = noise2(noise, x, y);
     int i;
     for (i = 1; i < octaves; i++) {
         freq *= lacunarity;
         amp *= persistence;
         max += amp;
-        total += noise2(x * freq, y * freq) * amp;
+        total += noise2(noise, x * freq, y * freq) * amp;
     }
     return (1 + total / max) / 2;
 }
 
-float simplex3(
-    float x, float y, float z,
+float noise_simplex3(
+    const NoiseContext *noise, float x, float y, float z,
     int octaves, float persistence, float lacunarity)
 {
     float freq = 1.0f;
     float amp = 1.0f;
     float max = 1.0f;
-    float total = noise3(x, y, z);
+    float total = noise3(noise, x, y, z);
     int i;
     for (i = 1; i < octaves; ++i) {
         freq *= lacunarity;
         amp *= persistence;
         max += amp;
-        total += noise3(x * freq, y * freq, z * freq) * amp;
+        total += noise3(noise, x * freq, y * freq, z * freq) * amp;
     }
     return (1 + total / max) / 2;
 }
+
+float simplex2(
+    float x, float y,
+    int octaves, float persistence, float lacunarity)
+{
+    return noise_simplex2(
+        &default_noise, x, y, octaves, persistence, lacunarity);
+}
+
+float simplex3(
+    float x, float y, float z,
+    int octaves, float persistence, float lacunarity)
+{
+    return noise_simplex3(
+        &default_noise, x, y, z, octaves, persistence, lacunarity);
+}
+
+#ifdef NOISE_SSE2
+
+// The functions below are noise2 and noise3 four points at a time. Every
+// floating point operation is done in the same order as in the scalar
+// code, so that the results are the same to the last bit.
+
+static __m128 floor4(__m128 x) {
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)));
+}
+
+static __m128 noise2_4(const NoiseContext *noise, __m128 x, __m128 y) {
+    const unsigned char *perm = noise->perm;
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 s = _mm_mul_ps(_mm_add_ps(x, y), _mm_set1_ps(F2));
+    __m128 i = floor4(_mm_add_ps(x, s));
+    __m128 j = floor4(_mm_add_ps(y, s));
+    __m128 t = _mm_mul_ps(_mm_add_ps(i, j), _mm_set1_ps(G2));
+
+    __m128 xx[3], yy[3], gx[3], gy[3];
+    xx[0] = _mm_sub_ps(x, _mm_sub_ps(i, t));
+    yy[0] = _mm_sub_ps(y, _mm_sub_ps(j, t));
+
+    __m128 i1 = _mm_and_ps(_mm_cmpgt_ps(xx[0], yy[0]), one);
+    __m128 j1 = _mm_and_ps(_mm_cmple_ps(xx[0], yy[0]), one);
+
+    xx[2] = _mm_sub_ps(_mm_add_ps(xx[0], _mm_set1_ps(G2 * 2.0f)), one);
+    yy[2] = _mm_sub_ps(_mm_add_ps(yy[0], _mm_set1_ps(G2 * 2.0f)), one);
+    xx[1] = _mm_add_ps(_mm_sub_ps(xx[0], i1), _mm_set1_ps(G2));
+    yy[1] = _mm_add_ps(_mm_sub_ps(yy[0], j1), _mm_set1_ps(G2));
+
+    // the permutation table lookups are done one lane at a time
+    int ii[4], jj[4];
+    float fi1[4], gxs[3][4], gys[3][4];
+    _mm_storeu_si128((__m128i *)ii, _mm_cvttps_epi32(i));
+    _mm_storeu_si128((__m128i *)jj, _mm_cvttps_epi32(j));
+    _mm_storeu_ps(fi1, i1);
+    for (int l = 0; l < 4; l++) {
+        int I = ii[l] & 255;
+        int J = jj[l] & 255;
+        int a = fi1[l] != 0;
+        int b = !a;
+        int g0 = perm[I + perm[J]] % 12;
+        int g1 = perm[I + a + perm[J + b]] % 12;
+        int g2 = perm[I + 1 + perm[J + 1]] % 12;
+        gxs[0][l] = GRAD3[g0][0]; gys[0][l] = GRAD3[g0][1];
+        gxs[1][l] = GRAD3[g1][0]; gys[1][l] = GRAD3[g1][1];
+        gxs[2][l] = GRAD3[g2][0]; gys[2][l] = GRAD3[g2][1];
+    }
+
+    __m128 total = zero;
+    for (int c = 0; c <= 2; c++) {
+        gx[c] = _mm_loadu_ps(gxs[c]);
+        gy[c] = _mm_loadu_ps(gys[c]);
+        __m128 f = _mm_sub_ps(
+            _mm_sub_ps(_mm_set1_ps(0.5f), _mm_mul_ps(xx[c], xx[c])),
+            _mm_mul_ps(yy[c], yy[c]));
+        __m128 f4 = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(f, f), f), f);
+        __m128 dot = _mm_add_ps(_mm_mul_ps(gx[c], xx[c]),
+            _mm_mul_ps(gy[c], yy[c]));
+        __m128 n = _mm_and_ps(_mm_cmpgt_ps(f, zero), _mm_mul_ps(f4, dot));
+        total = c ? _mm_add_ps(total, n) : n;
+    }
+    return _mm_mul_ps(total, _mm_set1_ps(70.0f));
+}
+
+static __m128 noise3_4(
+    const NoiseContext *noise, __m128 x, __m128 y, __m128 z)
+{
+    const unsigned char *perm = noise->perm;
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 s = _mm_mul_ps(_mm_add_ps(_mm_add_ps(x, y), z), _mm_set1_ps(F3));
+    __m128 i = floor4(_mm_add_ps(x, s));
+    __m128 j = floor4(_mm_add_ps(y, s));
+    __m128 k = floor4(_mm_add_ps(z, s));
+    __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(i, j), k), _mm_set1_ps(G3));
+
+    __m128 pos[4][3];
+    pos[0][0] = _mm_sub_ps(x, _mm_sub_ps(i, t));
+    pos[0][1] = _mm_sub_ps(y, _mm_sub_ps(j, t));
+    pos[0][2] = _mm_sub_ps(z, _mm_sub_ps(k, t));
+
+    // the branches of noise3 that pick the simplex, as masks
+    __m128 a = _mm_cmpge_ps(pos[0][0], pos[0][1]);
+    __m128 b = _mm_cmpge_ps(pos[0][1], pos[0][2]);
+    __m128 c = _mm_cmpge_ps(pos[0][0], pos[0][2]);
+    __m128 o1[3], o2[3];
+    o1[0] = _mm_and_ps(a, _mm_or_ps(b, c));
+    o1[1] = _mm_andnot_ps(a, b);
+    o1[2] = _mm_andnot_ps(b, _mm_andnot_ps(_mm_and_ps(a, c), one));
+    o2[0] = _mm_or_ps(a, _mm_and_ps(b, c));
+    o2[1] = _mm_or_ps(_mm_and_ps(a, b), _mm_andnot_ps(a, one));
+    o2[2] = _mm_or_ps(_mm_andnot_ps(b, one),
+        _mm_andnot_ps(_mm_or_ps(a, c), one));
+    for (int d = 0; d <= 2; d++) {
+        o1[d] = _mm_and_ps(o1[d], one);
+        o2[d] = _mm_and_ps(o2[d], one);
+    }
+
+    for (int d = 0; d <= 2; d++) {
+        pos[3][d] = _mm_add_ps(_mm_sub_ps(pos[0][d], one),
+            _mm_set1_ps(3.0f * G3));
+        pos[2][d] = _mm_add_ps(_mm_sub_ps(pos[0][d], o2[d]),
+            _mm_set1_ps(2.0f * G3));
+        pos[1][d] = _mm_add_ps(_mm_sub_ps(pos[0][d], o1[d]),
+            _mm_set1_ps(G3));
+    }
+
+    int ii[4], jj[4], kk[4];
+    float fo1[3][4], fo2[3][4], grad[4][3][4];
+    _mm_storeu_si128((__m128i *)ii, _mm_cvttps_epi32(i));
+    _mm_storeu_si128((__m128i *)jj, _mm_cvttps_epi32(j));
+    _mm_storeu_si128((__m128i *)kk, _mm_cvttps_epi32(k));
+    for (int d = 0; d <= 2; d++) {
+        _mm_storeu_ps(fo1[d], o1[d]);
+        _mm_storeu_ps(fo2[d], o2[d]);
+    }
+    for (int l = 0; l < 4; l++) {
+        int I = ii[l] & 255;
+        int J = jj[l] & 255;
+        int K = kk[l] & 255;
+        int a0 = fo1[0][l] != 0, a1 = fo1[1][l] != 0, a2 = fo1[2][l] != 0;
+        int b0 = fo2[0][l] != 0, b1 = fo2[1][l] != 0, b2 = fo2[2][l] != 0;
+        int g[4];
+        g[0] = perm[I + perm[J + perm[K]]] % 12;
+        g[1] = perm[I + a0 + perm[J + a1 + perm[a2 + K]]] % 12;
+        g[2] = perm[I + b0 + perm[J + b1 + perm[b2 + K]]] % 12;
+        g[3] = perm[I + 1 + perm[J + 1 + perm[K + 1]]] % 12;
+        for (int e = 0; e <= 3; e++) {
+            for (int d = 0; d <= 2; d++) {
+                grad[e][d][l] = GRAD3[g[e]][d];
+            }
+        }
+    }
+
+    __m128 total = zero;
+    for (int e = 0; e <= 3; e++) {
+        __m128 f = _mm_sub_ps(
+            _mm_sub_ps(
+                _mm_sub_ps(_mm_set1_ps(0.6f),
+                    _mm_mul_ps(pos[e][0], pos[e][0])),
+                _mm_mul_ps(pos[e][1], pos[e][1])),
+            _mm_mul_ps(pos[e][2], pos[e][2]));
+        __m128 f4 = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(f, f), f), f);
+        __m128 dot = _mm_add_ps(
+            _mm_add_ps(
+                _mm_mul_ps(pos[e][0], _mm_loadu_ps(grad[e][0])),
+                _mm_mul_ps(pos[e][1], _mm_loadu_ps(grad[e][1]))),
+            _mm_mul_ps(pos[e][2], _mm_loadu_ps(grad[e][2])));
+        __m128 n = _mm_and_ps(_mm_cmpgt_ps(f, zero), _mm_mul_ps(f4, dot));
+        total = e ? _mm_add_ps(total, n) : n;
+    }
+    return _mm_mul_ps(total, _mm_set1_ps(32.0f));
+}
+
+#endif
+
+void noise_simplex2_batch(
+    const NoiseContext *noise, const float *x, const float *y,
+    float *out, int n,
+    int octaves, float persistence, float lacunarity)
+{
+    int index = 0;
+#ifdef NOISE_SSE2
+    for (; index + 4 <= n; index += 4) {
+        __m128 px = _mm_loadu_ps(x + index);
+        __m128 py = _mm_loadu_ps(y + index);
+        float freq = 1.0f;
+        float amp = 1.0f;
+        float max = 1.0f;
+        __m128 total = noise2_4(noise, px, py);
+        for (int i = 1; i < octaves; i++) {
+            freq *= lacunarity;
+            amp *= persistence;
+            max += amp;
+            __m128 f = _mm_set1_ps(freq);
+            total = _mm_add_ps(total, _mm_mul_ps(
+                noise2_4(noise, _mm_mul_ps(px, f), _mm_mul_ps(py, f)),
+                _mm_set1_ps(amp)));
+        }
+        __m128 result = _mm_div_ps(
+            _mm_add_ps(_mm_set1_ps(1.0f),
+                _mm_div_ps(total, _mm_set1_ps(max))),
+            _mm_set1_ps(2.0f));
+        _mm_storeu_ps(out + index, result);
+    }
+#endif
+    for (; index < n; index++) {
+        out[index] = noise_simplex2(noise,
+            x[index], y[index], octaves, persistence, lacunarity);
+    }
+}
+
+void noise_simplex3_batch(
+    const NoiseContext *noise, const float *x, const float *y,
+    const float *z, float *out, int n,
+    int octaves, float persistence, float lacunarity)
+{
+    int index = 0;
+#ifdef NOISE_SSE2
+    for (; index + 4 <= n; index += 4) {
+        __m128 px = _mm_loadu_ps(x + index);
+        __m128 py = _mm_loadu_ps(y + index);
+        __m128 pz = _mm_loadu_ps(z + index);
+        float freq = 1.0f;
+        float amp = 1.0f;
+        float max = 1.0f;
+        __m128 total = noise3_4(noise, px, py, pz);
+        for (int i = 1; i < octaves; ++i) {
+            freq *= lacunarity;
+            amp *= persistence;
+            max += amp;
+            __m128 f = _mm_set1_ps(freq);
+            total = _mm_add_ps(total, _mm_mul_ps(
+                noise3_4(noise, _mm_mul_ps(px, f), _mm_mul_ps(py, f),
+                    _mm_mul_ps(pz, f)),
+                _mm_set1_ps(amp)));
+        }
+        __m128 result = _mm_div_ps(
+            _mm_add_ps(_mm_set1_ps(1.0f),
+                _mm_div_ps(total, _mm_set1_ps(max))),
+            _mm_set1_ps(2.0f));
+        _mm_storeu_ps(out + index, result);
+    }
+#endif
+    for (; index < n; index++) {
+        out[index] = noise_simplex3(noise,
+            x[index], y[index], z[index], octaves, persistence, lacunarity);
+    }
+}
@@ -27,6 +27,39 @@ SOFTWARE.
 #ifndef _noise_h_
 #define _noise_h_
 
+// The permutation table that a world's noise is derived from. Each world
+// generator owns one, so several can generate in parallel without locks.
+typedef struct {
+    unsigned char perm[512];
+} NoiseContext;
+
+void noise_default(NoiseContext *noise);
+void noise_seed(NoiseContext *noise, unsigned int x);
+NoiseContext *noise_create(unsigned int x);
+void noise_destroy(NoiseContext *noise);
+
+float noise_simplex2(
+    const NoiseContext *noise, float x, float y,
+    int octaves, float persistence, float lacunarity);
+
+float noise_simplex3(
+    const NoiseContext *noise, float x, float y, float z,
+    int octaves, float persistence, float lacunarity);
+
+// Evaluate noise_simplex2 / noise_simplex3 at n points at once. The
+// results are bit-identical to calling them for each point; on x86-64
+// four points are evaluated per SSE2 instruction.
+void noise_simplex2_batch(
+    const NoiseContext *noise, const float *x, const float *y,
+    float *out, int n,
+    int octaves, float persistence, float lacunarity);
+
+void noise_simplex3_batch(
+    const NoiseContext *noise, const float *x, const float *y,
+    const float *z, float *out, int n,
+    int octaves, float persistence, float lacunarity);
+
+// The same, using the built-in table, or the one last given to seed().
 void seed(unsigned int x);
 
 float simplex2(
@@ -209,6 +209,7 @@ class Model(object):
             (re.compile(r'^/pq\s+(-?[0-9]+)\s*,?\s*(-?[0-9]+)$'), self.on_pq),
             (re.compile(r'^/help(?:\s+(\S+))?$'), self.on_help),
             (re.compile(r'^/list$'), self.on_list),
+            (re.compile(r'^/view\s+([0-9]+)$'), self.on_view),
         ]
     def start(self):
         thread = threading.Thread(target=self.run)
@@ -602,6 +603,10 @@ class Model(object):
     def on_list(self, client):
         client.send(TALK,
             'Players: %s' % ', '.join(x.nick for x in self.clients))
+    def on_view(self, client, radius):
+        # sent by clients when their view distance changes; this server
+        # broadcasts to everyone regardless, so there is nothing to do
+        pass
     def send_positions(self, client):
         for other in self.clients:
             if other == client:
@@ -24,13 +24,17 @@ const float pi = 3.14159265;
 
 void main() {
     vec3 color = vec3(texture(sampler, fs_in.fragment_uv));
+    bool cloud = color == vec3(1.0, 1.0, 1.0);
+    // opaque blocks have no holes, and without a discard their depth
+    // can be tested before they are shaded
+#ifndef OPAQUE
     if (color == vec3(1.0, 0.0, 1.0)) {
         discard;
     }
-    bool cloud = color == vec3(1.0, 1.0, 1.0);
     if (cloud && bool(ortho)) {
         discard;
     }
+#endif
     float df = cloud ? 1.0 - fs_in.diffuse * 0.2 : fs_in.diffuse;
     float ambient_occlusion = cloud ? 1.0 - (1.0 - fs_in.fragment_ambient_occlusion) * 0.2 : fs_in.fragment_ambient_occlusion;
     if(enable_ambient_occlusion)
@@ -8,6 +8,11 @@ uniform int ortho;
 layout (location = 0) in vec4 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec4 uv;
+#ifdef PLAYER
+// each player's cube is the same, placed and turned per instance
+layout (location = 3) in vec3 offset;
+layout (location = 4) in vec2 rotation;
+#endif
 
 
 out VS_OUT {
@@ -23,21 +28,47 @@ out VS_OUT {
 const float pi = 3.14159265;
 const vec3 light_direction = normalize(vec3(-1.0, 1.0, -1.0));
 
+#ifdef PLAYER
+// the rotation mat_rotate makes
+mat3 rotate(vec3 axis, float angle) {
+    axis = normalize(axis);
+    float s = sin(angle);
+    float c = cos(angle);
+    float m = 1.0 - c;
+    float x = axis.x;
+    float y = axis.y;
+    float z = axis.z;
+    return mat3(m * x * x + c, m * x * y - z * s, m * z * x + y * s,
+                m * x * y + z * s, m * y * y + c, m * y * z - x * s,
+                m * z * x - y * s, m * y * z + x * s, m * z * z + c);
+}
+#endif
+
 void main() {
-    gl_Position = matrix * position;
+#ifdef PLAYER
+    // as make_player turns it: about y, then down about its new x
+    mat3 turn = rotate(vec3(cos(rotation.x), 0.0, sin(rotation.x)), -rotation.y) *
+                rotate(vec3(0.0, 1.0, 0.0), rotation.x);
+    vec4 world = vec4(turn * vec3(position) + offset, 1.0);
+    vec3 world_normal = turn * normal;
+#else
+    vec4 world = position;
+    vec3 world_normal = normal;
+#endif
+    gl_Position = matrix * world;
     vs_out.fragment_uv = uv.xy;
     vs_out.fragment_ambient_occlusion = 0.3 + (1.0 - uv.z) * 0.7;
     vs_out.fragment_light = uv.w;
-    vs_out.diffuse = max(0.0, dot(normal, light_direction));
+    vs_out.diffuse = max(0.0, dot(world_normal, light_direction));
     if (bool(ortho)) {
         vs_out.fog_factor = 0.0;
         vs_out.fog_height = 0.0;
     }
     else {
-        float camera_distance = distance(camera, vec3(position));
+        float camera_distance = distance(camera, vec3(world));
         vs_out.fog_factor = pow(clamp(camera_distance / fog_distance, 0.0, 1.0), 4.0);
-        float dy = position.y - camera.y;
-        float dx = distance(position.xz, camera.xz);
+        float dy = world.y - camera.y;
+        float dx = distance(world.xz, camera.xz);
         vs_out.fog_height = (atan(dy, dx) + pi / 2) / pi;
     }
 }
@@ -68,3 +68,36 @@ int get_access_token(char *result, int length, char *username,
   }
   return 0;
 }
+
+/*
+ * Server side of the login: ask the auth server at `url` who owns the
+ * access token a client presented.  The reply is the numeric user id.
+ */
+int get_user_id(int *result, const char *url, const char *username,
+                const char *access_token) {
+  CURL *curl = curl_easy_init();
+  if (curl) {
+    char post[MAX_POST_LENGTH] = {0};
+    char response[MAX_RESPONSE_LENGTH] = {0};
+    long http_code = 0;
+    snprintf(post, MAX_POST_LENGTH, "username=%s&access_token=%s", username,
+             access_token);
+#ifdef _WIN32
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
+#endif
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_function);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    CURLcode code = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_cleanup(curl);
+    if (code == CURLE_OK && http_code == 200 && response[0] &&
+        strspn(response, "0123456789") == strlen(response)) {
+      *result = atoi(response);
+      return 1;
+    }
+  }
+  return 0;
+}
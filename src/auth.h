@@ -25,5 +25,7 @@
 
 int get_access_token(char *result, int length, char *username,
                      char *identity_token);
+int get_user_id(int *result, const char *url, const char *username,
+                const char *access_token);
 
 #endif
@@ -32,7 +32,14 @@
 #endif
 
 #include "client.h"
+#include "config.h"
+#include "protocol.h"
+#include "record.h"
 #include "tinycthread.h"
+#ifdef ENABLE_LOOPBACK
+#include "server.h"
+#endif
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,8 +50,28 @@
 static int client_enabled = 0, running = 0, sd = 0, bytes_sent = 0,
            bytes_received = 0, qsize = 0;
 static char *queue = 0;
+static int server_version = 1, sent_updates = -1;
+static int sent_state[POSITION_FIELDS];
+static float sent_x, sent_y, sent_z, sent_rx, sent_ry;
 static thrd_t recv_thread;
 static mtx_t mutex;
+static Record record = {0};
+
+#ifdef ENABLE_LOOPBACK
+/*
+ * Loopback mode runs the server model from server.c on a thread of its
+ * own.  Lines the client sends are appended to `loopback_input` instead
+ * of a socket, and whatever the server queues for its one client is
+ * moved into the same receive queue the socket thread fills.
+ */
+static int loopback = 0, loopback_wake = 0;
+static char loopback_path[1024];
+static char loopback_generator[1024];
+static thrd_t loopback_thread;
+static mtx_t loopback_mutex;
+static cnd_t loopback_cnd;
+static ServerBuffer loopback_input;
+#endif
 
 void client_enable() { client_enabled = 1; }
 
@@ -73,6 +100,17 @@ void client_send(char *data) {
   if (!client_enabled) {
     return;
   }
+  record_write(&record, RECORD_SEND, data, strlen(data));
+#ifdef ENABLE_LOOPBACK
+  if (loopback) {
+    mtx_lock(&loopback_mutex);
+    server_buffer_append(&loopback_input, data, strlen(data));
+    bytes_sent += strlen(data);
+    cnd_signal(&loopback_cnd);
+    mtx_unlock(&loopback_mutex);
+    return;
+  }
+#endif
   if (client_sendall(sd, data, strlen(data)) == -1) {
     perror("client_sendall");
     exit(1);
@@ -97,25 +135,80 @@ void client_login(const char *username, const char *identity_token) {
   client_send(buffer);
 }
 
-void client_position(float x, float y, float z, float rx, float ry) {
+// seconds between updates: often while moving fast, rarely when creeping
+static double position_interval(float speed, float turn) {
+  if (speed > 4 || turn > 2) {
+    return 0.1;
+  }
+  if (speed > 1 || turn > 0.5) {
+    return 0.2;
+  }
+  return 0.4;
+}
+
+/*
+ * Send our position if it changed and enough time has passed since the
+ * last update, `elapsed` seconds ago.  Returns 1 if anything was sent.
+ * Servers that speak the delta protocol get "M" lines against the last
+ * position sent, with a "P" keyframe every so often.
+ */
+int client_position(double elapsed, float x, float y, float z, float rx,
+                    float ry) {
   if (!client_enabled) {
-    return;
+    return 0;
   }
-  static float px, py, pz, prx, pry = 0;
-  float distance = (px - x) * (px - x) + (py - y) * (py - y) +
-                   (pz - z) * (pz - z) + (prx - rx) * (prx - rx) +
-                   (pry - ry) * (pry - ry);
+  const float dx = x - sent_x, dy = y - sent_y, dz = z - sent_z,
+              drx = rx - sent_rx, dry = ry - sent_ry;
+  float distance = dx * dx + dy * dy + dz * dz + drx * drx + dry * dry;
   if (distance < 0.0001) {
-    return;
+    return 0;
   }
-  px = x;
-  py = y;
-  pz = z;
-  prx = rx;
-  pry = ry;
+  if (elapsed < 0.1) {
+    return 0;
+  }
+  const float speed = sqrtf(dx * dx + dy * dy + dz * dz) / elapsed;
+  const float turn = sqrtf(drx * drx + dry * dry) / elapsed;
+  if (elapsed < position_interval(speed, turn)) {
+    return 0;
+  }
+  sent_x = x;
+  sent_y = y;
+  sent_z = z;
+  sent_rx = rx;
+  sent_ry = ry;
   char buffer[1024];
-  snprintf(buffer, 1024, "P,%.2f,%.2f,%.2f,%.2f,%.2f\n", x, y, z, rx, ry);
+  int state[POSITION_FIELDS];
+  quantize_position(state, x, y, z, rx, ry);
+  if (server_version >= PROTOCOL_VERSION_DELTA && sent_updates >= 0 &&
+      sent_updates < KEYFRAME_INTERVAL && !needs_keyframe(state, sent_state)) {
+    if (!format_delta(buffer, 1024, "M", state, sent_state)) {
+      return 1;
+    }
+    sent_updates++;
+  } else {
+    snprintf(buffer, 1024, "P,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+             state[0] / (double)POSITION_SCALE,
+             state[1] / (double)POSITION_SCALE,
+             state[2] / (double)POSITION_SCALE,
+             state[3] / (double)ROTATION_SCALE,
+             state[4] / (double)ROTATION_SCALE);
+    sent_updates = 0;
+  }
+  memcpy(sent_state, state, sizeof(state));
   client_send(buffer);
+  return 1;
+}
+
+// the server announced its protocol version
+void client_server_version(int version) {
+  if (!client_enabled) {
+    return;
+  }
+  if (version >= PROTOCOL_VERSION_DELTA &&
+      server_version < PROTOCOL_VERSION_DELTA) {
+    server_version = PROTOCOL_VERSION_DELTA;
+    client_version(PROTOCOL_VERSION_DELTA);
+  }
 }
 
 void client_chunk(int p, int q, int key) {
@@ -166,6 +259,16 @@ void client_talk(const char *text) {
   client_send(buffer);
 }
 
+// the server only forwards blocks and players within this many chunks
+void client_view(int radius) {
+  if (!client_enabled) {
+    return;
+  }
+  char buffer[1024];
+  snprintf(buffer, 1024, "T,/view %d\n", radius);
+  client_send(buffer);
+}
+
 char *client_recv() {
   if (!client_enabled) {
     return 0;
@@ -187,9 +290,43 @@ char *client_recv() {
     bytes_received += length;
   }
   mtx_unlock(&mutex);
+  if (result) {
+    record_write(&record, RECORD_RECV, result, strlen(result));
+  }
   return result;
 }
 
+/*
+ * Start recording everything sent and received to `path`, or stop if
+ * `path` is NULL.  Returns 0 on success.
+ */
+int client_record(const char *path) {
+  record_close(&record);
+  if (path) {
+    return record_open(&record, path);
+  }
+  return 0;
+}
+
+// blocks while the main thread has not caught up with the queue
+static void enqueue_received(const char *data, int length) {
+  while (1) {
+    int done = 0;
+    mtx_lock(&mutex);
+    if (qsize + length < QUEUE_SIZE) {
+      memcpy(queue + qsize, data, sizeof(char) * length);
+      qsize += length;
+      queue[qsize] = '\0';
+      done = 1;
+    }
+    mtx_unlock(&mutex);
+    if (done || !running) {
+      break;
+    }
+    sleep(0);
+  }
+}
+
 int recv_worker(void *arg) {
   char *data = malloc(sizeof(char) * RECV_SIZE);
   while (1) {
@@ -202,30 +339,109 @@ int recv_worker(void *arg) {
         break;
       }
     }
-    data[length] = '\0';
-    while (1) {
-      int done = 0;
-      mtx_lock(&mutex);
-      if (qsize + length < QUEUE_SIZE) {
-        memcpy(queue + qsize, data, sizeof(char) * (length + 1));
-        qsize += length;
-        done = 1;
+    enqueue_received(data, length);
+  }
+  free(data);
+  return 0;
+}
+
+#ifdef ENABLE_LOOPBACK
+static void loopback_notify(void *arg) {
+  mtx_lock(&loopback_mutex);
+  loopback_wake = 1;
+  cnd_signal(&loopback_cnd);
+  mtx_unlock(&loopback_mutex);
+}
+
+int loopback_worker(void *arg) {
+  ServerConfig config;
+  memset(&config, 0, sizeof(config));
+  config.db_path = loopback_path;
+  config.generator = loopback_generator[0] ? loopback_generator : NULL;
+  config.workers = 2;
+  config.day_length = DAY_LENGTH;
+  config.notify = loopback_notify;
+  if (server_init(&config)) {
+    fprintf(stderr, "could not start the loopback server on %s\n",
+            loopback_path);
+    exit(1);
+  }
+  ServerClient *client = server_connect("loopback", NULL);
+  ServerBuffer input;
+  server_buffer_alloc(&input, RECV_SIZE);
+  while (1) {
+    mtx_lock(&loopback_mutex);
+    if (running && !loopback_input.size && !loopback_wake) {
+      // wake up now and then for the server's timers
+      struct timespec timeout;
+      clock_gettime(CLOCK_REALTIME, &timeout);
+      timeout.tv_nsec += 50000000;
+      if (timeout.tv_nsec >= 1000000000) {
+        timeout.tv_sec++;
+        timeout.tv_nsec -= 1000000000;
       }
-      mtx_unlock(&mutex);
-      if (done) {
-        break;
+      cnd_timedwait(&loopback_cnd, &loopback_mutex, &timeout);
+    }
+    ServerBuffer swap = input;
+    input = loopback_input;
+    loopback_input = swap;
+    loopback_wake = 0;
+    const int stop = !running;
+    mtx_unlock(&loopback_mutex);
+    if (input.size) {
+      server_receive(client, input.data, input.size);
+      input.size = 0;
+    }
+    server_complete_jobs();
+    server_tick();
+    ServerBuffer *output = &client->output;
+    if (output->size) {
+      // hand over whole lines, no more than the queue can ever take
+      int length = output->size;
+      if (length > QUEUE_SIZE / 2) {
+        length = QUEUE_SIZE / 2;
+        while (length && output->data[length - 1] != '\n') {
+          length--;
+        }
       }
-      sleep(0);
+      enqueue_received(output->data, length);
+      server_buffer_consume(output, length);
+    }
+    if (stop) {
+      break;
     }
   }
-  free(data);
+  server_buffer_free(&input);
+  server_shutdown();
   return 0;
 }
 
+/*
+ * Use an in-process server on the world in `path` instead of a socket.
+ * Call instead of client_connect.  `generator` is the one to make the
+ * world with from now on, or "" for the one it was made with.
+ */
+void client_connect_loopback(const char *path, const char *generator) {
+  if (!client_enabled) {
+    return;
+  }
+  server_version = 1;
+  sent_updates = -1;
+  loopback = 1;
+  snprintf(loopback_path, sizeof(loopback_path), "%s", path);
+  snprintf(loopback_generator, sizeof(loopback_generator), "%s", generator);
+}
+#endif
+
 void client_connect(char *hostname, int port) {
   if (!client_enabled) {
     return;
   }
+  server_version = 1;
+  sent_updates = -1;
+#ifdef ENABLE_LOOPBACK
+  loopback = 0;
+#endif
   struct hostent *host;
   struct sockaddr_in address;
   if ((host = gethostbyname(hostname)) == 0) {
@@ -254,6 +470,20 @@ void client_start() {
   queue = (char *)calloc(QUEUE_SIZE, sizeof(char));
   qsize = 0;
   mtx_init(&mutex, mtx_plain);
+#ifdef ENABLE_LOOPBACK
+  if (loopback) {
+    mtx_init(&loopback_mutex, mtx_plain);
+    cnd_init(&loopback_cnd);
+    server_buffer_alloc(&loopback_input, RECV_SIZE);
+    loopback_wake = 0;
+    if (thrd_create(&loopback_thread, loopback_worker, NULL) !=
+        thrd_success) {
+      perror("thrd_create");
+      exit(1);
+    }
+    return;
+  }
+#endif
   if (thrd_create(&recv_thread, recv_worker, NULL) != thrd_success) {
     perror("thrd_create");
     exit(1);
@@ -264,6 +494,23 @@ void client_stop() {
   if (!client_enabled) {
     return;
   }
+#ifdef ENABLE_LOOPBACK
+  if (loopback) {
+    // the server thread owns a database; let it shut down cleanly
+    mtx_lock(&loopback_mutex);
+    running = 0;
+    cnd_signal(&loopback_cnd);
+    mtx_unlock(&loopback_mutex);
+    thrd_join(loopback_thread, NULL);
+    server_buffer_free(&loopback_input);
+    mtx_destroy(&loopback_mutex);
+    cnd_destroy(&loopback_cnd);
+    loopback = 0;
+    qsize = 0;
+    free(queue);
+    return;
+  }
+#endif
   running = 0;
   close(sd);
   // if (thrd_join(recv_thread, NULL) != thrd_success) {
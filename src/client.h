@@ -29,17 +29,22 @@ void client_enable();
 void client_disable();
 int get_client_enabled();
 void client_connect(char *hostname, int port);
+void client_connect_loopback(const char *path, const char *generator);
 void client_start();
 void client_stop();
 void client_send(char *data);
 char *client_recv();
 void client_version(int version);
 void client_login(const char *username, const char *identity_token);
-void client_position(float x, float y, float z, float rx, float ry);
+int client_position(double elapsed, float x, float y, float z, float rx,
+                    float ry);
+void client_server_version(int version);
 void client_chunk(int p, int q, int key);
 void client_block(int x, int y, int z, int w);
 void client_light(int x, int y, int z, int w);
 void client_sign(int x, int y, int z, int face, const char *text);
 void client_talk(const char *text);
+void client_view(int radius);
+int client_record(const char *path);
 
 #endif
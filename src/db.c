@@ -26,6 +26,7 @@
 #include "db.h"
 #include "ring.h"
 #include "sqlite3.h"
+#include "terrain.h"
 #include "tinycthread.h"
 #include <string.h>
 
@@ -42,6 +43,7 @@ static sqlite3_stmt *load_lights_stmt;
 static sqlite3_stmt *load_signs_stmt;
 static sqlite3_stmt *get_key_stmt;
 static sqlite3_stmt *set_key_stmt;
+static TerrainStore terrain;
 
 static Ring ring;
 static thrd_t thrd;
@@ -75,44 +77,13 @@ int db_init(char *path) {
       "   rx float not null,"
       "   ry float not null"
       ");"
-      "create table if not exists block ("
-      "    p int not null,"
-      "    q int not null,"
-      "    x int not null,"
-      "    y int not null,"
-      "    z int not null,"
-      "    w int not null"
-      ");"
-      "create table if not exists light ("
-      "    p int not null,"
-      "    q int not null,"
-      "    x int not null,"
-      "    y int not null,"
-      "    z int not null,"
-      "    w int not null"
-      ");"
       "create table if not exists key ("
       "    p int not null,"
       "    q int not null,"
       "    key int not null"
       ");"
-      "create table if not exists sign ("
-      "    p int not null,"
-      "    q int not null,"
-      "    x int not null,"
-      "    y int not null,"
-      "    z int not null,"
-      "    face int not null,"
-      "    text text not null"
-      ");"
-      "create unique index if not exists block_pqxyz_idx on block (p, q, x, y, "
-      "z);"
-      "create unique index if not exists light_pqxyz_idx on light (p, q, x, y, "
-      "z);"
       "create unique index if not exists key_pq_idx on key (p, q);"
-      "create unique index if not exists sign_xyzface_idx on sign (x, y, z, "
-      "face);"
-      "create index if not exists sign_pq_idx on sign (p, q);";
+      WORLD_SCHEMA;
   static const char *const insert_block_query =
       "insert or replace into block (p, q, x, y, z, w) "
       "values (?, ?, ?, ?, ?, ?);";
@@ -162,6 +133,8 @@ int db_init(char *path) {
   if (rc) return rc;
   rc = sqlite3_prepare_v2(db, set_key_query, -1, &set_key_stmt, NULL);
   if (rc) return rc;
+  rc = terrain_open(&terrain, db);
+  if (rc) return rc;
   sqlite3_exec(db, "begin;", NULL, NULL, NULL);
   db_worker_start();
   return 0;
@@ -183,6 +156,7 @@ void db_close() {
   sqlite3_finalize(load_signs_stmt);
   sqlite3_finalize(get_key_stmt);
   sqlite3_finalize(set_key_stmt);
+  terrain_close(&terrain);
   sqlite3_close(db);
 }
 
@@ -324,6 +298,42 @@ int db_load_state(float *x, float *y, float *z, float *rx, float *ry) {
   return result;
 }
 
+/*
+ * The generator an offline world was made with, by name or plugin path.
+ * The client has no seed of its own, so it is stored without one.
+ */
+void db_save_generator(const char *name) {
+  if (!db_enabled) {
+    return;
+  }
+  static const char *const query =
+      "insert into generator (name, use_seed, seed) values (?, 0, 0);";
+  sqlite3_stmt *stmt;
+  sqlite3_exec(db, "delete from generator;", NULL, NULL, NULL);
+  sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+  sqlite3_bind_text(stmt, 1, name, -1, NULL);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
+int db_load_generator(char *name, int length) {
+  if (!db_enabled) {
+    return 0;
+  }
+  static const char *const query = "select name from generator;";
+  int result = 0;
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    const char *a = (const char *)sqlite3_column_text(stmt, 0);
+    strncpy(name, a, length - 1);
+    name[length - 1] = '\0';
+    result = 1;
+  }
+  sqlite3_finalize(stmt);
+  return result;
+}
+
 void db_insert_block(int p, int q, int x, int y, int z, int w) {
   if (!db_enabled) {
     return;
@@ -448,6 +458,20 @@ void db_load_lights(Map *map, int p, int q) {
   mtx_unlock(&load_mtx);
 }
 
+/*
+ * Load chunk (p, q) of `world`, a terrain_world key, if craft-pregen
+ * stored it.  Returns 1 if it did.
+ */
+int db_load_terrain(WorldChunk *chunk, const char *world, int p, int q) {
+  if (!db_enabled) {
+    return 0;
+  }
+  mtx_lock(&load_mtx);
+  const int result = terrain_load(&terrain, world, p, q, chunk);
+  mtx_unlock(&load_mtx);
+  return result;
+}
+
 void db_load_signs(SignList *list, int p, int q) {
   if (!db_enabled) {
     return;
@@ -23,6 +23,8 @@
 #ifndef _db_h_
 #define _db_h_
 
+#include "world.h"
+
 void db_enable();
 void db_disable();
 int get_db_enabled();
@@ -38,6 +40,8 @@ int db_auth_get_selected(char *username, int username_length,
                          char *identity_token, int identity_token_length);
 void db_save_state(float x, float y, float z, float rx, float ry);
 int db_load_state(float *x, float *y, float *z, float *rx, float *ry);
+void db_save_generator(const char *name);
+int db_load_generator(char *name, int length);
 void db_insert_block(int p, int q, int x, int y, int z, int w);
 void db_insert_light(int p, int q, int x, int y, int z, int w);
 void db_insert_sign(int p, int q, int x, int y, int z, int face,
@@ -48,6 +52,7 @@ void db_delete_all_signs();
 void db_load_blocks(Map *map, int p, int q);
 void db_load_lights(Map *map, int p, int q);
 void db_load_signs(SignList *list, int p, int q);
+int db_load_terrain(WorldChunk *chunk, const char *world, int p, int q);
 int db_get_key(int p, int q);
 void db_set_key(int p, int q, int key);
 void db_worker_start();
@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * craft-genbench: generates a fixed set of chunks for several seeds,
+ * hashes the blocks each chunk emits and its cloud layer, and compares
+ * the hashes with the golden ones below, once on one thread and once on
+ * every core sharing a structure cache.  It then times each stage of the
+ * generator.  A mismatch means the terrain players have built on would
+ * change; when that is intended, bump TERRAIN_VERSION and paste the
+ * output of -g here.
+ */
+
+#include "config.h"
+#include "noise.h"
+#include "terrain.h"
+#include "tinycthread.h"
+#include "world.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_ROUNDS 3
+#define MAX_WORKERS 64
+#define CORPUS_SIZE (sizeof(corpus) / sizeof(corpus[0]))
+#define SEED_COUNT (sizeof(seeds) / sizeof(seeds[0]))
+
+typedef struct {
+  int use_seed;
+  unsigned int seed;
+  uint64_t golden;
+} Seed;
+
+// built with the scalar and the SSE2 noise, which must agree
+static const Seed seeds[] = {
+    {0, 0, 0x5f2e7d570426d249ULL},
+    {1, 1, 0x4b643a65e39149acULL},
+    {1, 42, 0xb0f977435a14672fULL},
+    {1, 2020, 0xbbf705eedd30c6f4ULL},
+};
+
+// a block of chunks around the origin, where worlds start, and a few far
+// out, where float precision differs
+static const int corpus[][2] = {
+    {-3, -3}, {-3, -2}, {-3, -1}, {-3, 0}, {-3, 1}, {-3, 2},
+    {-2, -3}, {-2, -2}, {-2, -1}, {-2, 0}, {-2, 1}, {-2, 2},
+    {-1, -3}, {-1, -2}, {-1, -1}, {-1, 0}, {-1, 1}, {-1, 2},
+    {0, -3},  {0, -2},  {0, -1},  {0, 0},  {0, 1},  {0, 2},
+    {1, -3},  {1, -2},  {1, -1},  {1, 0},  {1, 1},  {1, 2},
+    {2, -3},  {2, -2},  {2, -1},  {2, 0},  {2, 1},  {2, 2},
+    {100, 100}, {-250, 40}, {1000, -1000}, {4000, 4001}, {-9999, -9999},
+};
+
+static const NoiseContext *noise;
+static WorldCache *cache;
+static uint64_t hashes[CORPUS_SIZE];
+static int next_chunk;
+static mtx_t mtx;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// FNV-1a over every block the chunk emits, ring included, so that the
+// hash does not depend on how WorldChunk lays out its volume
+static void _hash_block(int x, int y, int z, int w, void *arg) {
+  uint64_t *hash = arg;
+  const int values[4] = {x, y, z, w};
+  const unsigned char *bytes = (const unsigned char *)values;
+  for (size_t i = 0; i < sizeof(values); i++) {
+    *hash = (*hash ^ bytes[i]) * 0x100000001b3ULL;
+  }
+}
+
+static uint64_t _hash_chunk(const WorldChunk *world) {
+  unsigned char layer[WORLD_ROW * WORLD_ROW];
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  world_chunk_emit(world, _hash_block, &hash);
+  world_clouds(noise, world->p, world->q, layer);
+  for (size_t i = 0; i < sizeof(layer); i++) {
+    hash = (hash ^ layer[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static uint64_t _combine(void) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < CORPUS_SIZE; i++) {
+    hash = (hash ^ hashes[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static int worker_run(void *arg) {
+  WorldChunk world = {0};
+  while (1) {
+    mtx_lock(&mtx);
+    const int i = next_chunk++;
+    mtx_unlock(&mtx);
+    if (i >= (int)CORPUS_SIZE) {
+      break;
+    }
+    world_generate(noise, cache, corpus[i][0], corpus[i][1], &world);
+    hashes[i] = _hash_chunk(&world);
+  }
+  world_chunk_free(&world);
+  return 0;
+}
+
+static uint64_t _hash_threaded(int worker_count) {
+  thrd_t workers[MAX_WORKERS];
+  next_chunk = 0;
+  world_cache_clear(cache);
+  for (int i = 0; i < worker_count; i++) {
+    thrd_create(&workers[i], worker_run, NULL);
+  }
+  for (int i = 0; i < worker_count; i++) {
+    thrd_join(workers[i], NULL);
+  }
+  return _combine();
+}
+
+static uint64_t _hash_serial(int verbose) {
+  WorldChunk world = {0};
+  for (size_t i = 0; i < CORPUS_SIZE; i++) {
+    world_generate(noise, NULL, corpus[i][0], corpus[i][1], &world);
+    hashes[i] = _hash_chunk(&world);
+    if (verbose) {
+      printf("  %6d %6d %016llx\n", corpus[i][0], corpus[i][1],
+             (unsigned long long)hashes[i]);
+    }
+  }
+  world_chunk_free(&world);
+  return _combine();
+}
+
+static void _count_block(int x, int y, int z, int w, void *arg) {
+  (*(int *)arg)++;
+}
+
+// time each stage over the corpus, with a cold structure cache per round
+static void _benchmark(int rounds, int worker_count) {
+  double heightmap = 0, fill = 0, clouds = 0, emit = 0, encode = 0;
+  double threaded = 0;
+  unsigned char layer[WORLD_ROW * WORLD_ROW];
+  WorldChunk world = {0};
+  for (int round = 0; round < rounds; round++) {
+    world_cache_clear(cache);
+    for (size_t i = 0; i < CORPUS_SIZE; i++) {
+      double t0 = now();
+      world_heightmap(noise, corpus[i][0], corpus[i][1], &world);
+      double t1 = now();
+      world_fill(noise, cache, &world);
+      double t2 = now();
+      world_clouds(noise, corpus[i][0], corpus[i][1], layer);
+      double t3 = now();
+      int count = 0;
+      world_chunk_emit(&world, _count_block, &count);
+      double t4 = now();
+      int length;
+      free(terrain_encode(&world, &length));
+      double t5 = now();
+      heightmap += t1 - t0;
+      fill += t2 - t1;
+      clouds += t3 - t2;
+      emit += t4 - t3;
+      encode += t5 - t4;
+    }
+    double t0 = now();
+    _hash_threaded(worker_count);
+    threaded += now() - t0;
+  }
+  world_chunk_free(&world);
+  const double n = (double)rounds * CORPUS_SIZE;
+  printf("per chunk: heightmap %.3f ms, fill %.3f ms, clouds %.3f ms, "
+         "emit %.3f ms, encode %.3f ms\n",
+         heightmap * 1000 / n, fill * 1000 / n, clouds * 1000 / n,
+         emit * 1000 / n, encode * 1000 / n);
+  printf("generate and hash: %.0f chunks/s on 1 thread, %.0f on %d\n",
+         n / (heightmap + fill + clouds + emit), n / threaded, worker_count);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-g] [-v] [-n ROUNDS] [-w WORKERS]\n", name);
+}
+
+int main(int argc, char **argv) {
+  int golden = 0;
+  int verbose = 0;
+  int rounds = DEFAULT_ROUNDS;
+  int worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+  int option;
+  while ((option = getopt(argc, argv, "gvn:w:h")) != -1) {
+    switch (option) {
+      case 'g':
+        golden = 1;
+        break;
+      case 'v':
+        verbose = 1;
+        break;
+      case 'n':
+        rounds = atoi(optarg);
+        break;
+      case 'w':
+        worker_count = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (argc != optind || rounds < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (worker_count < 1) {
+    worker_count = 1;
+  }
+  if (worker_count > MAX_WORKERS) {
+    worker_count = MAX_WORKERS;
+  }
+
+  mtx_init(&mtx, mtx_plain);
+  cache = world_cache_create();
+  NoiseContext context;
+  int failures = 0;
+  for (size_t i = 0; i < SEED_COUNT; i++) {
+    const Seed *seed = seeds + i;
+    if (seed->use_seed) {
+      noise_seed(&context, seed->seed);
+    } else {
+      noise_default(&context);
+    }
+    noise = &context;
+    char name[32] = "built-in";
+    if (seed->use_seed) {
+      snprintf(name, sizeof(name), "seed %u", seed->seed);
+    }
+    if (verbose) {
+      printf("%s:\n", name);
+    }
+    const uint64_t serial = _hash_serial(verbose);
+    const uint64_t threaded = _hash_threaded(worker_count);
+    if (golden) {
+      printf("    {%d, %u, 0x%016llxULL},\n", seed->use_seed, seed->seed,
+             (unsigned long long)serial);
+    }
+    const int ok = golden ? serial == threaded
+                          : serial == seed->golden && threaded == seed->golden;
+    if (!golden || !ok) {
+      printf("%-4s %-10s %016llx", ok ? "ok" : "FAIL", name,
+             (unsigned long long)serial);
+      if (threaded != serial) {
+        printf(", %016llx on %d threads", (unsigned long long)threaded,
+               worker_count);
+      }
+      printf("\n");
+    }
+    failures += !ok;
+  }
+  if (!golden && rounds) {
+    noise_default(&context);
+    noise = &context;
+    _benchmark(rounds, worker_count);
+  }
+  world_cache_destroy(cache);
+  mtx_destroy(&mtx);
+  fflush(stdout);
+  if (failures) {
+    fprintf(stderr, "%d of %d seeds do not match\n", failures,
+            (int)SEED_COUNT);
+  }
+  return failures != 0;
+}
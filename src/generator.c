@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include "generator.h"
+#include "config.h"
+#include "item.h"
+#include "noise.h"
+#include "world.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_GENERATORS 16
+#define FLAT_HEIGHT 12
+
+/*
+ * A registered generator.  The built-in ones fill a WorldChunk directly
+ * and may have clouds; plugins only have their GeneratorInfo, and go
+ * through a dense volume that is packed into the chunk afterwards.
+ */
+typedef struct {
+  const char *name;
+  void *(*init)(int use_seed, unsigned int seed);
+  void (*fill)(void *state, int p, int q, WorldChunk *chunk);
+  void (*clouds)(void *state, int p, int q, unsigned char *layer);
+  void (*free)(void *state);
+  const GeneratorInfo *info;
+} Entry;
+
+struct Generator {
+  const Entry *entry;
+  void *state;
+};
+
+// default: the simplex noise terrain
+
+typedef struct {
+  NoiseContext noise;
+  WorldCache *cache;
+} NoiseWorld;
+
+static void *_noise_init(int use_seed, unsigned int seed) {
+  NoiseWorld *world = malloc(sizeof(NoiseWorld));
+  if (use_seed) {
+    noise_seed(&world->noise, seed);
+  } else {
+    noise_default(&world->noise);
+  }
+  world->cache = world_cache_create();
+  return world;
+}
+
+static void _noise_fill(void *state, int p, int q, WorldChunk *chunk) {
+  NoiseWorld *world = state;
+  world_generate(&world->noise, world->cache, p, q, chunk);
+}
+
+static void _noise_clouds(void *state, int p, int q, unsigned char *layer) {
+  NoiseWorld *world = state;
+  world_clouds(&world->noise, p, q, layer);
+}
+
+static void _noise_free(void *state) {
+  NoiseWorld *world = state;
+  world_cache_destroy(world->cache);
+  free(world);
+}
+
+// flat: the same column everywhere, for timing everything but generation
+
+static void _flat_fill(void *state, int p, int q, WorldChunk *chunk) {
+  char column[FLAT_HEIGHT];
+  for (int y = 0; y < FLAT_HEIGHT; y++) {
+    column[y] = y < FLAT_HEIGHT - 4 ? STONE : DIRT;
+  }
+  column[FLAT_HEIGHT - 1] = GRASS;
+  chunk->p = p;
+  chunk->q = q;
+  world_chunk_clear(chunk, FLAT_HEIGHT);
+  for (int i = 0; i < WORLD_ROW * WORLD_ROW; i++) {
+    chunk->height[i] = FLAT_HEIGHT;
+    chunk->biome[i] = WORLD_BIOME_GRASS;
+    memcpy(chunk->blocks + i * FLAT_HEIGHT, column, FLAT_HEIGHT);
+  }
+  chunk->count = WORLD_ROW * WORLD_ROW * FLAT_HEIGHT;
+}
+
+static Entry entries[MAX_GENERATORS] = {
+    {GENERATOR_DEFAULT, _noise_init, _noise_fill, _noise_clouds, _noise_free,
+     NULL},
+    {"flat", NULL, _flat_fill, NULL, NULL, NULL},
+};
+static int entry_count = 2;
+
+static Entry *_find(const char *name) {
+  for (int i = 0; i < entry_count; i++) {
+    if (strcmp(entries[i].name, name) == 0) {
+      return entries + i;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Add a plugin's generator.  Returns 0 on success, or -1 if it was built
+ * against another GENERATOR_ABI_VERSION, is incomplete, or its name is
+ * taken by another generator.
+ */
+int generator_register(const GeneratorInfo *info) {
+  if (info->abi_version != GENERATOR_ABI_VERSION || !info->name ||
+      !info->name[0] || strlen(info->name) >= MAX_GENERATOR_NAME_LENGTH ||
+      !info->generate) {
+    return -1;
+  }
+  Entry *entry = _find(info->name);
+  if (entry) {
+    return entry->info == info ? 0 : -1;
+  }
+  if (entry_count == MAX_GENERATORS) {
+    return -1;
+  }
+  entry = entries + entry_count++;
+  entry->name = info->name;
+  entry->init = info->init;
+  entry->fill = NULL;
+  entry->clouds = NULL;
+  entry->free = info->free;
+  entry->info = info;
+  return 0;
+}
+
+/*
+ * Load and register the generator in the shared object at `path`.  The
+ * library stays loaded for the life of the process.  Returns NULL if it
+ * could not be loaded or registered.
+ */
+const GeneratorInfo *generator_load(const char *path) {
+#ifdef _WIN32
+  HMODULE handle = LoadLibraryA(path);
+  if (!handle) {
+    return NULL;
+  }
+  const GeneratorInfo *info =
+      (const GeneratorInfo *)GetProcAddress(handle, GENERATOR_SYMBOL);
+  if (!info || generator_register(info)) {
+    FreeLibrary(handle);
+    return NULL;
+  }
+#else
+  void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (!handle) {
+    return NULL;
+  }
+  const GeneratorInfo *info = dlsym(handle, GENERATOR_SYMBOL);
+  if (!info || generator_register(info)) {
+    dlclose(handle);
+    return NULL;
+  }
+#endif
+  return info;
+}
+
+/*
+ * The generator registered as `name` for the world with this seed.  A
+ * name with a path separator in it is loaded as a plugin first.  Returns
+ * NULL if there is no such generator.
+ */
+Generator *generator_create(const char *name, int use_seed,
+                            unsigned int seed) {
+  Entry *entry = _find(name);
+  if (!entry && (strchr(name, '/') || strchr(name, '\\'))) {
+    const GeneratorInfo *info = generator_load(name);
+    entry = info ? _find(info->name) : NULL;
+  }
+  if (!entry) {
+    return NULL;
+  }
+  Generator *generator = malloc(sizeof(Generator));
+  generator->entry = entry;
+  generator->state = entry->init ? entry->init(use_seed, seed) : NULL;
+  return generator;
+}
+
+void generator_destroy(Generator *generator) {
+  if (!generator) {
+    return;
+  }
+  if (generator->entry->free) {
+    generator->entry->free(generator->state);
+  }
+  free(generator);
+}
+
+const char *generator_name(const Generator *generator) {
+  return generator->entry->name;
+}
+
+/*
+ * Generate chunk (p, q) and its ring.  A plugin fills every column to
+ * GENERATOR_HEIGHT; the columns are then cut down to the highest block
+ * of any of them, in place, and each column's height is its highest
+ * block, as plugins have no separate surface.
+ */
+void generator_generate(Generator *generator, int p, int q,
+                        WorldChunk *chunk) {
+  const Entry *entry = generator->entry;
+  if (entry->fill) {
+    entry->fill(generator->state, p, q, chunk);
+    return;
+  }
+  const int columns = WORLD_ROW * WORLD_ROW;
+  chunk->p = p;
+  chunk->q = q;
+  world_chunk_clear(chunk, GENERATOR_HEIGHT);
+  entry->info->generate(generator->state, p, q, CHUNK_SIZE, GENERATOR_HEIGHT,
+                        chunk->blocks);
+  int top = 1;
+  int count = 0;
+  for (int i = 0; i < columns; i++) {
+    const char *column = chunk->blocks + i * GENERATOR_HEIGHT;
+    int h = GENERATOR_HEIGHT;
+    while (h > 0 && !column[h - 1]) {
+      h--;
+    }
+    for (int y = 0; y < h; y++) {
+      count += column[y] != 0;
+    }
+    chunk->height[i] = h;
+    chunk->biome[i] = 0;
+    top = h > top ? h : top;
+  }
+  for (int i = 1; i < columns; i++) {
+    memmove(chunk->blocks + i * top, chunk->blocks + i * GENERATOR_HEIGHT,
+            top);
+  }
+  chunk->top = top;
+  chunk->count = count;
+}
+
+/*
+ * The cloud layer of chunk (p, q), as world_clouds lays it out.  Returns
+ * 0, leaving the layer alone, if the generator has no clouds.
+ */
+int generator_clouds(Generator *generator, int p, int q,
+                     unsigned char *layer) {
+  const Entry *entry = generator->entry;
+  if (!entry->clouds) {
+    return 0;
+  }
+  entry->clouds(generator->state, p, q, layer);
+  return 1;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _generator_h_
+#define _generator_h_
+
+#include "world.h"
+
+#define GENERATOR_ABI_VERSION 1
+#define GENERATOR_SYMBOL "craft_generator"
+#define GENERATOR_DEFAULT "default"
+#define GENERATOR_HEIGHT 256
+#define MAX_GENERATOR_NAME_LENGTH 32
+
+/*
+ * What a generator plugin exports, as a `const GeneratorInfo` named
+ * craft_generator.  `init` makes the state of one world from its seed
+ * (seed is 0 when use_seed is not set); `generate` may be called from
+ * several threads at once with the same state.  It fills chunk (p, q) and
+ * the ring of columns around it into `blocks`, which holds
+ * (size + 2) * (size + 2) columns of `height` zeroed blocks: column
+ * (dx, dz), with dx and dz from -1 to size, starts at
+ * ((dx + 1) * (size + 2) + dz + 1) * height.  Columns in the ring must
+ * come out the same as they do in the chunk that owns them.
+ */
+typedef struct {
+  int abi_version;  // GENERATOR_ABI_VERSION
+  const char *name;
+  void *(*init)(int use_seed, unsigned int seed);
+  void (*generate)(void *state, int p, int q, int size, int height,
+                   char *blocks);
+  void (*free)(void *state);
+} GeneratorInfo;
+
+// One world's instance of a generator.
+typedef struct Generator Generator;
+
+// The built-in generators are always registered.  Not thread safe.
+int generator_register(const GeneratorInfo *info);
+const GeneratorInfo *generator_load(const char *path);
+Generator *generator_create(const char *name, int use_seed, unsigned int seed);
+void generator_destroy(Generator *generator);
+const char *generator_name(const Generator *generator);
+void generator_generate(Generator *generator, int p, int q,
+                        WorldChunk *chunk);
+int generator_clouds(Generator *generator, int p, int q, unsigned char *layer);
+
+#endif
@@ -56,6 +56,8 @@
 uint32_t texture, font, sky, sign;
 
 Block_Attributes block_attrib;
+Block_Attributes opaque_attrib;  // the block shader, for faces with no holes
+Block_Attributes player_attrib;  // the block shader, one cube per player
 Line_Attributes line_attrib;
 Text_Attributes text_attrib;
 Sky_Attributes sky_attrib;
@@ -87,6 +89,13 @@ GLuint gl_gen_buffer(GLsizei size, const float *const data) {
 
 void gl_del_buffer(GLuint buffer) { glDeleteBuffers(1, &buffer); }
 
+// Replace what is in `buffer`, for data that changes from frame to frame.
+void gl_update_buffer(GLuint buffer, GLsizei size, const float *const data) {
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glBufferData(GL_ARRAY_BUFFER, size, data, GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 GLuint gl_gen_faces(int components, int faces, float *data) {
   GLuint buffer = gl_gen_buffer(sizeof(float) * 6 * components * faces, data);
   free(data);
@@ -118,6 +127,23 @@ GLuint gl_load_shader(GLenum type, const char *const path) {
   return result;
 }
 
+// The shader at `path`, with `defines` put in after its #version line.
+GLuint gl_load_shader_defines(GLenum type, const char *const path,
+                              const char *const defines) {
+  char *data = load_file(path);
+  const char *rest = strchr(data, '\n');
+  rest = rest ? rest + 1 : data + strlen(data);
+  const size_t version = rest - data;
+  char *source = malloc(strlen(data) + strlen(defines) + 1);
+  memcpy(source, data, version);
+  strcpy(source + version, defines);
+  strcat(source, rest);
+  GLuint result = gl_make_shader(type, source);
+  free(source);
+  free(data);
+  return result;
+}
+
 GLuint gl_make_program(GLuint shader1, GLuint shader2) {
   GLuint program = glCreateProgram();
   glAttachShader(program, shader1);
@@ -222,22 +248,14 @@ exit:
   return return_code;
 }
 
-void gl_initiliaze_global_state() {
-  glEnable(GL_CULL_FACE);
-  glEnable(GL_DEPTH_TEST);
-  glLogicOp(GL_INVERT);
-  glClearColor(0, 0, 0, 1);
-
-#define SHADER_DIR RESOURCE_PATH "/shaders/"
-
-  int32_t program = gl_load_program(SHADER_DIR "block_vertex.glsl",
-                                    SHADER_DIR "block_fragment.glsl");
-  // initiliaze shaders
-  block_attrib = (Block_Attributes){
+static Block_Attributes _block_attributes(GLuint program) {
+  return (Block_Attributes){
       .program = program,
       .position = glGetAttribLocation(program, "position"),
       .normal = glGetAttribLocation(program, "normal"),
       .uv = glGetAttribLocation(program, "uv"),
+      .offset = glGetAttribLocation(program, "offset"),
+      .rotation = glGetAttribLocation(program, "rotation"),
       .matrix = glGetUniformLocation(program, "matrix"),
       .sampler = glGetUniformLocation(program, "sampler"),
       .camera = glGetUniformLocation(program, "camera"),
@@ -248,9 +266,31 @@ void gl_initiliaze_global_state() {
       .ortho = glGetUniformLocation(program, "ortho"),
       .enable_ambient_occlusion =
           glGetUniformLocation(program, "enable_ambient_occlusion")};
+}
 
-  program = gl_load_program(SHADER_DIR "line_vertex.glsl",
-                            SHADER_DIR "line_fragment.glsl");
+void gl_initiliaze_global_state() {
+  glEnable(GL_CULL_FACE);
+  glEnable(GL_DEPTH_TEST);
+  glLogicOp(GL_INVERT);
+  glClearColor(0, 0, 0, 1);
+
+#define SHADER_DIR RESOURCE_PATH "/shaders/"
+
+  // initiliaze shaders
+  block_attrib = _block_attributes(gl_load_program(
+      SHADER_DIR "block_vertex.glsl", SHADER_DIR "block_fragment.glsl"));
+  opaque_attrib = _block_attributes(gl_make_program(
+      gl_load_shader(GL_VERTEX_SHADER, SHADER_DIR "block_vertex.glsl"),
+      gl_load_shader_defines(GL_FRAGMENT_SHADER,
+                             SHADER_DIR "block_fragment.glsl",
+                             "#define OPAQUE\n")));
+  player_attrib = _block_attributes(gl_make_program(
+      gl_load_shader_defines(GL_VERTEX_SHADER, SHADER_DIR "block_vertex.glsl",
+                             "#define PLAYER\n"),
+      gl_load_shader(GL_FRAGMENT_SHADER, SHADER_DIR "block_fragment.glsl")));
+
+  int32_t program = gl_load_program(SHADER_DIR "line_vertex.glsl",
+                                    SHADER_DIR "line_fragment.glsl");
   line_attrib =
       (Line_Attributes){.program = program,
                         .position = glGetAttribLocation(program, "position"),
@@ -309,27 +349,41 @@ void gl_initiliaze_textures() {
   gl_load_png_texture(TEXTURE_DIR "sign.png");
 }
 
+static void _setup_blocks(
+    const Block_Attributes *const attrib, const float *const matrix,
+    const PositionAndOrientation *const positionAndOrientation, float light) {
+  glUseProgram(attrib->program);
+  glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
+  glUniform3f(attrib->camera, positionAndOrientation->x,
+              positionAndOrientation->y, positionAndOrientation->z);
+  glUniform1i(attrib->sampler, 0);
+  glUniform1i(attrib->sky_sampler, 1);
+  glUniform1f(attrib->daylight, light);
+  glUniform1f(attrib->fog_distance, (float)g->render_radius * CHUNK_SIZE);
+  glUniform1i(attrib->ortho, g->ortho);
+  glUniform1i(attrib->enable_ambient_occlusion, enable_ambient_occlusion);
+  glUniform1f(attrib->timer, time_of_day());
+}
+
+/*
+ * Set up both block programs, and start with the opaque one.  The
+ * cutout faces are drawn after it, see gl_setup_render_cutout.
+ */
 void gl_setup_render_chunks(
     const float *const matrix,
     const PositionAndOrientation *const positionAndOrientation, float light) {
-  glUseProgram(block_attrib.program);
-  glUniformMatrix4fv(block_attrib.matrix, 1, GL_FALSE, matrix);
-  glUniform3f(block_attrib.camera, positionAndOrientation->x,
-              positionAndOrientation->y, positionAndOrientation->z);
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, texture);
-  glUniform1i(block_attrib.sampler, 0);
   glActiveTexture(GL_TEXTURE1);
   glBindTexture(GL_TEXTURE_2D, sky);
-  glUniform1i(block_attrib.sky_sampler, 1);
-  glUniform1f(block_attrib.daylight, light);
-  glUniform1f(block_attrib.fog_distance, (float)g->render_radius * CHUNK_SIZE);
-  glUniform1i(block_attrib.ortho, g->ortho);
-  glUniform1i(block_attrib.enable_ambient_occlusion, enable_ambient_occlusion);
-  glUniform1f(block_attrib.timer, time_of_day());
+  _setup_blocks(&block_attrib, matrix, positionAndOrientation, light);
+  _setup_blocks(&opaque_attrib, matrix, positionAndOrientation, light);
 }
 
-void gl_render_chunk(const Chunk *const chunk) {
+void gl_setup_render_cutout() { glUseProgram(block_attrib.program); }
+
+static void _draw_blocks(const Block_Attributes *const attrib, GLuint buffer,
+                         int first, int faces) {
   // TODO -
   // make and initilize the VAO once at initilization time.
   // only thing that should happen here
@@ -338,28 +392,41 @@ void gl_render_chunk(const Chunk *const chunk) {
   // 4) draw arrays 5) cleanup
   // also, remove magic numbers, like 6
 
-  // draw chunk
   GLuint vertexArrayID;
   glGenVertexArrays(1, &vertexArrayID);
   glBindVertexArray(vertexArrayID);
-  glBindBuffer(GL_ARRAY_BUFFER, chunk->buffer);
-  glEnableVertexAttribArray(block_attrib.position);
-  glEnableVertexAttribArray(block_attrib.normal);
-  glEnableVertexAttribArray(block_attrib.uv);
-  glVertexAttribPointer(block_attrib.position, 3, GL_FLOAT, GL_FALSE,
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glEnableVertexAttribArray(attrib->position);
+  glEnableVertexAttribArray(attrib->normal);
+  glEnableVertexAttribArray(attrib->uv);
+  glVertexAttribPointer(attrib->position, 3, GL_FLOAT, GL_FALSE,
                         sizeof(float) * 10, 0);
-  glVertexAttribPointer(block_attrib.normal, 3, GL_FLOAT, GL_FALSE,
+  glVertexAttribPointer(attrib->normal, 3, GL_FLOAT, GL_FALSE,
                         sizeof(float) * 10, (GLvoid *)(sizeof(float) * 3));
-  glVertexAttribPointer(block_attrib.uv, 4, GL_FLOAT, GL_FALSE,
-                        sizeof(float) * 10, (GLvoid *)(sizeof(float) * 6));
-  glDrawArrays(GL_TRIANGLES, 0, chunk->faces * 6);
-  glDisableVertexAttribArray(block_attrib.position);
-  glDisableVertexAttribArray(block_attrib.normal);
-  glDisableVertexAttribArray(block_attrib.uv);
+  glVertexAttribPointer(attrib->uv, 4, GL_FLOAT, GL_FALSE, sizeof(float) * 10,
+                        (GLvoid *)(sizeof(float) * 6));
+  glDrawArrays(GL_TRIANGLES, first * 6, faces * 6);
+  glDisableVertexAttribArray(attrib->position);
+  glDisableVertexAttribArray(attrib->normal);
+  glDisableVertexAttribArray(attrib->uv);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
   glDeleteVertexArrays(1, &vertexArrayID);
 }
 
+void gl_render_section(const Section *const section) {
+  _draw_blocks(&opaque_attrib, section->buffer, 0,
+               section->faces - section->cutout_faces);
+}
+
+void gl_render_section_cutout(const Section *const section) {
+  _draw_blocks(&block_attrib, section->buffer,
+               section->faces - section->cutout_faces, section->cutout_faces);
+}
+
+void gl_render_clouds(const Chunk *const chunk) {
+  _draw_blocks(&opaque_attrib, chunk->cloud_buffer, 0, chunk->cloud_faces);
+}
+
 void gl_draw_triangles_3d_text(GLuint buffer, int count) {
   GLuint vertexArrayID;
   glGenVertexArrays(1, &vertexArrayID);
@@ -431,45 +498,49 @@ void gl_render_sign(const float *const matrix, int x, int y, int z, int face) {
 
 void gl_setup_render_players(
     const float *const matrix,
-    const PositionAndOrientation *const positionAndOrientation) {
-  glUseProgram(block_attrib.program);
-  glUniformMatrix4fv(block_attrib.matrix, 1, GL_FALSE, matrix);
-  glUniform3f(block_attrib.camera, positionAndOrientation->x,
-              positionAndOrientation->y, positionAndOrientation->z);
+    const PositionAndOrientation *const positionAndOrientation, float light) {
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, texture);
-  glUniform1i(block_attrib.sampler, 0);
-  glUniform1i(block_attrib.enable_ambient_occlusion, enable_ambient_occlusion);
-  glUniform1f(block_attrib.timer, time_of_day());
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, sky);
+  _setup_blocks(&player_attrib, matrix, positionAndOrientation, light);
 }
 
-void gl_render_player(const Player *const other_player) {
-  // TODO -
-  // make and initilize the VAO once at initilization time.
-  // only thing that should happen here
-  // is 1) binding the vao, 2) binding the vbo,
-  // 3) setting the vertexattribpointers
-  // 4) draw arrays 5) cleanup
-  // also, remove magic numbers, like 36
-
-  // draw player
+/*
+ * Draw `count` players in one call: the cube in `buffer`, as make_player
+ * makes it at the origin, once for each x, y, z, rx, ry in `instances`.
+ */
+void gl_render_players(GLuint buffer, GLuint instances, int count) {
   GLuint vertexArrayID;
   glGenVertexArrays(1, &vertexArrayID);
   glBindVertexArray(vertexArrayID);
-  glBindBuffer(GL_ARRAY_BUFFER, other_player->buffer);
-  glEnableVertexAttribArray(block_attrib.position);
-  glEnableVertexAttribArray(block_attrib.normal);
-  glEnableVertexAttribArray(block_attrib.uv);
-  glVertexAttribPointer(block_attrib.position, 3, GL_FLOAT, GL_FALSE,
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glEnableVertexAttribArray(player_attrib.position);
+  glEnableVertexAttribArray(player_attrib.normal);
+  glEnableVertexAttribArray(player_attrib.uv);
+  glVertexAttribPointer(player_attrib.position, 3, GL_FLOAT, GL_FALSE,
                         sizeof(float) * 10, 0);
-  glVertexAttribPointer(block_attrib.normal, 3, GL_FLOAT, GL_FALSE,
+  glVertexAttribPointer(player_attrib.normal, 3, GL_FLOAT, GL_FALSE,
                         sizeof(float) * 10, (GLvoid *)(sizeof(float) * 3));
-  glVertexAttribPointer(block_attrib.uv, 4, GL_FLOAT, GL_FALSE,
+  glVertexAttribPointer(player_attrib.uv, 4, GL_FLOAT, GL_FALSE,
                         sizeof(float) * 10, (GLvoid *)(sizeof(float) * 6));
-  glDrawArrays(GL_TRIANGLES, 0, 36);
-  glDisableVertexAttribArray(block_attrib.position);
-  glDisableVertexAttribArray(block_attrib.normal);
-  glDisableVertexAttribArray(block_attrib.uv);
+  glBindBuffer(GL_ARRAY_BUFFER, instances);
+  glEnableVertexAttribArray(player_attrib.offset);
+  glEnableVertexAttribArray(player_attrib.rotation);
+  glVertexAttribPointer(player_attrib.offset, 3, GL_FLOAT, GL_FALSE,
+                        sizeof(float) * 5, 0);
+  glVertexAttribPointer(player_attrib.rotation, 2, GL_FLOAT, GL_FALSE,
+                        sizeof(float) * 5, (GLvoid *)(sizeof(float) * 3));
+  glVertexAttribDivisor(player_attrib.offset, 1);
+  glVertexAttribDivisor(player_attrib.rotation, 1);
+  glDrawArraysInstanced(GL_TRIANGLES, 0, 36, count);
+  glVertexAttribDivisor(player_attrib.offset, 0);
+  glVertexAttribDivisor(player_attrib.rotation, 0);
+  glDisableVertexAttribArray(player_attrib.position);
+  glDisableVertexAttribArray(player_attrib.normal);
+  glDisableVertexAttribArray(player_attrib.uv);
+  glDisableVertexAttribArray(player_attrib.offset);
+  glDisableVertexAttribArray(player_attrib.rotation);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
   glDeleteVertexArrays(1, &vertexArrayID);
 }
@@ -561,8 +632,13 @@ void gl_render_wireframe(const float *const matrix, int hx, int hy, int hz) {
   glDisable(GL_COLOR_LOGIC_OP);
 }
 
-void gl_render_text(const float *const matrix, int justify, float x, float y,
-                    float n, const char *const text) {
+// Draw the `length` characters of text in `buffer`.
+void gl_render_text(const float *const matrix, GLuint buffer, int length) {
+  // the vertex array is kept, as text is drawn every frame
+  static GLuint vertexArrayID;
+  if (!vertexArrayID) {
+    glGenVertexArrays(1, &vertexArrayID);
+  }
   glUseProgram(text_attrib.program);
   glUniformMatrix4fv(text_attrib.matrix, 1, GL_FALSE, matrix);
   glActiveTexture(GL_TEXTURE0);
@@ -570,28 +646,13 @@ void gl_render_text(const float *const matrix, int justify, float x, float y,
   glUniform1i(text_attrib.sampler, 0);
   // extra1 = is_sign
   glUniform1i(text_attrib.is_sign, 0);
-  int length = (int)strlen(text);
-  x -= n * justify * (length - 1) / 2;
-  GLuint text_buffer;
-  {
-    // initialize text_buffer
-    const int length = (int)strlen(text);
-    float *data = malloc_faces(4, length);
-    for (int i = 0; i < length; i++) {
-      make_character(data + i * 24, x, y, n / 2, n, text[i]);
-      x += n;
-    }
-    text_buffer = gl_gen_faces(4, length, data);
-  }
   // draw text
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-  GLuint vertexArrayID;
-  glGenVertexArrays(1, &vertexArrayID);
   glBindVertexArray(vertexArrayID);
 
-  glBindBuffer(GL_ARRAY_BUFFER, text_buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
   glEnableVertexAttribArray(text_attrib.position);
   glEnableVertexAttribArray(text_attrib.uv);
   glVertexAttribPointer(text_attrib.position, 2, GL_FLOAT, GL_FALSE,
@@ -602,12 +663,9 @@ void gl_render_text(const float *const matrix, int justify, float x, float y,
   glDisableVertexAttribArray(text_attrib.position);
   glDisableVertexAttribArray(text_attrib.uv);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-  glDeleteVertexArrays(1, &vertexArrayID);
+  glBindVertexArray(0);
 
   glDisable(GL_BLEND);
-
-  gl_del_buffer(text_buffer);
 }
 
 void gl_render_item(const float *const matrix) {
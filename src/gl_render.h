@@ -35,9 +35,12 @@ void gl_scissor(GLint x_min, GLint y_min, GLsizei x_width, GLsizei y_height);
 
 GLuint gl_gen_buffer(GLsizei size, const float *const data);
 void gl_del_buffer(GLuint buffer);
+void gl_update_buffer(GLuint buffer, GLsizei size, const float *const data);
 GLuint gl_gen_faces(int components, int faces, float *data);
 GLuint gl_make_shader(GLenum type, const char *const source);
 GLuint gl_load_shader(GLenum type, const char *const path);
+GLuint gl_load_shader_defines(GLenum type, const char *const path,
+                              const char *const defines);
 GLuint gl_make_program(GLuint shader1, GLuint shader2);
 GLuint gl_load_program(const char *path1, const char *path2);
 void gl_load_png_texture(const char *file_name);
@@ -50,7 +53,13 @@ void gl_setup_render_chunks(
     const float *matrix,
     const PositionAndOrientation *const positionAndOrientation, float light);
 
-void gl_render_chunk(const Chunk *const chunk);
+void gl_render_section(const Section *const section);
+
+void gl_setup_render_cutout();
+
+void gl_render_section_cutout(const Section *const section);
+
+void gl_render_clouds(const Chunk *const chunk);
 
 void gl_draw_triangles_3d_text(GLuint buffer, int count);
 
@@ -62,9 +71,9 @@ void gl_render_sign(const float *const matrix, int x, int y, int z, int face);
 
 void gl_setup_render_players(
     const float *const matrix,
-    const PositionAndOrientation *const positionAndOrientation);
+    const PositionAndOrientation *const positionAndOrientation, float light);
 
-void gl_render_player(const Player *const other_player);
+void gl_render_players(GLuint buffer, GLuint instances, int count);
 
 void gl_render_sky(GLuint buffer, const float *const matrix);
 
@@ -72,8 +81,7 @@ void gl_draw_lines(GLuint buffer, int components, int count);
 
 void gl_render_wireframe(const float *const matrix, int hx, int hy, int hz);
 
-void gl_render_text(const float *const matrix, int justify, float x, float y,
-                    float n, const char *const text);
+void gl_render_text(const float *const matrix, GLuint buffer, int length);
 
 void gl_render_item(const float *const matrix);
 
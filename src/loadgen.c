@@ -0,0 +1,549 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * craft-loadgen: puts load on a server, either by replaying a session
+ * recorded with the client's /record command, or with synthetic bots
+ * that walk, build and chat.  Once a second it prints how many messages
+ * went each way, how long chunk requests took to answer and, from the
+ * server's /stats command, how long the server's loop took.
+ */
+
+#include "config.h"
+#include "record.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT "4080"
+#define MAX_PENDING_CHUNKS 256
+#define MAX_LATENCIES 65536
+#define RECV_SIZE 65536
+#define LINE_SIZE 1024
+
+typedef struct {
+  int p;
+  int q;
+  double time;
+} PendingChunk;
+
+typedef struct {
+  int index;
+  int fd;
+  char *input;
+  int input_size;
+  // what the server was not ready to take yet, sent before anything else
+  char *output;
+  int output_size;
+  int output_capacity;
+  // synthetic bots
+  float x;
+  float z;
+  float heading;
+  int p;
+  int q;
+  int placed;
+  double next_move;
+  double next_build;
+  double next_chat;
+  // replaying bots
+  int entry;
+  PendingChunk pending[MAX_PENDING_CHUNKS];
+  int pending_count;
+} Bot;
+
+typedef struct {
+  long sent;
+  long received;
+  long sent_bytes;
+  long received_bytes;
+  long received_by_type[128];
+  double latencies[MAX_LATENCIES];
+  int latency_count;
+  char server_stats[LINE_SIZE];
+} Stats;
+
+static int bot_count = 10;
+static double duration = 60;
+static double move_rate = 10;
+static double build_rate = 0.5;
+static double chat_rate = 0.05;
+static double speed = 1;
+static int spread = 256;
+static int view = 3;
+static const char *recording;
+static RecordEntry *entries;
+static int entry_count;
+
+static Bot *bots;
+static Stats stats;
+static int epoll_fd = -1;
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(int signal) { stopping = 1; }
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double frand() { return rand() / (RAND_MAX + 1.0); }
+
+// the time until the next event of something that happens `rate` times a
+// second on average
+static double next_event(double rate) {
+  if (rate <= 0) {
+    return 1e30;
+  }
+  return -log(1 - frand()) / rate;
+}
+
+static int chunked(float x) { return floorf(roundf(x) / CHUNK_SIZE); }
+
+static int connect_to(const char *host, const char *port) {
+  struct addrinfo hints, *result, *info;
+  int fd = -1;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &result)) {
+    return -1;
+  }
+  for (info = result; info; info = info->ai_next) {
+    fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (connect(fd, info->ai_addr, info->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  if (fd >= 0) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
+// whether to wake up when the bot's socket can take more
+static void bot_watch(Bot *bot, int writable) {
+  struct epoll_event event;
+  event.events = EPOLLIN | (writable ? EPOLLOUT : 0);
+  event.data.ptr = bot;
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, bot->fd, &event);
+}
+
+// sends what the socket will take; returns how much, or -1 if it failed
+static int bot_write(Bot *bot, const char *data, int length) {
+  int sent = 0;
+  while (sent < length) {
+    ssize_t n = send(bot->fd, data + sent, length - sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      fprintf(stderr, "bot %d: send failed\n", bot->index);
+      stopping = 1;
+      return -1;
+    }
+    sent += n;
+    stats.sent_bytes += n;
+  }
+  return sent;
+}
+
+/*
+ * Sends everything, in order.  What the server is not ready for is kept
+ * and sent when it is; a load generator that drops its own load is no
+ * use.
+ */
+static void send_all(Bot *bot, const char *data, int length) {
+  if (!bot->output_size) {
+    const int sent = bot_write(bot, data, length);
+    if (sent < 0) {
+      return;
+    }
+    data += sent;
+    length -= sent;
+    if (!length) {
+      return;
+    }
+    bot_watch(bot, 1);
+  }
+  if (bot->output_size + length > bot->output_capacity) {
+    bot->output_capacity = (bot->output_size + length) * 2;
+    bot->output = realloc(bot->output, bot->output_capacity);
+  }
+  memcpy(bot->output + bot->output_size, data, length);
+  bot->output_size += length;
+}
+
+static void bot_flush(Bot *bot) {
+  const int sent = bot_write(bot, bot->output, bot->output_size);
+  if (sent <= 0) {
+    return;
+  }
+  memmove(bot->output, bot->output + sent, bot->output_size - sent);
+  bot->output_size -= sent;
+  if (!bot->output_size) {
+    bot_watch(bot, 0);
+  }
+}
+
+static void bot_send(Bot *bot, const char *format, ...) {
+  char line[LINE_SIZE];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (line[0] == 'C' && bot->pending_count < MAX_PENDING_CHUNKS) {
+    PendingChunk *pending = bot->pending + bot->pending_count++;
+    sscanf(line, "C,%d,%d", &pending->p, &pending->q);
+    pending->time = now();
+  }
+  stats.sent++;
+  send_all(bot, line, length);
+}
+
+static void on_line(Bot *bot, const char *line) {
+  int p, q;
+  stats.received++;
+  stats.received_by_type[line[0] & 0x7f]++;
+  if (sscanf(line, "C,%d,%d", &p, &q) == 2) {
+    for (int i = 0; i < bot->pending_count; i++) {
+      PendingChunk *pending = bot->pending + i;
+      if (pending->p == p && pending->q == q) {
+        if (stats.latency_count < MAX_LATENCIES) {
+          stats.latencies[stats.latency_count++] = now() - pending->time;
+        }
+        *pending = bot->pending[--bot->pending_count];
+        break;
+      }
+    }
+  } else if (!strncmp(line, "T,Stats: ", 9)) {
+    snprintf(stats.server_stats, LINE_SIZE, "%s", line + 9);
+  }
+}
+
+static void bot_read(Bot *bot) {
+  while (1) {
+    if (bot->input_size == RECV_SIZE) {
+      // a single line longer than the buffer; drop it
+      bot->input_size = 0;
+    }
+    ssize_t n = recv(bot->fd, bot->input + bot->input_size,
+                     RECV_SIZE - bot->input_size, 0);
+    if (n == 0) {
+      fprintf(stderr, "bot %d: disconnected\n", bot->index);
+      stopping = 1;
+      return;
+    }
+    if (n < 0) {
+      return;
+    }
+    stats.received_bytes += n;
+    bot->input_size += n;
+    int start = 0;
+    for (int i = 0; i < bot->input_size; i++) {
+      if (bot->input[i] == '\n') {
+        bot->input[i] = '\0';
+        on_line(bot, bot->input + start);
+        start = i + 1;
+      }
+    }
+    memmove(bot->input, bot->input + start, bot->input_size - start);
+    bot->input_size -= start;
+  }
+}
+
+// ask for the chunks around the bot that it has not asked for yet
+static void request_chunks(Bot *bot, int old_p, int old_q, int all) {
+  for (int dp = -view; dp <= view; dp++) {
+    for (int dq = -view; dq <= view; dq++) {
+      const int p = bot->p + dp;
+      const int q = bot->q + dq;
+      if (!all && abs(p - old_p) <= view && abs(q - old_q) <= view) {
+        continue;
+      }
+      bot_send(bot, "C,%d,%d,0\n", p, q);
+    }
+  }
+}
+
+static void bot_start(Bot *bot, double start) {
+  if (recording) {
+    // the recording begins with the client's own handshake
+    return;
+  }
+  bot_send(bot, "V,1\n");
+  bot_send(bot, "A,,\n");
+  bot->x = (frand() - 0.5) * spread;
+  bot->z = (frand() - 0.5) * spread;
+  bot->heading = frand() * 2 * M_PI;
+  bot->p = chunked(bot->x);
+  bot->q = chunked(bot->z);
+  bot->next_move = start + frand() / move_rate;
+  bot->next_build = start + next_event(build_rate);
+  bot->next_chat = start + next_event(chat_rate);
+  bot_send(bot, "P,%.2f,%.2f,%.2f,%.2f,%.2f\n", bot->x, 60.0, bot->z,
+           bot->heading, 0.0);
+  request_chunks(bot, 0, 0, 1);
+}
+
+static void bot_update(Bot *bot, double start, double t) {
+  if (recording) {
+    // replay what the recorded client sent, at the recorded times
+    while (bot->entry < entry_count) {
+      RecordEntry *entry = entries + bot->entry;
+      if (entry->direction != RECORD_SEND) {
+        bot->entry++;
+        continue;
+      }
+      if (start + entry->time / speed > t) {
+        break;
+      }
+      char *line = entry->data;
+      while (*line) {
+        char *end = strchr(line, '\n');
+        int length = end ? end - line + 1 : (int)strlen(line);
+        if (line[0] == 'C' && bot->pending_count < MAX_PENDING_CHUNKS) {
+          PendingChunk *pending = bot->pending + bot->pending_count++;
+          sscanf(line, "C,%d,%d", &pending->p, &pending->q);
+          pending->time = t;
+        }
+        stats.sent++;
+        send_all(bot, line, length);
+        line += length;
+      }
+      bot->entry++;
+    }
+    return;
+  }
+  if (t >= bot->next_move) {
+    const float step = 4.0 / move_rate;
+    bot->heading += (frand() - 0.5) * 0.5;
+    bot->x += cosf(bot->heading) * step;
+    bot->z += sinf(bot->heading) * step;
+    bot_send(bot, "P,%.2f,%.2f,%.2f,%.2f,%.2f\n", bot->x, 60.0, bot->z,
+             bot->heading, 0.0);
+    const int old_p = bot->p, old_q = bot->q;
+    bot->p = chunked(bot->x);
+    bot->q = chunked(bot->z);
+    if (bot->p != old_p || bot->q != old_q) {
+      request_chunks(bot, old_p, old_q, 0);
+    }
+    bot->next_move += 1 / move_rate;
+  }
+  if (t >= bot->next_build) {
+    // build a block above the bot's head and take it away again
+    const int x = roundf(bot->x), z = roundf(bot->z);
+    bot_send(bot, "B,%d,%d,%d,%d\n", x, 100 + bot->index % 100, z,
+             bot->placed ? 0 : 1 + rand() % 15);
+    bot->placed = !bot->placed;
+    bot->next_build += next_event(build_rate);
+  }
+  if (t >= bot->next_chat) {
+    bot_send(bot, "T,hello from bot %d\n", bot->index);
+    bot->next_chat += next_event(chat_rate);
+  }
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  const double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void report(double elapsed) {
+  const char *types = "BCDEKLMNPRSTUV";
+  double average = 0, p99 = 0, max = 0;
+  if (stats.latency_count) {
+    qsort(stats.latencies, stats.latency_count, sizeof(double),
+          compare_doubles);
+    for (int i = 0; i < stats.latency_count; i++) {
+      average += stats.latencies[i];
+    }
+    average /= stats.latency_count;
+    p99 = stats.latencies[(int)(stats.latency_count * 0.99)];
+    max = stats.latencies[stats.latency_count - 1];
+  }
+  printf("sent %.0f/s (%.1f KB/s)  received %.0f/s (%.1f KB/s)\n",
+         stats.sent / elapsed, stats.sent_bytes / elapsed / 1024,
+         stats.received / elapsed, stats.received_bytes / elapsed / 1024);
+  printf("  by type:");
+  for (const char *type = types; *type; type++) {
+    if (stats.received_by_type[(int)*type]) {
+      printf(" %c %.0f/s", *type, stats.received_by_type[(int)*type] / elapsed);
+    }
+  }
+  printf("\n  chunks: %d answered, latency avg %.1f ms, p99 %.1f ms, "
+         "max %.1f ms\n",
+         stats.latency_count, average * 1000, p99 * 1000, max * 1000);
+  if (stats.server_stats[0]) {
+    printf("  server: %s\n", stats.server_stats);
+  }
+  fflush(stdout);
+  memset(&stats, 0, sizeof(stats));
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-n BOTS] [-t SECONDS] [-r RECORDING] [-x SPEED]\n"
+          "       [-m MOVES/S] [-b BUILDS/S] [-c CHATS/S] [-s SPREAD] "
+          "[-v VIEW]\n"
+          "       [HOST [PORT]]\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  const char *host = DEFAULT_HOST;
+  const char *port = DEFAULT_PORT;
+  int option;
+  while ((option = getopt(argc, argv, "n:t:r:x:m:b:c:s:v:h")) != -1) {
+    switch (option) {
+      case 'n':
+        bot_count = atoi(optarg);
+        break;
+      case 't':
+        duration = atof(optarg);
+        break;
+      case 'r':
+        recording = optarg;
+        break;
+      case 'x':
+        speed = atof(optarg);
+        break;
+      case 'm':
+        move_rate = atof(optarg);
+        break;
+      case 'b':
+        build_rate = atof(optarg);
+        break;
+      case 'c':
+        chat_rate = atof(optarg);
+        break;
+      case 's':
+        spread = atoi(optarg);
+        break;
+      case 'v':
+        view = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind < argc) {
+    host = argv[optind++];
+  }
+  if (optind < argc) {
+    port = argv[optind++];
+  }
+  if (bot_count < 1 || move_rate <= 0 || speed <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (recording && record_load(recording, &entries, &entry_count)) {
+    fprintf(stderr, "could not read %s\n", recording);
+    return 1;
+  }
+  signal(SIGINT, on_signal);
+  signal(SIGPIPE, SIG_IGN);
+  srand(time(NULL));
+  epoll_fd = epoll_create1(0);
+  bots = calloc(bot_count, sizeof(Bot));
+  const double start = now();
+  for (int i = 0; i < bot_count; i++) {
+    Bot *bot = bots + i;
+    bot->index = i;
+    bot->fd = connect_to(host, port);
+    if (bot->fd < 0) {
+      fprintf(stderr, "could not connect to %s:%s\n", host, port);
+      return 1;
+    }
+    bot->input = malloc(RECV_SIZE);
+    bot_start(bot, start);
+    fcntl(bot->fd, F_SETFL, fcntl(bot->fd, F_GETFL, 0) | O_NONBLOCK);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = bot;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, bot->fd, &event);
+  }
+  double last_report = start;
+  double last_stats = start;
+  struct epoll_event events[64];
+  while (!stopping) {
+    const int count = epoll_wait(epoll_fd, events, 64, 5);
+    for (int i = 0; i < count; i++) {
+      Bot *bot = events[i].data.ptr;
+      if (events[i].events & EPOLLOUT) {
+        bot_flush(bot);
+      }
+      bot_read(bot);
+    }
+    const double t = now();
+    for (int i = 0; i < bot_count; i++) {
+      bot_update(bots + i, start, t);
+    }
+    if (t - last_stats >= 1) {
+      bot_send(bots, "T,/stats\n");
+      last_stats = t;
+    }
+    if (t - last_report >= 1) {
+      report(t - last_report);
+      last_report = t;
+    }
+    if (t - start >= duration) {
+      break;
+    }
+  }
+  for (int i = 0; i < bot_count; i++) {
+    close(bots[i].fd);
+    free(bots[i].input);
+    free(bots[i].output);
+  }
+  free(bots);
+  if (recording) {
+    record_free(entries, entry_count);
+  }
+  close(epoll_fd);
+  return 0;
+}
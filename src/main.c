@@ -58,6 +58,7 @@
 #include "gl_render.h"
 #include "item.h"
 #include "matrix.h"
+#include "mesh.h"
 #include "noise.h"
 #include "util.h"
 
@@ -117,9 +118,10 @@ GLuint gen_sky_buffer() {
 #endif
 }
 
-GLuint gen_player_buffer(float x, float y, float z, float rx, float ry) {
+// The cube of a player at the origin, which the player shader moves.
+GLuint gen_player_buffer() {
   float *const data = malloc_faces(10, 6);
-  make_player(data, x, y, z, rx, ry);
+  make_player(data, 0, 0, 0, 0, 0);
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
   return gl_gen_faces(10, 6, data);
 #endif
@@ -138,24 +140,35 @@ Player *find_player(int id) {
 void update_player(Player *player, float x, float y, float z, float rx,
                    float ry, int interpolate) {
   if (interpolate) {
-    PositionAndOrientation *positionAndOrientation1 =
-        &player->positionAndOrientation1;
-    PositionAndOrientation *positionAndOrientation2 =
-        &player->positionAndOrientation2;
-    memcpy(positionAndOrientation1, positionAndOrientation2,
-           sizeof(PositionAndOrientation));
-    positionAndOrientation2->x = x;
-    positionAndOrientation2->y = y;
-    positionAndOrientation2->z = z;
-    positionAndOrientation2->rx = rx;
-    positionAndOrientation2->ry = ry;
-    positionAndOrientation2->t = glfwGetTime();
-    if (positionAndOrientation2->rx - positionAndOrientation1->rx > PI) {
-      positionAndOrientation1->rx += 2 * PI;
-    }
-    if (positionAndOrientation1->rx - positionAndOrientation2->rx > PI) {
-      positionAndOrientation1->rx -= 2 * PI;
-    }
+    PositionAndOrientation *samples = player->samples;
+    const float now = glfwGetTime();
+    if (player->sample_count && now < samples[player->sample_count - 1].t) {
+      // the clock was reset by a time update; old samples are meaningless
+      player->sample_count = 0;
+    }
+    if (player->sample_count == PLAYER_SAMPLES) {
+      memmove(samples, samples + 1,
+              sizeof(PositionAndOrientation) * (PLAYER_SAMPLES - 1));
+      player->sample_count--;
+    }
+    PositionAndOrientation *sample = samples + player->sample_count;
+    sample->x = x;
+    sample->y = y;
+    sample->z = z;
+    sample->rx = rx;
+    sample->ry = ry;
+    sample->t = now;
+    if (player->sample_count) {
+      // keep rx continuous so interpolation takes the short way round
+      const PositionAndOrientation *previous = sample - 1;
+      if (sample->rx - previous->rx > PI) {
+        sample->rx -= 2 * PI;
+      }
+      if (previous->rx - sample->rx > PI) {
+        sample->rx += 2 * PI;
+      }
+    }
+    player->sample_count++;
   } else {
     PositionAndOrientation *positionAndOrientation =
         &player->positionAndOrientation;
@@ -164,14 +177,55 @@ void update_player(Player *player, float x, float y, float z, float rx,
     positionAndOrientation->z = z;
     positionAndOrientation->rx = rx;
     positionAndOrientation->ry = ry;
-#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-    gl_del_buffer(player->buffer);
-#endif
-    player->buffer =
-        gen_player_buffer(positionAndOrientation->x, positionAndOrientation->y,
-                          positionAndOrientation->z, positionAndOrientation->rx,
-                          positionAndOrientation->ry);
+    player->placed = 1;
+  }
+}
+
+/*
+ * Place a remote player where it was `delay` seconds ago, interpolating
+ * between the buffered samples.  The delay follows the spacing of the
+ * recent updates, since the server sends far away players less often.
+ * Past the newest sample the last velocity is extrapolated for a short
+ * while, then eased back to that sample in case the player stopped.
+ */
+void interpolate_player(Player *player, double now) {
+  const int count = player->sample_count;
+  const PositionAndOrientation *samples = player->samples;
+  if (!count) {
+    return;
   }
+  float delay = MIN_INTERPOLATION_DELAY;
+  if (count > 1) {
+    delay = (samples[count - 1].t - samples[0].t) / (count - 1) * 1.5;
+    delay = MAX_NUMBER(delay, MIN_INTERPOLATION_DELAY);
+    delay = MIN_NUMBER(delay, MAX_INTERPOLATION_DELAY);
+  }
+  const float t = now - delay;
+  const PositionAndOrientation *a = samples, *b = samples;
+  float p = 0;
+  if (count == 1 || t <= samples[0].t) {
+    p = 0;
+  } else if (t < samples[count - 1].t) {
+    int i = 1;
+    while (samples[i].t <= t) {
+      i++;
+    }
+    a = samples + i - 1;
+    b = samples + i;
+    p = (t - a->t) / MAX_NUMBER(b->t - a->t, 0.001);
+  } else {
+    a = samples + count - 2;
+    b = samples + count - 1;
+    const float span = MAX_NUMBER(b->t - a->t, 0.001);
+    float ahead = t - b->t;
+    if (ahead > MAX_EXTRAPOLATION) {
+      ahead = MAX_NUMBER(2 * MAX_EXTRAPOLATION - ahead, 0);
+    }
+    p = 1 + ahead / span;
+  }
+  update_player(player, a->x + (b->x - a->x) * p, a->y + (b->y - a->y) * p,
+                a->z + (b->z - a->z) * p, a->rx + (b->rx - a->rx) * p,
+                a->ry + (b->ry - a->ry) * p, 0);
 }
 
 Player *player_crosshair(Player *player) {
@@ -245,6 +299,29 @@ int chunk_distance(const Chunk *const chunk, int p, int q) {
   return MAX_NUMBER(dp, dq);
 }
 
+/*
+ * The level of detail to mesh chunk at, seen from chunk (p, q): every
+ * block within lod_radius, then a level coarser each time the distance
+ * doubles, up to MAX_LOD.  A chunk only coarsens once it is
+ * LOD_HYSTERESIS past the boundary, so walking back and forth across one
+ * does not remesh the chunks along it every time.
+ */
+int chunk_lod(const Chunk *const chunk, int p, int q) {
+  if (g->lod_radius <= 0) {
+    return 0;
+  }
+  const int distance = chunk_distance(chunk, p, q);
+  int lod = chunk->lod;
+  while (lod < MAX_LOD &&
+         distance > (g->lod_radius << lod) + LOD_HYSTERESIS) {
+    lod++;
+  }
+  while (lod > 0 && distance <= g->lod_radius << (lod - 1)) {
+    lod--;
+  }
+  return lod;
+}
+
 int chunk_visible(float planes[6][4], int p, int q, int miny, int maxy) {
   const int x = p * CHUNK_SIZE - 1, z = q * CHUNK_SIZE - 1, d = CHUNK_SIZE + 1,
             n = g->ortho ? 4 : 6;
@@ -273,25 +350,69 @@ int chunk_visible(float planes[6][4], int p, int q, int miny, int maxy) {
   return 1;
 }
 
+/*
+ * Fill in the highest obstacle of every column of chunk (p, q) from its
+ * block map, in one pass over the map.
+ */
+void compute_heights(const Map *const map, int p, int q, short *heights) {
+  for (int i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+    heights[i] = HEIGHT_NONE;
+  }
+  for (unsigned int i = 0; i <= map->mask; i++) {
+    const MapEntry *const entry = map->data + i;
+    if (EMPTY_ENTRY(entry) || !is_obstacle(entry->e.w)) {
+      continue;
+    }
+    const int dx = entry->e.x + map->dx - p * CHUNK_SIZE;
+    const int dz = entry->e.z + map->dz - q * CHUNK_SIZE;
+    const int y = entry->e.y + map->dy;
+    if (dx < 0 || dz < 0 || dx >= CHUNK_SIZE || dz >= CHUNK_SIZE) {
+      continue;
+    }
+    short *const height = heights + dx * CHUNK_SIZE + dz;
+    *height = MAX_NUMBER(*height, y);
+  }
+}
+
+/*
+ * Keep the column's height current after block (x, y, z) became w.
+ * Removing the top block only marks the column, it is looked up again
+ * when it is next asked for.
+ */
+void update_height(Chunk *chunk, int x, int y, int z, int w) {
+  const int dx = x - chunk->p * CHUNK_SIZE;
+  const int dz = z - chunk->q * CHUNK_SIZE;
+  if (dx < 0 || dz < 0 || dx >= CHUNK_SIZE || dz >= CHUNK_SIZE) {
+    return;
+  }
+  short *const height = chunk->heights + dx * CHUNK_SIZE + dz;
+  if (is_obstacle(w)) {
+    if (*height != HEIGHT_UNKNOWN && y > *height) {
+      *height = y;
+    }
+  } else if (y == *height) {
+    *height = HEIGHT_UNKNOWN;
+  }
+}
+
 int highest_block(float x, float z) {
-  int result = -1;
   const int nx = roundf(x), nz = roundf(z), p = chunked(x), q = chunked(z);
-  const Chunk *const chunk = find_chunk(p, q);
-  if (chunk) {
-    const Map *const map = &chunk->map;
-    for (unsigned int i = 0; i <= map->mask; i++) {
-      const MapEntry *const entry = map->data + i;
-      if (EMPTY_ENTRY(entry)) {
-        continue;
-      }
-      const int ex = entry->e.x + map->dx, ey = entry->e.y + map->dy,
-                ez = entry->e.z + map->dz, ew = entry->e.w;
-      if (is_obstacle(ew) && ex == nx && ez == nz) {
-        result = MAX_NUMBER(result, ey);
+  Chunk *const chunk = find_chunk(p, q);
+  if (!chunk) {
+    return -1;
+  }
+  short *const height =
+      chunk->heights + (nx - p * CHUNK_SIZE) * CHUNK_SIZE + nz - q * CHUNK_SIZE;
+  if (*height == HEIGHT_UNKNOWN) {
+    *height = HEIGHT_NONE;
+    for (int y = 255; y >= 0; y--) {
+      if (is_obstacle(map_get(&chunk->map, nx, y, nz))) {
+        *height = y;
+        break;
       }
     }
   }
-  return result;
+  return *height;
 }
 
 int _hit_test(const Map *const map, float max_distance, int previous, float x,
@@ -488,304 +609,95 @@ int has_lights(const Chunk *const chunk) {
   return 0;
 }
 
-void dirty_chunk(Chunk *const chunk) {
-  chunk->dirty = 1;
-  if (has_lights(chunk)) {
+/*
+ * The sections that hold any of y0 to y1.
+ */
+int section_mask(int y0, int y1) {
+  y0 = MAX_NUMBER(y0, 0);
+  y1 = MIN_NUMBER(y1, 255);
+  if (y0 > y1) {
+    return 0;
+  }
+  const int a = y0 / SECTION_SIZE;
+  const int b = y1 / SECTION_SIZE;
+  return ((2 << b) - 1) & ~((1 << a) - 1);
+}
+
+void _dirty_sections(Chunk *const chunk, int sections, int neighbors) {
+  chunk->dirty |= sections;
+  if (neighbors) {
     for (int dp = -1; dp <= 1; dp++) {
       for (int dq = -1; dq <= 1; dq++) {
         Chunk *const other_chunk = find_chunk(chunk->p + dp, chunk->q + dq);
         if (other_chunk) {
-          other_chunk->dirty = 1;
+          other_chunk->dirty |= sections;
         }
       }
     }
   }
 }
 
-#define XZ_SIZE (CHUNK_SIZE * 3 + 2)
-#define XZ_LO (CHUNK_SIZE)
-#define XZ_HI (CHUNK_SIZE * 2 + 1)
-#define Y_SIZE 258
-#define XYZ(x, y, z) ((y) * XZ_SIZE * XZ_SIZE + (x) * XZ_SIZE + (z))
-#define XZ(x, z) ((x) * XZ_SIZE + (z))
-
-void light_fill(const char *const opaque, char *light, int x, int y, int z,
-                int w, int force) {
-  if (x + w < XZ_LO || z + w < XZ_LO) {
-    return;
-  }
-  if (x - w > XZ_HI || z - w > XZ_HI) {
-    return;
-  }
-  if (y < 0 || y >= Y_SIZE) {
-    return;
-  }
-  if (light[XYZ(x, y, z)] >= w) {
-    return;
-  }
-  if (!force && opaque[XYZ(x, y, z)]) {
-    return;
-  }
-  light[XYZ(x, y, z)] = w--;
-  light_fill(opaque, light, x - 1, y, z, w, 0);
-  light_fill(opaque, light, x + 1, y, z, w, 0);
-  light_fill(opaque, light, x, y - 1, z, w, 0);
-  light_fill(opaque, light, x, y + 1, z, w, 0);
-  light_fill(opaque, light, x, y, z - 1, w, 0);
-  light_fill(opaque, light, x, y, z + 1, w, 0);
-}
-
-void compute_chunk(WorkerItem *item) {
-  char *const opaque = (char *)calloc(XZ_SIZE * XZ_SIZE * Y_SIZE, sizeof(char));
-  char *const light = (char *)calloc(XZ_SIZE * XZ_SIZE * Y_SIZE, sizeof(char));
-  char *const highest = (char *)calloc(XZ_SIZE * XZ_SIZE, sizeof(char));
-
-  const int ox = item->p * CHUNK_SIZE - CHUNK_SIZE - 1;
-  const int oy = -1;
-  const int oz = item->q * CHUNK_SIZE - CHUNK_SIZE - 1;
-
-  // check for lights
-  int has_light = 0;
-  if (SHOW_LIGHTS) {
-    for (int a = 0; a < 3; a++) {
-      for (int b = 0; b < 3; b++) {
-        Map *map = item->light_maps[a][b];
-        if (map && map->size) {
-          has_light = 1;
-        }
-      }
-    }
-  }
-
-  // populate opaque array
-  for (int a = 0; a < 3; a++) {
-    for (int b = 0; b < 3; b++) {
-      const Map *const map = item->block_maps[a][b];
-      if (!map) {
-        continue;
-      }
-      for (unsigned int i = 0; i <= map->mask; i++) {
-        const MapEntry *const entry = map->data + i;
-        if (EMPTY_ENTRY(entry)) {
-          continue;
-        }
-        const int ex = entry->e.x + map->dx;
-        const int ey = entry->e.y + map->dy;
-        const int ez = entry->e.z + map->dz;
-        const int ew = entry->e.w;
-        const int x = ex - ox;
-        const int y = ey - oy;
-        const int z = ez - oz;
-        const int w = ew;
-        // TODO: this should be unnecessary
-        if (x < 0 || y < 0 || z < 0) {
-          continue;
-        }
-        if (x >= XZ_SIZE || y >= Y_SIZE || z >= XZ_SIZE) {
-          continue;
-        }
-        // END TODO
-        opaque[XYZ(x, y, z)] = !is_transparent(w);
-        if (opaque[XYZ(x, y, z)]) {
-          highest[XZ(x, z)] = MAX_NUMBER(highest[XZ(x, z)], y);
-        }
-      }
-    }
-  }
+void dirty_chunk(Chunk *const chunk) {
+  _dirty_sections(chunk, ALL_SECTIONS, has_lights(chunk));
+}
 
-  // flood fill light intensities
-  if (has_light) {
-    for (int a = 0; a < 3; a++) {
-      for (int b = 0; b < 3; b++) {
-        const Map *const map = item->light_maps[a][b];
-        if (!map) {
-          continue;
-        }
-        for (unsigned int i = 0; i <= map->mask; i++) {
-          const MapEntry *const entry = map->data + i;
-          if (EMPTY_ENTRY(entry)) {
-            continue;
-          }
-          const int ex = entry->e.x + map->dx;
-          const int ey = entry->e.y + map->dy;
-          const int ez = entry->e.z + map->dz;
-          const int ew = entry->e.w;
-          const int x = ex - ox;
-          const int y = ey - oy;
-          const int z = ez - oz;
-          light_fill(opaque, light, x, y, z, ew, 1);
-        }
-      }
-    }
+/*
+ * A block changed at y.  That changes the faces and ambient occlusion
+ * of the blocks next to it and the shading of the 8 blocks below it; if
+ * there are lights around, it can also change the light 15 blocks away,
+ * in the neighbouring chunks too.
+ */
+void dirty_block(Chunk *const chunk, int y) {
+  if (has_lights(chunk)) {
+    _dirty_sections(chunk, section_mask(y - 15, y + 15), 1);
+  } else {
+    _dirty_sections(chunk, section_mask(y - 8, y + 1), 0);
   }
+}
 
-  const Map *const map = item->block_maps[1][1];
-
-  // count exposed faces
-  int miny = 256;
-  int maxy = 0;
-  int faces = 0;
-  for (unsigned int i = 0; i <= map->mask; i++) {
-    const MapEntry *const entry = map->data + i;
-    if (EMPTY_ENTRY(entry)) {
-      continue;
-    }
-    const int ex = entry->e.x + map->dx;
-    const int ey = entry->e.y + map->dy;
-    const int ez = entry->e.z + map->dz;
-    const int ew = entry->e.w;
-    if (ew <= 0) {
-      continue;
-    }
-    const int x = ex - ox;
-    const int y = ey - oy;
-    const int z = ez - oz;
-    const int f1 = !opaque[XYZ(x - 1, y, z)];
-    const int f2 = !opaque[XYZ(x + 1, y, z)];
-    const int f3 = !opaque[XYZ(x, y + 1, z)];
-    const int f4 = !opaque[XYZ(x, y - 1, z)] && (ey > 0);
-    const int f5 = !opaque[XYZ(x, y, z - 1)];
-    const int f6 = !opaque[XYZ(x, y, z + 1)];
-    const int total = f1 + f2 + f3 + f4 + f5 + f6;
-    if (total == 0) {
-      continue;
-    }
-    miny = MIN_NUMBER(miny, ey);
-    maxy = MAX_NUMBER(maxy, ey);
-    faces += is_plant(ew) ? 4 : total;
-  }
+void dirty_light(Chunk *const chunk, int y) {
+  _dirty_sections(chunk, section_mask(y - 15, y + 15), 1);
+}
 
-  // generate geometry
-  float *const data = malloc_faces(10, faces);
-  int offset = 0;
-  for (unsigned int i = 0; i <= map->mask; i++) {
-    const MapEntry *const entry = map->data + i;
-    if (EMPTY_ENTRY(entry)) {
-      continue;
-    }
-    const int ex = entry->e.x + map->dx;
-    const int ey = entry->e.y + map->dy;
-    const int ez = entry->e.z + map->dz;
-    const int ew = entry->e.w;
-    if (ew <= 0) {
-      continue;
-    }
-    const int x = ex - ox;
-    const int y = ey - oy;
-    const int z = ez - oz;
-    const int f1 = !opaque[XYZ(x - 1, y, z)];
-    const int f2 = !opaque[XYZ(x + 1, y, z)];
-    const int f3 = !opaque[XYZ(x, y + 1, z)];
-    const int f4 = !opaque[XYZ(x, y - 1, z)] && (ey > 0);
-    const int f5 = !opaque[XYZ(x, y, z - 1)];
-    const int f6 = !opaque[XYZ(x, y, z + 1)];
-    const int total = f1 + f2 + f3 + f4 + f5 + f6;
-    if (total == 0) {
-      continue;
-    }
-    char neighbors[27] = {0}, lights[27] = {0};
-    float shades[27] = {0};
-    int index = 0;
-    for (int dx = -1; dx <= 1; dx++) {
-      for (int dy = -1; dy <= 1; dy++) {
-        for (int dz = -1; dz <= 1; dz++) {
-          neighbors[index] = opaque[XYZ(x + dx, y + dy, z + dz)];
-          lights[index] = light[XYZ(x + dx, y + dy, z + dz)];
-          shades[index] = 0;
-          if (y + dy <= highest[XZ(x + dx, z + dz)]) {
-            for (int oy = 0; oy < 8; oy++) {
-              if (opaque[XYZ(x + dx, y + dy + oy, z + dz)]) {
-                shades[index] = 1.0 - oy * 0.125;
-                break;
-              }
-            }
-          }
-          index++;
-        }
-      }
-    }
-    float ambient_occlusion[6][4];
-    // TODO -- this shadows the other light variable.  should
-    // it be renamed?
-    float light[6][4];
-    // ambient occlusion
-    {
-      static const int lookup3[6][4][3] = {
-          {{0, 1, 3}, {2, 1, 5}, {6, 3, 7}, {8, 5, 7}},
-          {{18, 19, 21}, {20, 19, 23}, {24, 21, 25}, {26, 23, 25}},
-          {{6, 7, 15}, {8, 7, 17}, {24, 15, 25}, {26, 17, 25}},
-          {{0, 1, 9}, {2, 1, 11}, {18, 9, 19}, {20, 11, 19}},
-          {{0, 3, 9}, {6, 3, 15}, {18, 9, 21}, {24, 15, 21}},
-          {{2, 5, 11}, {8, 5, 17}, {20, 11, 23}, {26, 17, 23}}};
-      static const int lookup4[6][4][4] = {
-          {{0, 1, 3, 4}, {1, 2, 4, 5}, {3, 4, 6, 7}, {4, 5, 7, 8}},
-          {{18, 19, 21, 22},
-           {19, 20, 22, 23},
-           {21, 22, 24, 25},
-           {22, 23, 25, 26}},
-          {{6, 7, 15, 16}, {7, 8, 16, 17}, {15, 16, 24, 25}, {16, 17, 25, 26}},
-          {{0, 1, 9, 10}, {1, 2, 10, 11}, {9, 10, 18, 19}, {10, 11, 19, 20}},
-          {{0, 3, 9, 12}, {3, 6, 12, 15}, {9, 12, 18, 21}, {12, 15, 21, 24}},
-          {{2, 5, 11, 14}, {5, 8, 14, 17}, {11, 14, 20, 23}, {14, 17, 23, 26}}};
-      static const float curve[4] = {0.0, 0.25, 0.5, 0.75};
-      for (int i = 0; i < 6; i++) {
-        for (int j = 0; j < 4; j++) {
-          const int corner = neighbors[lookup3[i][j][0]],
-                    side1 = neighbors[lookup3[i][j][1]],
-                    side2 = neighbors[lookup3[i][j][2]],
-                    value = side1 && side2 ? 3 : corner + side1 + side2;
-          float shade_sum = 0, light_sum = 0;
-          const int is_light = lights[13] == 15;
-          for (int k = 0; k < 4; k++) {
-            shade_sum += shades[lookup4[i][j][k]];
-            light_sum += lights[lookup4[i][j][k]];
-          }
-          if (is_light) {
-            light_sum = 15 * 4 * 10;
-          }
-          const float total = curve[value] + shade_sum / 4.0;
-          ambient_occlusion[i][j] = MIN_NUMBER(total, 1.0);
-          light[i][j] = light_sum / 15.0 / 4.0;
-        }
-      }
-    }
-    if (is_plant(ew)) {
-      float min_ambient_occlusion = 1, max_light = 0;
-      for (int a = 0; a < 6; a++) {
-        for (int b = 0; b < 4; b++) {
-          min_ambient_occlusion =
-              MIN_NUMBER(min_ambient_occlusion, ambient_occlusion[a][b]);
-          max_light = MAX_NUMBER(max_light, light[a][b]);
-        }
-      }
-      float rotation = simplex2(ex, ez, 4, 0.5, 2) * 360;
-      make_plant(data + offset, min_ambient_occlusion, max_light, ex, ey, ez,
-                 0.5, ew, rotation);
-    } else {
-      make_cube(data + offset, ambient_occlusion, light, f1, f2, f3, f4, f5, f6,
-                ex, ey, ez, 0.5, ew);
-    }
-    offset += (is_plant(ew) ? 4 : total) * 60;
+// the chunks changed, so every view walks its sections again
+static void _visibility_stale() {
+  for (int i = 0; i < VIEWS; i++) {
+    g->visibility[i].stale = 1;
   }
-
-  free(opaque);
-  free(light);
-  free(highest);
-
-  item->miny = miny;
-  item->maxy = maxy;
-  item->faces = faces;
-  item->data = data;
 }
 
 void generate_chunk(Chunk *const chunk, WorkerItem *const item) {
-  chunk->miny = item->miny;
-  chunk->maxy = item->maxy;
-  chunk->faces = item->faces;
+  _visibility_stale();
+  chunk->miny = 256;
+  chunk->maxy = 0;
+  for (int s = 0; s < CHUNK_SECTIONS; s++) {
+    Section *const section = chunk->sections + s;
+    const Section *const mesh = item->meshes + s;
+    section->empty = mesh->empty;
+    section->full = mesh->full;
+    if (item->sections >> s & 1) {
+      section->solid_layers = mesh->solid_layers;
+      section->connected = mesh->connected;
+      section->faces = mesh->faces;
+      section->cutout_faces = mesh->cutout_faces;
+      section->miny = mesh->miny;
+      section->maxy = mesh->maxy;
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-  gl_del_buffer(chunk->buffer);
-  chunk->buffer = gl_gen_faces(10, item->faces, item->data);
+      gl_del_buffer(section->buffer);
+      section->buffer = 0;
+      if (item->data[s]) {
+        section->buffer = gl_gen_buffer(sizeof(float) * 60 * mesh->faces,
+                                        item->data[s]);
+      }
 #endif
+      pool_release(&g->pool, item->data[s]);
+      item->data[s] = NULL;
+    }
+    if (section->faces) {
+      chunk->miny = MIN_NUMBER(chunk->miny, section->miny);
+      chunk->maxy = MAX_NUMBER(chunk->maxy, section->maxy);
+    }
+  }
 
   // generate sign buffer
   const SignList *const signs = &chunk->signs;
@@ -819,6 +731,8 @@ void gen_chunk_buffer(Chunk *const chunk) {
   {
     item->p = chunk->p;
     item->q = chunk->q;
+    item->sections = chunk->dirty;
+    item->lod = chunk->lod;
   }
   for (int dp = -1; dp <= 1; dp++) {
     for (int dq = -1; dq <= 1; dq++) {
@@ -833,14 +747,72 @@ void gen_chunk_buffer(Chunk *const chunk) {
       }
     }
   }
-  compute_chunk(item);
+  compute_chunk(item, &g->scratch);
   generate_chunk(chunk, item);
   chunk->dirty = 0;
 }
 
-void map_set_func(int x, int y, int z, int w, void *arg) {
-  Map *map = (Map *)arg;
-  map_set(map, x, y, z, w);
+/*
+ * Mesh the chunk's clouds.  They are not blocks: they have their own
+ * layer, generated once when the chunk loads and never rebuilt when
+ * blocks change, with flat shading instead of ambient occlusion.
+ */
+void compute_clouds(WorkerItem *item) {
+  item->cloud_faces = 0;
+  item->cloud_data = NULL;
+  if (!SHOW_CLOUDS) {
+    return;
+  }
+  unsigned char layer[WORLD_ROW * WORLD_ROW];
+  if (!generator_clouds(g->generator, item->p, item->q, layer)) {
+    return;
+  }
+  int faces = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    float ambient_occlusion[6][4] = {{0}};
+    float light[6][4] = {{0}};
+    for (int dx = 0; dx < CHUNK_SIZE; dx++) {
+      for (int dz = 0; dz < CHUNK_SIZE; dz++) {
+        const int column = layer[WORLD_COLUMN(dx, dz)];
+        for (int b = 0; column >> b; b++) {
+          const int bit = 1 << b;
+          if (!(column & bit)) {
+            continue;
+          }
+          const int f1 = !(layer[WORLD_COLUMN(dx - 1, dz)] & bit);
+          const int f2 = !(layer[WORLD_COLUMN(dx + 1, dz)] & bit);
+          const int f3 = !(column & (bit << 1));
+          const int f4 = !(column & (bit >> 1));
+          const int f5 = !(layer[WORLD_COLUMN(dx, dz - 1)] & bit);
+          const int f6 = !(layer[WORLD_COLUMN(dx, dz + 1)] & bit);
+          const int total = f1 + f2 + f3 + f4 + f5 + f6;
+          if (pass && total) {
+            make_cube(item->cloud_data + faces * 60, ambient_occlusion, light,
+                      f1, f2, f3, f4, f5, f6, item->p * CHUNK_SIZE + dx,
+                      WORLD_CLOUD_BOTTOM + b, item->q * CHUNK_SIZE + dz, 0.5,
+                      CLOUD);
+          }
+          faces += total;
+        }
+      }
+    }
+    if (!pass) {
+      item->cloud_faces = faces;
+      item->cloud_data = malloc_faces(10, faces);
+      faces = 0;
+    }
+  }
+}
+
+void generate_clouds(Chunk *const chunk, WorkerItem *const item) {
+  chunk->cloud_faces = item->cloud_faces;
+#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
+  gl_del_buffer(chunk->cloud_buffer);
+  chunk->cloud_buffer = gl_gen_faces(10, item->cloud_faces, item->cloud_data);
+#else
+  free(item->cloud_data);
+#endif
+  item->cloud_data = NULL;
 }
 
 void load_chunk(WorkerItem *item) {
@@ -848,9 +820,16 @@ void load_chunk(WorkerItem *item) {
   const int q = item->q;
   Map *const block_map = item->block_maps[1][1];
   Map *const light_map = item->light_maps[1][1];
-  create_world(p, q, map_set_func, block_map);
+  WorldChunk world = {0};
+  if (!db_load_terrain(&world, g->world_key, p, q)) {
+    generator_generate(g->generator, p, q, &world);
+  }
+  map_set_world(block_map, &world);
+  world_chunk_free(&world);
   db_load_blocks(block_map, p, q);
   db_load_lights(light_map, p, q);
+  compute_heights(block_map, p, q, item->heights);
+  compute_clouds(item);
 }
 
 void request_chunk(int p, int q) {
@@ -863,12 +842,25 @@ void init_chunk(Chunk *chunk, int p, int q) {
   {
     chunk->p = p;
     chunk->q = q;
-    chunk->faces = 0;
+    memset(chunk->sections, 0, sizeof(chunk->sections));
+    for (int s = 0; s < CHUNK_SECTIONS; s++) {
+      // seen through until it is meshed
+      chunk->sections[s].connected = ALL_CONNECTED;
+    }
+    chunk->dirty = 0;
+    chunk->lod = 0;
+    chunk->miny = 256;
+    chunk->maxy = 0;
     chunk->sign_faces = 0;
-    chunk->buffer = 0;
+    chunk->cloud_faces = 0;
     chunk->sign_buffer = 0;
+    chunk->cloud_buffer = 0;
+    for (int i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+      chunk->heights[i] = HEIGHT_NONE;
+    }
   }
   dirty_chunk(chunk);
+  _visibility_stale();
   SignList *const signs = &chunk->signs;
   sign_list_alloc(signs, 16);
   db_load_signs(signs, p, q);
@@ -893,6 +885,8 @@ void create_chunk(Chunk *chunk, int p, int q) {
     item->light_maps[1][1] = &chunk->lights;
   }
   load_chunk(item);
+  memcpy(chunk->heights, item->heights, sizeof(chunk->heights));
+  generate_clouds(chunk, item);
 
   request_chunk(p, q);
 }
@@ -926,11 +920,15 @@ void delete_chunks() {
       map_free(&chunk->lights);
       sign_list_free(&chunk->signs);
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-      gl_del_buffer(chunk->buffer);
+      for (int s = 0; s < CHUNK_SECTIONS; s++) {
+        gl_del_buffer(chunk->sections[s].buffer);
+      }
       gl_del_buffer(chunk->sign_buffer);
+      gl_del_buffer(chunk->cloud_buffer);
 #endif
       Chunk *other_chunk = g->chunks + (--count);
       memcpy(chunk, other_chunk, sizeof(Chunk));
+      _visibility_stale();
     }
   }
   g->chunk_count = count;
@@ -943,11 +941,15 @@ void delete_all_chunks() {
     map_free(&chunk->lights);
     sign_list_free(&chunk->signs);
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-    gl_del_buffer(chunk->buffer);
+    for (int s = 0; s < CHUNK_SECTIONS; s++) {
+      gl_del_buffer(chunk->sections[s].buffer);
+    }
     gl_del_buffer(chunk->sign_buffer);
+    gl_del_buffer(chunk->cloud_buffer);
 #endif
   }
   g->chunk_count = 0;
+  _visibility_stale();
 }
 
 void check_workers() {
@@ -965,9 +967,18 @@ void check_workers() {
           map_free(&chunk->lights);
           map_copy(&chunk->map, block_map);
           map_copy(&chunk->lights, light_map);
+          memcpy(chunk->heights, item->heights, sizeof(chunk->heights));
+          generate_clouds(chunk, item);
           request_chunk(item->p, item->q);
         }
         generate_chunk(chunk, item);
+      } else {
+        for (int s = 0; s < CHUNK_SECTIONS; s++) {
+          pool_release(&g->pool, item->data[s]);
+        }
+        if (item->load) {
+          free(item->cloud_data);
+        }
       }
       for (int a = 0; a < 3; a++) {
         for (int b = 0; b < 3; b++) {
@@ -989,6 +1000,24 @@ void check_workers() {
   }
 }
 
+/*
+ * Wait for the workers to finish what they are doing and take it, so
+ * nothing they use (the database, the generator) goes away under them.
+ */
+void drain_workers() {
+#ifndef ENABLE_NO_THREADS
+  for (int i = 0; i < WORKERS; i++) {
+    Worker *const worker = g->workers + i;
+    mtx_lock(&worker->mtx);
+    while (worker->state == WORKER_BUSY) {
+      cnd_wait(&worker->cnd, &worker->mtx);
+    }
+    mtx_unlock(&worker->mtx);
+  }
+#endif
+  check_workers();
+}
+
 void force_chunks(Player *player) {
   const PositionAndOrientation *const positionAndOrientation =
       &player->positionAndOrientation;
@@ -1013,19 +1042,16 @@ void force_chunks(Player *player) {
   }
 }
 
-void ensure_chunks_worker(Player *player, Worker *worker) {
-  const PositionAndOrientation *const positionAndOrientation =
-      &player->positionAndOrientation;
-  float matrix[16];
-  set_matrix_3d(matrix, g->width, g->height, positionAndOrientation->x,
-                positionAndOrientation->y, positionAndOrientation->z,
-                positionAndOrientation->rx, positionAndOrientation->ry, g->fov,
-                g->ortho, g->render_radius);
-  float planes[6][4];
-  frustum_planes(planes, g->render_radius, matrix);
-  const int p = chunked(positionAndOrientation->x);
-  const int q = chunked(positionAndOrientation->z);
-  const int r = g->create_radius;
+/*
+ * Give the worker the chunk around the view most in need of meshing, if
+ * any.  `grid` holds the chunks within create_radius of the view, in rows
+ * along q, as ensure_chunks places them.
+ */
+void ensure_chunks_worker(View *const view, Worker *worker, Chunk **grid) {
+  const int p = view->p;
+  const int q = view->q;
+  const int r = MIN_NUMBER(g->create_radius, MAX_RENDER_RADIUS);
+  const int size = r * 2 + 1;
   const int start = 0x0fffffff;
   int best_score = start;
   int best_a = 0;
@@ -1038,15 +1064,16 @@ void ensure_chunks_worker(Player *player, Worker *worker) {
       if (index != worker->index) {
         continue;
       }
-      Chunk *chunk = find_chunk(a, b);
+      Chunk *chunk = grid[(dp + r) * size + dq + r];
       if (chunk && !chunk->dirty) {
         continue;
       }
       const int distance = MAX_NUMBER(ABS(dp), ABS(dq));
-      const int invisible = !chunk_visible(planes, a, b, 0, 256);
+      const int invisible = !chunk_visible(view->planes, a, b, 0, 256);
       int priority = 0;
       if (chunk) {
-        priority = chunk->buffer && chunk->dirty;
+        // already meshed, only some of its sections changed
+        priority = chunk->dirty != ALL_SECTIONS;
       }
       int score = (invisible << 24) | (priority << 16) | distance;
       if (score < best_score) {
@@ -1062,12 +1089,15 @@ void ensure_chunks_worker(Player *player, Worker *worker) {
   const int a = best_a;
   const int b = best_b;
   int load = 0;
-  Chunk *chunk = find_chunk(a, b);
+  Chunk **const cell = grid + (a - p + r) * size + b - q + r;
+  Chunk *chunk = *cell;
   if (!chunk) {
     load = 1;
     if (g->chunk_count < MAX_CHUNKS) {
       chunk = g->chunks + g->chunk_count++;
       init_chunk(chunk, a, b);
+      chunk->lod = chunk_lod(chunk, g->lod_p, g->lod_q);
+      *cell = chunk;
     } else {
       return;
     }
@@ -1077,6 +1107,8 @@ void ensure_chunks_worker(Player *player, Worker *worker) {
     item->p = chunk->p;
     item->q = chunk->q;
     item->load = load;
+    item->sections = chunk->dirty;
+    item->lod = chunk->lod;
   }
   for (int dp = -1; dp <= 1; dp++) {
     for (int dq = -1; dq <= 1; dq++) {
@@ -1108,14 +1140,48 @@ void ensure_chunks_worker(Player *player, Worker *worker) {
   cnd_signal(&worker->cnd);
 }
 
-void ensure_chunks(Player *player) {
+/*
+ * Remesh the chunks whose level of detail changed as the player moved.
+ * They keep drawing their old mesh until the new one is ready.  Called
+ * once a frame with the local player, not per view: a picture in picture
+ * of someone far away would otherwise flip the levels back and forth.
+ */
+void update_lods(Player *player) {
+  const PositionAndOrientation *const positionAndOrientation =
+      &player->positionAndOrientation;
+  const int p = chunked(positionAndOrientation->x);
+  const int q = chunked(positionAndOrientation->z);
+  g->lod_p = p;
+  g->lod_q = q;
+  for (int i = 0; i < g->chunk_count; i++) {
+    Chunk *const chunk = g->chunks + i;
+    const int lod = chunk_lod(chunk, p, q);
+    if (lod != chunk->lod) {
+      chunk->lod = lod;
+      chunk->dirty = ALL_SECTIONS;
+    }
+  }
+}
+
+void ensure_chunks(View *const view) {
   check_workers();
-  force_chunks(player);
+  force_chunks(view->player);
+  // the chunks in range, placed once rather than searched for each one
+  static Chunk *grid[VIEW_SIZE * VIEW_SIZE];
+  const int r = MIN_NUMBER(g->create_radius, MAX_RENDER_RADIUS);
+  const int size = r * 2 + 1;
+  memset(grid, 0, sizeof(Chunk *) * size * size);
+  for (int i = 0; i < g->chunk_count; i++) {
+    Chunk *const chunk = g->chunks + i;
+    if (chunk_distance(chunk, view->p, view->q) <= r) {
+      grid[(chunk->p - view->p + r) * size + chunk->q - view->q + r] = chunk;
+    }
+  }
   for (int i = 0; i < WORKERS; i++) {
     Worker *const worker = g->workers + i;
     mtx_lock(&worker->mtx);
     if (worker->state == WORKER_IDLE) {
-      ensure_chunks_worker(player, worker);
+      ensure_chunks_worker(view, worker, grid);
     }
     mtx_unlock(&worker->mtx);
   }
@@ -1134,9 +1200,10 @@ int worker_run(void *arg) {
     if (item->load) {
       load_chunk(item);
     }
-    compute_chunk(item);
+    compute_chunk(item, &worker->scratch);
     mtx_lock(&worker->mtx);
     worker->state = WORKER_DONE;
+    cnd_signal(&worker->cnd);
     mtx_unlock(&worker->mtx);
   }
   return 0;
@@ -1149,7 +1216,7 @@ void unset_sign(int x, int y, int z) {
   if (chunk) {
     SignList *const signs = &chunk->signs;
     if (sign_list_remove_all(signs, x, y, z)) {
-      chunk->dirty = 1;
+      chunk->dirty |= section_mask(y, y);
       db_delete_signs(x, y, z);
     }
   } else {
@@ -1164,7 +1231,7 @@ void unset_sign_face(int x, int y, int z, int face) {
   if (chunk) {
     SignList *const signs = &chunk->signs;
     if (sign_list_remove(signs, x, y, z, face)) {
-      chunk->dirty = 1;
+      chunk->dirty |= section_mask(y, y);
       db_delete_sign(x, y, z, face);
     }
   } else {
@@ -1183,7 +1250,7 @@ void _set_sign(int p, int q, int x, int y, int z, int face, const char *text,
     SignList *const signs = &chunk->signs;
     sign_list_add(signs, x, y, z, face, text);
     if (dirty) {
-      chunk->dirty = 1;
+      chunk->dirty |= section_mask(y, y);
     }
   }
   db_insert_sign(p, q, x, y, z, face, text);
@@ -1206,7 +1273,7 @@ void toggle_light(int x, int y, int z) {
     map_set(map, x, y, z, w);
     db_insert_light(p, q, x, y, z, w);
     client_light(x, y, z, w);
-    dirty_chunk(chunk);
+    dirty_light(chunk, y);
   }
 }
 
@@ -1215,7 +1282,7 @@ void set_light(int p, int q, int x, int y, int z, int w) {
   if (chunk) {
     Map *const map = &chunk->lights;
     if (map_set(map, x, y, z, w)) {
-      dirty_chunk(chunk);
+      dirty_light(chunk, y);
       db_insert_light(p, q, x, y, z, w);
     }
   } else {
@@ -1228,8 +1295,9 @@ void _set_block(int p, int q, int x, int y, int z, int w, int dirty) {
   if (chunk) {
     Map *map = &chunk->map;
     if (map_set(map, x, y, z, w)) {
+      update_height(chunk, x, y, z, w);
       if (dirty) {
-        dirty_chunk(chunk);
+        dirty_block(chunk, y);
       }
       db_insert_block(p, q, x, y, z, w);
     }
@@ -1301,63 +1369,254 @@ void builder_block(int x, int y, int z, int w) {
   }
 }
 
-int render_chunks(Player *player) {
-  int result = 0;
+// the squared distances, in sections, that the walk can go
+#define SECTION_DISTANCES \
+  (2 * MAX_RENDER_RADIUS * MAX_RENDER_RADIUS + CHUNK_SECTIONS * CHUNK_SECTIONS)
+
+/*
+ * Put the `count` sections of the walk from section s of the middle chunk
+ * in order of how far they are from it, nearest first.  Sections are as
+ * wide as chunks, so they are counted out by their squared distance in
+ * sections.
+ */
+static void _sort_sections(Visibility *const visibility, int count, int size,
+                           int s) {
+  const int r = size / 2;
+  int first[SECTION_DISTANCES + 1] = {0};
+  for (int i = 0; i < count; i++) {
+    const int index = visibility->queue[i];
+    const int a = index / CHUNK_SECTIONS / size - r;
+    const int b = index / CHUNK_SECTIONS % size - r;
+    const int c = index % CHUNK_SECTIONS - s;
+    first[a * a + b * b + c * c]++;
+  }
+  for (int d = 0, total = 0; d <= SECTION_DISTANCES; d++) {
+    const int n = first[d];
+    first[d] = total;
+    total += n;
+  }
+  for (int i = 0; i < count; i++) {
+    const int index = visibility->queue[i];
+    const int a = index / CHUNK_SECTIONS / size - r;
+    const int b = index / CHUNK_SECTIONS % size - r;
+    const int c = index % CHUNK_SECTIONS - s;
+    visibility->sorted[first[a * a + b * b + c * c]++] = index;
+  }
+  memcpy(visibility->queue, visibility->sorted, sizeof(int) * count);
+}
+
+/*
+ * Walk the sections that can be seen from the camera at (x, y, z), out
+ * from its own, into visibility->queue, and return how many there are.
+ * A section is only left through a face connected to the one it was
+ * entered through, and never back towards the camera.  Every section in
+ * range is listed if the camera's chunk is not loaded yet.  They are then
+ * sorted nearest first.  The last walk is kept while the camera stays in
+ * its section and the chunks do not change; it is up to the caller to
+ * skip those out of the frustum.
+ */
+int find_visible_sections(Visibility *const visibility, float x, float y,
+                          float z) {
+  static const int steps[6][3] = {{-1, 0, 0}, {1, 0, 0},  {0, 1, 0},
+                                  {0, -1, 0}, {0, 0, -1}, {0, 0, 1}};
+  const int r = MIN_NUMBER(g->render_radius, MAX_RENDER_RADIUS);
+  const int size = r * 2 + 1;
+  const int p = chunked(x);
+  const int q = chunked(z);
+  const int s = MAX_NUMBER(0, MIN_NUMBER(CHUNK_SECTIONS - 1,
+                                         (int)floorf(y) / SECTION_SIZE));
+  if (!visibility->stale && visibility->p == p && visibility->q == q &&
+      visibility->s == s && visibility->radius == r) {
+    return visibility->count;
+  }
+  visibility->p = p;
+  visibility->q = q;
+  visibility->s = s;
+  visibility->radius = r;
+  visibility->stale = 0;
+  memset(visibility->chunks, 0, sizeof(Chunk *) * size * size);
+  for (int i = 0; i < g->chunk_count; i++) {
+    Chunk *const chunk = g->chunks + i;
+    if (chunk_distance(chunk, p, q) <= r) {
+      visibility->chunks[(chunk->p - p + r) * size + chunk->q - q + r] = chunk;
+    }
+  }
+  int count = 0;
+  if (!visibility->chunks[r * size + r]) {
+    for (int i = 0; i < size * size * CHUNK_SECTIONS; i++) {
+      if (visibility->chunks[i / CHUNK_SECTIONS]) {
+        visibility->queue[count++] = i;
+      }
+    }
+    _sort_sections(visibility, count, size, s);
+    visibility->count = count;
+    return count;
+  }
+  memset(visibility->steps, -1, size * size * CHUNK_SECTIONS);
+  const int start = (r * size + r) * CHUNK_SECTIONS + s;
+  visibility->steps[start] = 0;
+  visibility->from[start] = -1;
+  visibility->queue[count++] = start;
+  for (int head = 0; head < count; head++) {
+    const int i = visibility->queue[head];
+    const Chunk *const chunk = visibility->chunks[i / CHUNK_SECTIONS];
+    const Section *const section = chunk->sections + i % CHUNK_SECTIONS;
+    const int a = i / CHUNK_SECTIONS / size;
+    const int b = i / CHUNK_SECTIONS % size;
+    for (int f = 0; f < 6; f++) {
+      if (visibility->steps[i] >> (f ^ 1) & 1) {
+        continue;
+      }
+      if (visibility->from[i] >= 0 &&
+          !section_sees(section, visibility->from[i], f)) {
+        continue;
+      }
+      const int na = a + steps[f][0];
+      const int ns = i % CHUNK_SECTIONS + steps[f][1];
+      const int nb = b + steps[f][2];
+      if (na < 0 || nb < 0 || na >= size || nb >= size || ns < 0 ||
+          ns >= CHUNK_SECTIONS || !visibility->chunks[na * size + nb]) {
+        continue;
+      }
+      const int n = (na * size + nb) * CHUNK_SECTIONS + ns;
+      if (visibility->steps[n] != -1) {
+        continue;
+      }
+      visibility->steps[n] = visibility->steps[i] | 1 << f;
+      visibility->from[n] = f ^ 1;
+      visibility->queue[count++] = n;
+    }
+  }
+  _sort_sections(visibility, count, size, s);
+  visibility->count = count;
+  return count;
+}
+
+/*
+ * Work out what the passes that draw the world from `player`'s camera
+ * share, at the current size and field of view.  `visibility` is kept
+ * for the same view from one frame to the next.
+ */
+void set_view(View *const view, Player *const player,
+              Visibility *const visibility) {
   const PositionAndOrientation *const positionAndOrientation =
       &player->positionAndOrientation;
-  ensure_chunks(player);
-  const int p = chunked(positionAndOrientation->x);
-  const int q = chunked(positionAndOrientation->z);
-
-  float light;
-  // initilize light
+  view->player = player;
+  view->visibility = visibility;
+  view->x = positionAndOrientation->x;
+  view->y = positionAndOrientation->y;
+  view->z = positionAndOrientation->z;
+  view->p = chunked(view->x);
+  view->q = chunked(view->z);
+  // daylight
   {
-    // daylight
     float timer = time_of_day();
     if (timer < 0.5) {
       float t = (timer - 0.25) * 100;
-      light = 1 / (1 + powf(2, -t));
+      view->daylight = 1 / (1 + powf(2, -t));
     } else {
       float t = (timer - 0.85) * 100;
-      light = 1 - 1 / (1 + powf(2, -t));
+      view->daylight = 1 - 1 / (1 + powf(2, -t));
     }
   }
-  float matrix[16];
-  set_matrix_3d(matrix, g->width, g->height, positionAndOrientation->x,
-                positionAndOrientation->y, positionAndOrientation->z,
+  set_matrix_3d(view->matrix, g->width, g->height, view->x, view->y, view->z,
                 positionAndOrientation->rx, positionAndOrientation->ry, g->fov,
                 g->ortho, g->render_radius);
-  float planes[6][4];
-  frustum_planes(planes, g->render_radius, matrix);
+  set_matrix_3d(view->sky_matrix, g->width, g->height, 0, 0, 0,
+                positionAndOrientation->rx, positionAndOrientation->ry, g->fov,
+                0, g->render_radius);
+  frustum_planes(view->planes, g->render_radius, view->matrix);
+}
+
+int render_chunks(View *const view) {
+  int result = 0;
+  ensure_chunks(view);
+  const int p = view->p;
+  const int q = view->q;
 
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-  gl_setup_render_chunks(matrix, positionAndOrientation, light);
+  gl_setup_render_chunks(view->matrix, &view->player->positionAndOrientation,
+                         view->daylight);
 #endif
 
-  // N.B.
-  // To See what a chunk is, change this loop to
-  // only iterate once
+  Visibility *const visibility = view->visibility;
+  const int count =
+      find_visible_sections(visibility, view->x, view->y, view->z);
+  occlusion_clear(&visibility->occlusion, view->matrix);
+  // the opaque faces, nearest first, keeping the sections drawn for the
+  // cutout pass
+  int drawn = 0;
+  for (int i = 0; i < count; i++) {
+    const int index = visibility->queue[i];
+    const Chunk *const chunk = visibility->chunks[index / CHUNK_SECTIONS];
 #ifdef ENABLE_ONLY_RENDER_ONE_CHUNK
-  for (int i = 0; i < 1; i++) {
-#else
-  for (int i = 0; i < g->chunk_count; i++) {
+    // N.B. to see what a chunk is, only the first one is drawn
+    if (chunk != g->chunks) {
+      continue;
+    }
 #endif
-    const Chunk *const chunk = g->chunks + i;
-    if (chunk_distance(chunk, p, q) > g->render_radius) {
+    const int s = index % CHUNK_SECTIONS;
+    const Section *const section = chunk->sections + s;
+    if (section->buffer == 0 || section->faces == 0) {
+      continue;
+    }
+    if (!chunk_visible(view->planes, chunk->p, chunk->q, section->miny,
+                       section->maxy)) {
       continue;
     }
-    if (!chunk_visible(planes, chunk->p, chunk->q, chunk->miny, chunk->maxy)) {
+    // sections come nearest first, so those drawn hide the rest
+    const float x = chunk->p * CHUNK_SIZE - 0.5f;
+    const float z = chunk->q * CHUNK_SIZE - 0.5f;
+    if (OCCLUSION_CULLING &&
+        occlusion_hidden(&visibility->occlusion, x - 1, section->miny - 1,
+                         z - 1, x + CHUNK_SIZE + 1, section->maxy + 1,
+                         z + CHUNK_SIZE + 1)) {
       continue;
     }
-    if (chunk->buffer == 0) {
+    if (OCCLUSION_CULLING && section->solid_layers) {
+      const float y = s * SECTION_SIZE - 0.5f;
+      occlusion_add_box(&visibility->occlusion, x, y, z, x + CHUNK_SIZE,
+                        y + section->solid_layers, z + CHUNK_SIZE);
+    }
+
+#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
+    gl_render_section(section);
+#endif
+
+    visibility->drawn[drawn++] = index;
+    result += section->faces;
+  }
+  // clouds are culled by their own layer, not the terrain's height
+  for (int i = 0; i < g->chunk_count && SHOW_CLOUDS && !g->ortho; i++) {
+    const Chunk *const chunk = g->chunks + i;
+    if (chunk->cloud_faces == 0 ||
+        chunk_distance(chunk, p, q) > g->render_radius ||
+        !chunk_visible(view->planes, chunk->p, chunk->q, WORLD_CLOUD_BOTTOM,
+                       WORLD_CLOUD_TOP)) {
       continue;
     }
 
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-    gl_render_chunk(chunk);
+    gl_render_clouds(chunk);
 #endif
 
-    result += chunk->faces;
+    result += chunk->cloud_faces;
+  }
+  // then the faces with holes in them, whose fragments cannot be dropped
+  // before they are shaded, over as little as the rest left uncovered
+#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
+  gl_setup_render_cutout();
+#endif
+  for (int i = 0; i < drawn; i++) {
+    const int index = visibility->drawn[i];
+    const Chunk *const chunk = visibility->chunks[index / CHUNK_SECTIONS];
+    const Section *const section = chunk->sections + index % CHUNK_SECTIONS;
+    if (section->cutout_faces == 0) {
+      continue;
+    }
+#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
+    gl_render_section_cutout(section);
+#endif
   }
   return result;
 }
@@ -1368,29 +1627,18 @@ void draw_triangles_3d_text(GLuint buffer, int count) {
 #endif
 }
 
-void render_signs(Player *player) {
-  PositionAndOrientation *positionAndOrientation =
-      &player->positionAndOrientation;
-  int p = chunked(positionAndOrientation->x);
-  int q = chunked(positionAndOrientation->z);
-  float matrix[16];
-  set_matrix_3d(matrix, g->width, g->height, positionAndOrientation->x,
-                positionAndOrientation->y, positionAndOrientation->z,
-                positionAndOrientation->rx, positionAndOrientation->ry, g->fov,
-                g->ortho, g->render_radius);
-  float planes[6][4];
-  frustum_planes(planes, g->render_radius, matrix);
-
+void render_signs(View *const view) {
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-  gl_setup_render_signs(matrix);
+  gl_setup_render_signs(view->matrix);
 #endif
 
   for (int i = 0; i < g->chunk_count; i++) {
     Chunk *chunk = g->chunks + i;
-    if (chunk_distance(chunk, p, q) > g->sign_radius) {
+    if (chunk_distance(chunk, view->p, view->q) > g->sign_radius) {
       continue;
     }
-    if (!chunk_visible(planes, chunk->p, chunk->q, chunk->miny, chunk->maxy)) {
+    if (!chunk_visible(view->planes, chunk->p, chunk->q, chunk->miny,
+                       chunk->maxy)) {
       continue;
     }
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
@@ -1399,64 +1647,60 @@ void render_signs(Player *player) {
   }
 }
 
-void render_sign(Player *player) {
+void render_sign(View *const view) {
   if (!g->typing || g->typing_buffer[0] != CRAFT_KEY_SIGN) {
     return;
   }
   int x, y, z, face;
-  if (!hit_test_face(player, &x, &y, &z, &face)) {
+  if (!hit_test_face(view->player, &x, &y, &z, &face)) {
     return;
   }
-  PositionAndOrientation *positionAndOrientation =
-      &player->positionAndOrientation;
-  float matrix[16];
-  set_matrix_3d(matrix, g->width, g->height, positionAndOrientation->x,
-                positionAndOrientation->y, positionAndOrientation->z,
-                positionAndOrientation->rx, positionAndOrientation->ry, g->fov,
-                g->ortho, g->render_radius);
 
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-  gl_render_sign(matrix, x, y, z, face);
+  gl_render_sign(view->matrix, x, y, z, face);
 #endif
 }
 
-void render_players(Player *player) {
-  PositionAndOrientation *positionAndOrientation =
-      &player->positionAndOrientation;
-  float matrix[16];
-  set_matrix_3d(matrix, g->width, g->height, positionAndOrientation->x,
-                positionAndOrientation->y, positionAndOrientation->z,
-                positionAndOrientation->rx, positionAndOrientation->ry, g->fov,
-                g->ortho, g->render_radius);
-
-#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-  gl_setup_render_players(matrix, positionAndOrientation);
-#endif
-
+/*
+ * Draw the players other than the viewer's, all at once: one cube, and
+ * the position and rotation of each.
+ */
+void render_players(View *const view) {
+  float data[MAX_PLAYERS * 5];
+  int count = 0;
   for (int i = 0; i < g->player_count; i++) {
-    Player *other_player = g->players + i;
-    if (other_player != player) {
-      // draw player
-      if (other_player->buffer == 0) {
-        continue;
-      }
-#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-      gl_render_player(other_player);
-#endif
+    const Player *other_player = g->players + i;
+    if (other_player == view->player || !other_player->placed) {
+      continue;
     }
+    const PositionAndOrientation *s = &other_player->positionAndOrientation;
+    float *d = data + count++ * 5;
+    d[0] = s->x;
+    d[1] = s->y;
+    d[2] = s->z;
+    d[3] = s->rx;
+    d[4] = s->ry;
+  }
+  if (!count) {
+    return;
   }
+#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
+  const GLsizei size = sizeof(float) * 5 * count;
+  if (g->player_buffer) {
+    gl_update_buffer(g->player_instances, size, data);
+  } else {
+    g->player_buffer = gen_player_buffer();
+    g->player_instances = gl_gen_buffer(size, data);
+  }
+  gl_setup_render_players(view->matrix, &view->player->positionAndOrientation,
+                          view->daylight);
+  gl_render_players(g->player_buffer, g->player_instances, count);
+#endif
 }
 
-void render_sky(Player *player, GLuint buffer) {
-  PositionAndOrientation *positionAndOrientation =
-      &player->positionAndOrientation;
-  float matrix[16];
-  set_matrix_3d(matrix, g->width, g->height, 0, 0, 0,
-                positionAndOrientation->rx, positionAndOrientation->ry, g->fov,
-                0, g->render_radius);
-
+void render_sky(View *const view, GLuint buffer) {
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-  gl_render_sky(buffer, matrix);
+  gl_render_sky(buffer, view->sky_matrix);
 #endif
 }
 
@@ -1466,37 +1710,153 @@ void draw_lines(GLuint buffer, int components, int count) {
 #endif
 }
 
-void render_wireframe(Player *player) {
-  PositionAndOrientation *positionAndOrientation =
-      &player->positionAndOrientation;
-  float matrix[16];
-  set_matrix_3d(matrix, g->width, g->height, positionAndOrientation->x,
-                positionAndOrientation->y, positionAndOrientation->z,
-                positionAndOrientation->rx, positionAndOrientation->ry, g->fov,
-                g->ortho, g->render_radius);
+void render_wireframe(View *const view) {
+  const PositionAndOrientation *const positionAndOrientation =
+      &view->player->positionAndOrientation;
   int hx, hy, hz;
   int hw = hit_test(0, positionAndOrientation->x, positionAndOrientation->y,
                     positionAndOrientation->z, positionAndOrientation->rx,
                     positionAndOrientation->ry, &hx, &hy, &hz);
   if (is_obstacle(hw)) {
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-    gl_render_wireframe(matrix, hx, hy, hz);
+    gl_render_wireframe(view->matrix, hx, hy, hz);
 #endif
   }
 }
 
-void render_text(int justify, float x, float y, float n, char *text) {
-  if (!do_render_text) {
+// Start a frame's lines of text in `batch`.
+void begin_text(TextBatch *const batch) {
+  batch->count = 0;
+  batch->length = 0;
+}
+
+/*
+ * Add a line of text to `batch`.  It is only laid out again if it differs
+ * from the line in the same place last frame, and then so are the lines
+ * after it, whose characters it may have written over.
+ */
+void render_text(TextBatch *const batch, int justify, float x, float y,
+                 float n, const char *const text) {
+  if (!do_render_text || batch->count == MAX_TEXT_RUNS) {
+    return;
+  }
+  TextRun *const run = batch->runs + batch->count++;
+  const int length = MIN_NUMBER((int)strlen(text), MAX_RUN_LENGTH - 1);
+  const int start = batch->length;
+  batch->length += length;
+  if (run->start == start && run->length == length && run->x == x &&
+      run->y == y && run->n == n && run->justify == justify &&
+      strncmp(run->text, text, length) == 0) {
+    return;
+  }
+  if (batch->capacity < batch->length) {
+    batch->capacity = MAX_NUMBER(batch->length, batch->capacity * 2);
+    batch->data = (float *)realloc(batch->data,
+                                   sizeof(float) * 24 * batch->capacity);
+  }
+  memcpy(run->text, text, length);
+  run->text[length] = '\0';
+  run->x = x;
+  run->y = y;
+  run->n = n;
+  run->justify = justify;
+  run->start = start;
+  run->length = length;
+  x -= n * justify * (length - 1) / 2;
+  for (int i = 0; i < length; i++) {
+    make_character(batch->data + (start + i) * 24, x, y, n / 2, n, text[i]);
+    x += n;
+  }
+  for (int i = batch->count; i < MAX_TEXT_RUNS; i++) {
+    batch->runs[i].start = -1;
+  }
+  batch->uploaded = -1;
+}
+
+// Draw the lines added to `batch` since begin_text, in one go.
+void draw_text(TextBatch *const batch) {
+  if (!batch->length) {
     return;
   }
-
   float matrix[16];
   set_matrix_2d(matrix, g->width, g->height);
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-  gl_render_text(matrix, justify, x, y, n, text);
+  if (batch->uploaded != batch->length) {
+    const GLsizei size = sizeof(float) * 24 * batch->length;
+    if (batch->buffer) {
+      gl_update_buffer(batch->buffer, size, batch->data);
+    } else {
+      batch->buffer = gl_gen_buffer(size, batch->data);
+    }
+    batch->uploaded = batch->length;
+  }
+  gl_render_text(matrix, batch->buffer, batch->length);
 #endif
 }
 
+// Make the crosshair's buffer again if the window changed size.
+void ensure_crosshair_buffer() {
+  Hud *const hud = &g->hud;
+  if (hud->crosshair_buffer && hud->crosshair_width == g->width &&
+      hud->crosshair_height == g->height && hud->crosshair_scale == g->scale) {
+    return;
+  }
+  const int x = g->width / 2, y = g->height / 2, p = 10 * g->scale;
+  float data[] = {x, y - p, x, y + p, x - p, y, x + p, y};
+#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
+  gl_del_buffer(hud->crosshair_buffer);
+  hud->crosshair_buffer = gl_gen_buffer(sizeof(data), data);
+#endif
+  hud->crosshair_width = g->width;
+  hud->crosshair_height = g->height;
+  hud->crosshair_scale = g->scale;
+}
+
+// Make the buffer of the block in hand again if another was picked.
+void ensure_item_buffer(int w) {
+  Hud *const hud = &g->hud;
+  if (hud->item_buffer && hud->item == w) {
+    return;
+  }
+  const float x = 0, y = 0, z = 0, n = 0.5;
+  const int faces = is_plant(w) ? 4 : 6;
+  float *data = malloc_faces(10, faces);
+  if (is_plant(w)) {
+    float ambient_occlusion = 0, light = 1;
+    make_plant(data, ambient_occlusion, light, x, y, z, n, w, 45);
+  } else {
+    float ambient_occlusion[6][4] = {0};
+    float light[6][4] = {{0.5, 0.5, 0.5, 0.5}, {0.5, 0.5, 0.5, 0.5},
+                         {0.5, 0.5, 0.5, 0.5}, {0.5, 0.5, 0.5, 0.5},
+                         {0.5, 0.5, 0.5, 0.5}, {0.5, 0.5, 0.5, 0.5}};
+    make_cube(data, ambient_occlusion, light, 1, 1, 1, 1, 1, 1, x, y, z, n,
+              w);
+  }
+#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
+  gl_del_buffer(hud->item_buffer);
+  hud->item_buffer = gl_gen_faces(10, faces, data);
+#else
+  free(data);
+#endif
+  hud->item = w;
+}
+
+void delete_hud() {
+  Hud *const hud = &g->hud;
+  TextBatch *const batches[2] = {&hud->text, &hud->pip_text};
+  for (int i = 0; i < 2; i++) {
+#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
+    gl_del_buffer(batches[i]->buffer);
+#endif
+    free(batches[i]->data);
+  }
+#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
+  gl_del_buffer(hud->crosshair_buffer);
+  gl_del_buffer(hud->item_buffer);
+#endif
+  memset(hud, 0, sizeof(Hud));
+}
+
 void add_message(const char *text) {
   printf("%s\n", text);
   snprintf(g->messages[g->message_index], MAX_TEXT_LENGTH, "%s", text);
@@ -1697,6 +2057,25 @@ void tree(Block *block) {
   }
 }
 
+#ifdef ENABLE_LOOPBACK
+/*
+ * Play online against a server running inside this process, on the
+ * world saved in FILE.db (the offline world by default).
+ */
+void set_loopback(const char *filename) {
+  g->mode_changed = 1;
+  g->mode = MODE_ONLINE;
+  g->loopback = 1;
+  if (filename) {
+    snprintf(g->loopback_path, MAX_PATH_LENGTH, "%s.db", filename);
+  } else {
+    snprintf(g->loopback_path, MAX_PATH_LENGTH, "%s", DB_PATH);
+  }
+  snprintf(g->server_addr, MAX_ADDR_LENGTH, "loopback");
+  snprintf(g->db_path, MAX_PATH_LENGTH, "cache.loopback.db");
+}
+#endif
+
 void parse_command(const char *buffer, int forward) {
   char username[128] = {0};
   char token[128] = {0};
@@ -1721,10 +2100,17 @@ void parse_command(const char *buffer, int forward) {
              1) {
     g->mode_changed = 1;
     g->mode = MODE_ONLINE;
+    g->loopback = 0;
     strncpy(g->server_addr, server_addr, MAX_ADDR_LENGTH);
     g->server_port = server_port;
     snprintf(g->db_path, MAX_PATH_LENGTH, "cache.%s.%d.db", g->server_addr,
              g->server_port);
+#ifdef ENABLE_LOOPBACK
+  } else if (sscanf(buffer, "/loopback %128s", filename) == 1) {
+    set_loopback(filename);
+  } else if (strcmp(buffer, "/loopback") == 0) {
+    set_loopback(NULL);
+#endif
   } else if (sscanf(buffer, "/offline %128s", filename) == 1) {
     g->mode_changed = 1;
     g->mode = MODE_OFFLINE;
@@ -1733,14 +2119,41 @@ void parse_command(const char *buffer, int forward) {
     g->mode_changed = 1;
     g->mode = MODE_OFFLINE;
     snprintf(g->db_path, MAX_PATH_LENGTH, "%s", DB_PATH);
+  } else if (sscanf(buffer, "/generator %128s", filename) == 1) {
+    Generator *generator = generator_create(filename, 0, 0);
+    if (g->mode == MODE_ONLINE && !g->loopback) {
+      add_message("The server picks the generator.");
+    } else if (generator) {
+      g->mode_changed = 1;
+      snprintf(g->next_generator, MAX_PATH_LENGTH, "%s", filename);
+    } else {
+      add_message("Unknown generator.");
+    }
+    generator_destroy(generator);
   } else if (sscanf(buffer, "/view %d", &radius) == 1) {
-    if (radius >= 1 && radius <= 24) {
+    if (radius >= 1 && radius <= MAX_RENDER_RADIUS) {
       g->create_radius = radius;
       g->render_radius = radius;
       g->delete_radius = radius + 4;
+      client_view(radius);
     } else {
-      add_message("Viewing distance must be between 1 and 24.");
+      add_message("Viewing distance must be between 1 and 32.");
     }
+  } else if (sscanf(buffer, "/lod %d", &radius) == 1) {
+    if (radius >= 0) {
+      g->lod_radius = radius;
+    } else {
+      add_message("Detail distance must be 0 or more.");
+    }
+  } else if (sscanf(buffer, "/record %128s", filename) == 1) {
+    if (client_record(filename)) {
+      add_message("Could not open the recording file.");
+    } else {
+      add_message("Recording network traffic.");
+    }
+  } else if (strcmp(buffer, "/record") == 0) {
+    client_record(NULL);
+    add_message("Recording stopped.");
   } else if (strcmp(buffer, "/copy") == 0) {
     copy();
   } else if (strcmp(buffer, "/paste") == 0) {
@@ -2215,6 +2628,32 @@ void handle_movement(double dt) {
   }
 }
 
+/*
+ * Generate terrain as the server does, with the generator and seed it
+ * named when we connected.  The chunks made so far came from the default
+ * generator, so they are dropped and made again.
+ */
+void use_generator(const char *name, int use_seed, unsigned int seed) {
+  char world_key[MAX_TERRAIN_WORLD_LENGTH];
+  terrain_world(world_key, name, use_seed, seed);
+  if (!strcmp(world_key, g->world_key)) {
+    return;
+  }
+  Generator *generator = generator_create(name, use_seed, seed);
+  if (!generator) {
+    char text[MAX_TEXT_LENGTH];
+    snprintf(text, MAX_TEXT_LENGTH,
+             "This server's generator, %s, is not available here.", name);
+    add_message(text);
+    return;
+  }
+  drain_workers();
+  delete_all_chunks();
+  generator_destroy(g->generator);
+  g->generator = generator;
+  snprintf(g->world_key, MAX_TERRAIN_WORLD_LENGTH, "%s", world_key);
+}
+
 void parse_buffer(char *buffer) {
   Player *me = g->players;
   PositionAndOrientation *positionAndOrientation =
@@ -2263,22 +2702,47 @@ void parse_buffer(char *buffer) {
         player = g->players + g->player_count;
         g->player_count++;
         player->id = pid;
-        player->buffer = 0;
+        player->placed = 0;
+        player->sample_count = 0;
         snprintf(player->name, MAX_NAME_LENGTH, "player%d", pid);
-        update_player(player, px, py, pz, prx, pry, 1);  // twice
       }
       if (player) {
+        quantize_position(player->state, px, py, pz, prx, pry);
         update_player(player, px, py, pz, prx, pry, 1);
       }
     }
+    int delta[POSITION_FIELDS] = {0};
+    if (sscanf(line, "M,%d,%d,%d,%d,%d,%d", &pid, delta, delta + 1, delta + 2,
+               delta + 3, delta + 4) >= 2) {
+      Player *player = find_player(pid);
+      if (player) {
+        int *state = player->state;
+        for (int i = 0; i < POSITION_FIELDS; i++) {
+          state[i] += delta[i];
+        }
+        update_player(player, state[0] / (float)POSITION_SCALE,
+                      state[1] / (float)POSITION_SCALE,
+                      state[2] / (float)POSITION_SCALE,
+                      state[3] / (float)ROTATION_SCALE,
+                      state[4] / (float)ROTATION_SCALE, 1);
+      }
+    }
+    int version, use_seed;
+    unsigned int seed;
+    char generator[MAX_GENERATOR_NAME_LENGTH];
+    const int fields = sscanf(line, "V,%d,%31[^,],%d,%u", &version,
+                              generator, &use_seed, &seed);
+    if (fields >= 1) {
+      client_server_version(version);
+    }
+    if (fields == 4) {
+      use_generator(generator, use_seed, seed);
+    }
     if (sscanf(line, "D,%d", &pid) == 1) {
       // delete player
       Player *player = find_player(pid);
       if (player) {
         int count = g->player_count;
-#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-        gl_del_buffer(player->buffer);
-#endif
         Player *other_player = g->players + (--count);
         memcpy(player, other_player, sizeof(Player));
         g->player_count = count;
@@ -2415,6 +2879,12 @@ int initialize_craft(int argc, char **argv) {
 #endif
 
     // CHECK COMMAND LINE ARGUMENTS //
+#ifdef ENABLE_LOOPBACK
+    if ((argc == 2 || argc == 3) && strcmp(argv[1], "--loopback") == 0) {
+      set_loopback(argc == 3 ? argv[2] : NULL);
+      g->mode_changed = 0;
+    } else
+#endif
     if (argc == 2 || argc == 3) {
       g->mode = MODE_ONLINE;
       strncpy(g->server_addr, argv[1], MAX_ADDR_LENGTH);
@@ -2430,6 +2900,9 @@ int initialize_craft(int argc, char **argv) {
     g->render_radius = RENDER_CHUNK_RADIUS;
     g->delete_radius = DELETE_CHUNK_RADIUS;
     g->sign_radius = RENDER_SIGN_RADIUS;
+    g->lod_radius = LOD_CHUNK_RADIUS;
+
+    pool_alloc(&g->pool);
 
 #ifdef ENABLE_NO_THREADS
 #else
@@ -2470,14 +2943,45 @@ int main(int argc, char **argv) {
       }
     }
 
+    // GENERATOR INITIALIZATION //
+    // an offline world keeps the generator it was made with; a server
+    // names its own when the client connects, see use_generator
+    char generator[MAX_PATH_LENGTH] = GENERATOR_DEFAULT;
+    if (g->mode == MODE_OFFLINE) {
+      if (g->next_generator[0]) {
+        snprintf(generator, MAX_PATH_LENGTH, "%s", g->next_generator);
+      } else {
+        db_load_generator(generator, MAX_PATH_LENGTH);
+      }
+    }
+    g->generator = generator_create(generator, 0, 0);
+    if (g->generator) {
+      if (g->mode == MODE_OFFLINE) {
+        db_save_generator(generator);
+      }
+    } else {
+      // a plugin that is gone; the world keeps its name for when it is back
+      g->generator = generator_create(GENERATOR_DEFAULT, 0, 0);
+    }
+    terrain_world(g->world_key, generator_name(g->generator), 0, 0);
+
     // CLIENT INITIALIZATION //
     if (g->mode == MODE_ONLINE) {
       client_enable();
-      client_connect(g->server_addr, g->server_port);
+#ifdef ENABLE_LOOPBACK
+      if (g->loopback) {
+        client_connect_loopback(g->loopback_path, g->next_generator);
+      } else
+#endif
+        client_connect(g->server_addr, g->server_port);
       client_start();
       client_version(1);
       login();
+      if (g->create_radius != CREATE_CHUNK_RADIUS) {
+        client_view(g->create_radius);
+      }
     }
+    g->next_generator[0] = '\0';
 
     // LOCAL VARIABLES //
     reset_model();
@@ -2492,7 +2996,7 @@ int main(int argc, char **argv) {
         &g->players->positionAndOrientation;
     me->id = 0;
     me->name[0] = '\0';
-    me->buffer = 0;
+    me->placed = 1;
     g->player_count = 1;
 
     // LOAD STATE FROM DATABASE //
@@ -2575,55 +3079,24 @@ int main(int argc, char **argv) {
       }
 
       // SEND POSITION TO SERVER //
-      if (now - last_update > 0.1) {
+      if (client_position(now - last_update, positionAndOrientation->x,
+                          positionAndOrientation->y, positionAndOrientation->z,
+                          positionAndOrientation->rx,
+                          positionAndOrientation->ry)) {
         last_update = now;
-        client_position(positionAndOrientation->x, positionAndOrientation->y,
-                        positionAndOrientation->z, positionAndOrientation->rx,
-                        positionAndOrientation->ry);
       }
 
       // PREPARE TO RENDER //
       g->observe1 = g->observe1 % g->player_count;
       g->observe2 = g->observe2 % g->player_count;
       delete_chunks();
-#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-      gl_del_buffer(me->buffer);
-#endif
-      me->buffer = gen_player_buffer(
-          positionAndOrientation->x, positionAndOrientation->y,
-          positionAndOrientation->z, positionAndOrientation->rx,
-          positionAndOrientation->ry);
+      update_lods(g->players);
       for (int i = 1; i < g->player_count; i++) {
-        // interpolate playen
-        {
-          Player *player = g->players + i;
-          PositionAndOrientation *positionAndOrientation1 =
-              &player->positionAndOrientation1;
-          PositionAndOrientation *positionAndOrientation2 =
-              &player->positionAndOrientation2;
-          float t1 = positionAndOrientation2->t - positionAndOrientation1->t,
-                t2 = glfwGetTime() - positionAndOrientation2->t;
-          t1 = MIN_NUMBER(t1, 1);
-          t1 = MAX_NUMBER(t1, 0.1);
-          float p = MIN_NUMBER(t2 / t1, 1);
-          update_player(
-              player,
-              positionAndOrientation1->x +
-                  (positionAndOrientation2->x - positionAndOrientation1->x) * p,
-              positionAndOrientation1->y +
-                  (positionAndOrientation2->y - positionAndOrientation1->y) * p,
-              positionAndOrientation1->z +
-                  (positionAndOrientation2->z - positionAndOrientation1->z) * p,
-              positionAndOrientation1->rx +
-                  (positionAndOrientation2->rx - positionAndOrientation1->rx) *
-                      p,
-              positionAndOrientation1->ry +
-                  (positionAndOrientation2->ry - positionAndOrientation1->ry) *
-                      p,
-              0);
-        }
+        interpolate_player(g->players + i, now);
       }
       Player *player = g->players + g->observe1;
+      View view;
+      set_view(&view, player, g->visibility);
 
       // RENDER 3-D SCENE //
 
@@ -2632,21 +3105,21 @@ int main(int argc, char **argv) {
       gl_clear_depth_buffer();
 #endif
       if (do_render_sky) {
-        render_sky(player, sky_buffer);
+        render_sky(&view, sky_buffer);
       }
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
       gl_clear_depth_buffer();
 #endif
       int face_count = 0;  // default value
       if (do_render_chunks) {
-        face_count = render_chunks(player);
+        face_count = render_chunks(&view);
       }
-      render_signs(player);
-      render_sign(player);
-      render_players(player);
+      render_signs(&view);
+      render_sign(&view);
+      render_players(&view);
       if (SHOW_WIREFRAME) {
         if (do_render_wireframe) {
-          render_wireframe(player);
+          render_wireframe(&view);
         }
       }
 
@@ -2658,24 +3131,13 @@ int main(int argc, char **argv) {
         // render crosshairs
         float matrix[16];
         set_matrix_2d(matrix, g->width, g->height);
-        GLuint crosshair_buffer;
-        {
-          // initialize crosshair_buffer
-          const int x = g->width / 2, y = g->height / 2, p = 10 * g->scale;
-          float data[] = {x, y - p, x, y + p, x - p, y, x + p, y};
-#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-          crosshair_buffer = gl_gen_buffer(sizeof(data), data);
-#endif
-        }
+        ensure_crosshair_buffer();
 
         if (do_render_crosshairs) {
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-          gl_render_crosshairs(crosshair_buffer, matrix);
+          gl_render_crosshairs(g->hud.crosshair_buffer, matrix);
 #endif
         }
-#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-        gl_del_buffer(crosshair_buffer);
-#endif
       }
       if (SHOW_ITEM) {
         // render item
@@ -2689,18 +3151,8 @@ int main(int argc, char **argv) {
         }
 
         int w = items[g->item_index];
+        ensure_item_buffer(w);
         if (is_plant(w)) {
-          GLuint plant_buffer;
-          {
-            // initialize plant buffer
-            const float x = 0, y = 0, z = 0, n = 0.5;
-            float *data = malloc_faces(10, 4);
-            float ambient_occlusion = 0, light = 1;
-            make_plant(data, ambient_occlusion, light, x, y, z, n, w, 45);
-#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-            plant_buffer = gl_gen_faces(10, 4, data);
-#endif
-          }
           // TODO -
           // make and initilize the VAO once at initilization time.
           // only thing that should happen here
@@ -2710,47 +3162,28 @@ int main(int argc, char **argv) {
           // also, remove magic numbers, like 24
 
           // draw plant
-          if (plant_buffer != 0) {
+          if (g->hud.item_buffer != 0) {
             if (do_render_plant) {
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-              gl_render_plant(plant_buffer);
+              gl_render_plant(g->hud.item_buffer);
 #endif
             }
           }
-#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-          gl_del_buffer(plant_buffer);
-#endif
         } else {
-          GLuint cube_buffer;
-          {
-            // initilize cube_buffer
-            const float x = 0, y = 0, z = 0, n = 0.5;
-            float *data = malloc_faces(10, 6);
-            float ambient_occlusion[6][4] = {0};
-            float light[6][4] = {{0.5, 0.5, 0.5, 0.5}, {0.5, 0.5, 0.5, 0.5},
-                                 {0.5, 0.5, 0.5, 0.5}, {0.5, 0.5, 0.5, 0.5},
-                                 {0.5, 0.5, 0.5, 0.5}, {0.5, 0.5, 0.5, 0.5}};
-            make_cube(data, ambient_occlusion, light, 1, 1, 1, 1, 1, 1, x, y, z,
-                      n, w);
-#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-            cube_buffer = gl_gen_faces(10, 6, data);
-#endif
-          }
           // draw cube buffer
-          if (cube_buffer != 0) {
+          if (g->hud.item_buffer != 0) {
             if (do_render_cube) {
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-              gl_render_cube(cube_buffer);
+              gl_render_cube(g->hud.item_buffer);
 #endif
             }
           }
-#ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-          gl_del_buffer(cube_buffer);
-#endif
         }
       }
 
       // RENDER TEXT //
+      TextBatch *const text = &g->hud.text;
+      begin_text(text);
       char text_buffer[1024];
       float ts = 12 * g->scale, tx = ts / 2, ty = g->height - ts;
       if (SHOW_INFO_TEXT) {
@@ -2765,33 +3198,34 @@ int main(int argc, char **argv) {
                  positionAndOrientation->y, positionAndOrientation->z,
                  g->player_count, g->chunk_count, face_count * 2, hour, am_pm,
                  fps.fps);
-        render_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+        render_text(text, ALIGN_LEFT, tx, ty, ts, text_buffer);
         ty -= ts * 2;
       }
       if (SHOW_CHAT_TEXT) {
         for (int i = 0; i < MAX_MESSAGES; i++) {
           int index = (g->message_index + i) % MAX_MESSAGES;
           if (strlen(g->messages[index])) {
-            render_text(ALIGN_LEFT, tx, ty, ts, g->messages[index]);
+            render_text(text, ALIGN_LEFT, tx, ty, ts, g->messages[index]);
             ty -= ts * 2;
           }
         }
       }
       if (g->typing) {
         snprintf(text_buffer, 1024, "> %s", g->typing_buffer);
-        render_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
+        render_text(text, ALIGN_LEFT, tx, ty, ts, text_buffer);
         ty -= ts * 2;
       }
       if (SHOW_PLAYER_NAMES) {
         if (player != me) {
-          render_text(ALIGN_CENTER, g->width / 2, ts, ts, player->name);
+          render_text(text, ALIGN_CENTER, g->width / 2, ts, ts, player->name);
         }
         Player *other_player = player_crosshair(player);
         if (other_player) {
-          render_text(ALIGN_CENTER, g->width / 2, g->height / 2 - ts - 24, ts,
-                      other_player->name);
+          render_text(text, ALIGN_CENTER, g->width / 2,
+                      g->height / 2 - ts - 24, ts, other_player->name);
         }
       }
+      draw_text(text);
 
       // RENDER PICTURE IN PICTURE //
       if (g->observe2) {
@@ -2813,23 +3247,27 @@ int main(int argc, char **argv) {
         g->height = ph;
         g->ortho = 0;
         g->fov = 65;
+        set_view(&view, player, g->visibility + 1);
 
         if (do_render_sky) {
-          render_sky(player, sky_buffer);
+          render_sky(&view, sky_buffer);
         }
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
         gl_clear_depth_buffer();
 #endif
         if (do_render_chunks) {
-          render_chunks(player);
+          render_chunks(&view);
         }
-        render_signs(player);
-        render_players(player);
+        render_signs(&view);
+        render_players(&view);
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
         gl_clear_depth_buffer();
 #endif
         if (SHOW_PLAYER_NAMES) {
-          render_text(ALIGN_CENTER, pw / 2, ts, ts, player->name);
+          TextBatch *const pip_text = &g->hud.pip_text;
+          begin_text(pip_text);
+          render_text(pip_text, ALIGN_CENTER, pw / 2, ts, ts, player->name);
+          draw_text(pip_text);
         }
       }
 
@@ -2852,6 +3290,7 @@ int main(int argc, char **argv) {
     gui_cleanup();
 
     // SHUTDOWN //
+    drain_workers();
     db_save_state(positionAndOrientation->x, positionAndOrientation->y,
                   positionAndOrientation->z, positionAndOrientation->rx,
                   positionAndOrientation->ry);
@@ -2862,17 +3301,18 @@ int main(int argc, char **argv) {
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
     gl_del_buffer(sky_buffer);
 #endif
+    delete_hud();
     delete_all_chunks();
+    generator_destroy(g->generator);
+    g->generator = NULL;
     // delete all players
-    {
-      for (int i = 0; i < g->player_count; i++) {
-        Player *player = g->players + i;
 #ifdef ENABLE_OPENGL_CORE_PROFILE_RENDERER
-        gl_del_buffer(player->buffer);
+    gl_del_buffer(g->player_buffer);
+    gl_del_buffer(g->player_instances);
 #endif
-      }
-      g->player_count = 0;
-    }
+    g->player_buffer = 0;
+    g->player_instances = 0;
+    g->player_count = 0;
   }
 
   glfwDestroyWindow(g->window);
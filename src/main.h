@@ -26,14 +26,26 @@
 // TODO - perhaps don't do a recursive include, but ensure that anything that
 // imports main.h imports util.h
 
+#include "generator.h"
+#include "occlusion.h"
+#include "pool.h"
+#include "protocol.h"
+#include "terrain.h"
 #include "util.h"
+#include "world.h"
 
 BEGIN_C_DECL
 
 #define MAX_CHUNKS 8192
 #define MAX_PLAYERS 128
+#define PLAYER_SAMPLES 8
+#define MIN_INTERPOLATION_DELAY 0.1
+#define MAX_INTERPOLATION_DELAY 1.0
+#define MAX_EXTRAPOLATION 0.25
 #define WORKERS 4
 #define MAX_TEXT_LENGTH 256
+#define MAX_TEXT_RUNS (MAX_MESSAGES + 8)
+#define MAX_RUN_LENGTH (MAX_TEXT_LENGTH * 2)
 #define MAX_NAME_LENGTH 32
 #define MAX_PATH_LENGTH 256
 #define MAX_ADDR_LENGTH 256
@@ -52,6 +64,35 @@ BEGIN_C_DECL
 #define WORKER_BUSY 1
 #define WORKER_DONE 2
 
+#define SECTION_SIZE 32
+#define CHUNK_SECTIONS (256 / SECTION_SIZE)
+#define ALL_SECTIONS ((1 << CHUNK_SECTIONS) - 1)
+#define HEIGHT_NONE -1     // a column with no obstacle in it
+#define HEIGHT_UNKNOWN -2  // its top was removed, look again when asked
+#define MAX_LOD 2          // the coarsest mesh, in cells of 1 << MAX_LOD
+#define ALL_CONNECTED 0x7fff  // every pair of a section's faces
+#define MAX_RENDER_RADIUS 32
+#define VIEW_SIZE (MAX_RENDER_RADIUS * 2 + 1)
+#define VIEW_SECTIONS (VIEW_SIZE * VIEW_SIZE * CHUNK_SECTIONS)
+#define VIEWS 2  // the main view and the picture in picture
+
+/*
+ * A Section is the part of a chunk between two multiples of
+ * SECTION_SIZE in y.  Each one has its own mesh, so that a change only
+ * remeshes the sections it can affect, and is culled on its own.
+ */
+typedef struct {
+  int faces;
+  int cutout_faces;  // the last of faces, with holes in their textures
+  int miny;  // the y range of the blocks with exposed faces
+  int maxy;
+  char empty;          // no blocks at all
+  char full;           // nothing but opaque blocks
+  char solid_layers;   // layers from its bottom that are all opaque
+  uint16_t connected;  // the pairs of its faces open to each other
+  uint32_t buffer;
+} Section;
+
 /*
  * A Chunk is a a subsection of the terrain, bound
  * by a square on the x-z plane.
@@ -65,27 +106,58 @@ typedef struct {
   SignList signs;
   int p;
   int q;
-  int faces;
+  Section sections[CHUNK_SECTIONS];
   int sign_faces;
-  int dirty;
-  int miny;
+  int dirty;  // the sections to remesh, a bit each
+  int lod;    // the level of detail of its mesh, see chunk_lod
+  int miny;   // the y range of all the sections, for signs
   int maxy;
-  uint32_t buffer;
+  short heights[CHUNK_SIZE * CHUNK_SIZE];  // the highest obstacle, by x, z
+  int cloud_faces;
   uint32_t sign_buffer;
+  uint32_t cloud_buffer;
 } Chunk;
 
 typedef struct {
   int p;
   int q;
   int load;
+  int sections;  // the sections to mesh, a bit each
+  int lod;
   Map *block_maps[3][3];
   Map *light_maps[3][3];
-  int miny;
-  int maxy;
-  int faces;
-  float *data;
+  Section meshes[CHUNK_SECTIONS];
+  float *data[CHUNK_SECTIONS];
+  short heights[CHUNK_SIZE * CHUNK_SIZE];
+  int cloud_faces;
+  float *cloud_data;
 } WorkerItem;
 
+/*
+ * The arrays compute_chunk meshes from, kept by each thread that meshes
+ * so they are not allocated for every chunk.  Only what the last chunk
+ * wrote to the opaque and light arrays is cleared before the next.
+ */
+typedef struct {
+  char *opaque;       // a byte per block, only filled in for lights
+  char *light;
+  uint64_t *solid;    // a bit per opaque block, in rows along z
+  uint64_t *present;  // the blocks to mesh
+  char *blocks;  // the type of each block in present
+  char *shade;   // the sky shade of each block, in eighths
+  uint64_t *corners;  // the occlusion of each corner, see _find_corners
+  short *highest;
+  float *cutout;      // the cutout faces of the section being meshed
+  int cutout_room;    // faces
+  int layers;         // y layers allocated
+  int opaque_layers;  // where opaque may have nonzero entries: the
+  int opaque_x0;      // layers below opaque_layers, rows opaque_x0 to
+  int opaque_x1;      // opaque_x1 of each
+  int light_layers;   // where light may, whole layers
+  // the faces of each section's last mesh, to size the next one's buffer
+  int faces[CHUNK_SECTIONS];
+} Scratch;
+
 typedef struct {
   int index;
   int state;
@@ -93,6 +165,7 @@ typedef struct {
   mtx_t mtx;
   cnd_t cnd;
   WorkerItem item;
+  Scratch scratch;
 } Worker;
 
 /*
@@ -142,29 +215,136 @@ typedef struct {
   float ry;
 
   /*
-   * TODO : figure out what t is and explain it.
+   * For the samples of a remote player, the time (glfwGetTime) the
+   * update arrived.  Unused for the displayed position.
    */
   float t;
 } PositionAndOrientation;
 
+/*
+ * A player.  For remote players, `samples` holds the most recent
+ * position updates from the server, oldest first, and
+ * positionAndOrientation is interpolated between them a little behind
+ * real time.  `state` is the quantized position that "M" deltas from the
+ * server apply to.
+ */
 typedef struct {
   int id;
   char name[MAX_NAME_LENGTH];
   PositionAndOrientation positionAndOrientation;
-  PositionAndOrientation positionAndOrientation1;
-  PositionAndOrientation positionAndOrientation2;
-  uint32_t buffer;
+  PositionAndOrientation samples[PLAYER_SAMPLES];
+  int sample_count;
+  int state[POSITION_FIELDS];
+  int placed;  // has a position to be drawn at
 } Player;
 
+/*
+ * The chunks around the camera, and the sections that can be seen from
+ * it, walked outwards from the camera's section.  Indexed by section, in
+ * chunks VIEW_SIZE to a side.  The walk does not depend on which way the
+ * camera looks, so it is kept until the camera enters another section or
+ * the chunks change.
+ */
+typedef struct {
+  Chunk *chunks[VIEW_SIZE * VIEW_SIZE];
+  signed char from[VIEW_SECTIONS];   // the face each was entered through
+  signed char steps[VIEW_SECTIONS];  // the directions taken to it, or -1
+  int queue[VIEW_SECTIONS];          // nearest first, once walked
+  int sorted[VIEW_SECTIONS];         // where they are sorted into
+  int count;                         // in queue
+  int drawn[VIEW_SECTIONS];          // those the last frame drew
+  // the camera's section and the radius it was walked for, and whether
+  // the chunks have changed since
+  int p;
+  int q;
+  int s;
+  int radius;
+  int stale;
+  Occlusion occlusion;
+} Visibility;
+
+/*
+ * What the passes that draw the world from one player's camera share,
+ * worked out once a frame by set_view.
+ */
+typedef struct {
+  Player *player;
+  float x;  // the camera
+  float y;
+  float z;
+  int p;  // its chunk
+  int q;
+  float daylight;
+  float matrix[16];
+  float sky_matrix[16];  // the same, looking out from the origin
+  float planes[6][4];
+  Visibility *visibility;  // this view's own, kept from frame to frame
+} View;
+
+/*
+ * A line of HUD text as it was last laid out, at `start` in its batch's
+ * vertices.  Text past MAX_RUN_LENGTH - 1 characters is cut.
+ */
+typedef struct {
+  char text[MAX_RUN_LENGTH];
+  float x;
+  float y;
+  float n;
+  int justify;
+  int start;
+  int length;
+} TextRun;
+
+/*
+ * The lines of HUD text drawn over one view, kept from frame to frame so
+ * only those that change are laid out again, and the buffer is only
+ * uploaded when one did.  They are drawn together, by draw_text.
+ */
+typedef struct {
+  TextRun runs[MAX_TEXT_RUNS];
+  int count;     // the runs this frame
+  int length;    // the characters in them
+  int capacity;  // characters data has room for
+  int uploaded;  // the characters in buffer, or -1 if it is out of date
+  float *data;   // 24 floats a character
+  uint32_t buffer;
+} TextBatch;
+
+// What the HUD draws, kept until it changes.
+typedef struct {
+  TextBatch text;      // over the main view
+  TextBatch pip_text;  // over the picture in picture
+  uint32_t crosshair_buffer;
+  int crosshair_width;  // the size and scale it was made for
+  int crosshair_height;
+  int crosshair_scale;
+  uint32_t item_buffer;
+  int item;  // the block item_buffer shows, or 0
+} Hud;
+
 typedef struct {
   GLFWwindow *window;
   Worker workers[WORKERS];
+  Scratch scratch;  // for meshing on the main thread
+  Pool pool;        // vertex buffers of chunk meshes
+  Visibility visibility[VIEWS];
+  Hud hud;
+  uint32_t player_buffer;     // the cube every player is drawn as
+  uint32_t player_instances;  // where each of them is, this frame
+  Generator *generator;
+  // what /generator picked for the next world loaded, or "" to keep the
+  // world's own
+  char next_generator[MAX_PATH_LENGTH];
+  char world_key[MAX_TERRAIN_WORLD_LENGTH];
   Chunk chunks[MAX_CHUNKS];
   int chunk_count;
   int create_radius;
   int render_radius;
   int delete_radius;
   int sign_radius;
+  int lod_radius;  // meshes get coarser beyond it, 0 to never
+  int lod_p;       // the chunk levels of detail are measured from,
+  int lod_q;       // the local player's, whichever views are drawn
   Player players[MAX_PLAYERS];
   int player_count;
   int typing;
@@ -186,6 +366,8 @@ typedef struct {
   char db_path[MAX_PATH_LENGTH];
   char server_addr[MAX_ADDR_LENGTH];
   int server_port;
+  int loopback;
+  char loopback_path[MAX_PATH_LENGTH];
   int day_length;
   int time_changed;
   Block block0;
@@ -201,6 +383,8 @@ typedef struct {
   uint32_t position;
   uint32_t normal;
   uint32_t uv;
+  uint32_t offset;    // where to put each player, or -1
+  uint32_t rotation;  // and which way it faces
   uint32_t matrix;
   uint32_t sampler;
   uint32_t camera;
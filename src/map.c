@@ -141,12 +141,12 @@ int map_get(const Map *const map, int x, int y, int z) {
   return 0;
 }
 
-void map_grow(Map *map) {
+static void _map_resize(Map *map, unsigned int mask) {
   Map new_map;
   new_map.dx = map->dx;
   new_map.dy = map->dy;
   new_map.dz = map->dz;
-  new_map.mask = (map->mask << 1) | 1;
+  new_map.mask = mask;
   new_map.size = 0;
   new_map.data = (MapEntry *)calloc(new_map.mask + 1, sizeof(MapEntry));
   for (unsigned int i = 0; i <= map->mask; i++) {
@@ -165,3 +165,19 @@ void map_grow(Map *map) {
   map->size = new_map.size;
   map->data = new_map.data;
 }
+
+void map_grow(Map *map) { _map_resize(map, (map->mask << 1) | 1); }
+
+/*
+ * Grow the map ahead of inserting `count` more entries, so that it is
+ * rehashed at most once instead of once per doubling.
+ */
+void map_reserve(Map *map, unsigned int count) {
+  unsigned int mask = map->mask;
+  while ((map->size + count) * 2 > mask) {
+    mask = (mask << 1) | 1;
+  }
+  if (mask != map->mask) {
+    _map_resize(map, mask);
+  }
+}
@@ -58,6 +58,7 @@ void map_alloc(Map *map, int dx, int dy, int dz, int mask);
 void map_free(Map *map);
 void map_copy(Map *dst, Map *src);
 void map_grow(Map *map);
+void map_reserve(Map *map, unsigned int count);
 int map_set(Map *map, int x, int y, int z, int w);
 int map_get(const Map *const map, int x, int y, int z);
 
@@ -0,0 +1,911 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "tinycthread.h"
+
+#include "sign.h"
+
+#include "map.h"
+
+#include "main.h"
+
+#include "cube.h"
+#include "item.h"
+#include "mesh.h"
+#include "noise.h"
+#include "util.h"
+
+/*
+ * Copy generated terrain into a chunk's block map, sized up front so
+ * that it does not rehash while filling.  Blocks in the ring around the
+ * chunk are stored negated, as create_world emits them.
+ */
+void map_set_world(Map *map, const WorldChunk *world) {
+  map_reserve(map, world->count);
+  for (int dx = -WORLD_PAD; dx < CHUNK_SIZE + WORLD_PAD; dx++) {
+    for (int dz = -WORLD_PAD; dz < CHUNK_SIZE + WORLD_PAD; dz++) {
+      const int flag =
+          (dx < 0 || dz < 0 || dx >= CHUNK_SIZE || dz >= CHUNK_SIZE) ? -1 : 1;
+      const int x = world->p * CHUNK_SIZE + dx;
+      const int z = world->q * CHUNK_SIZE + dz;
+      const char *column = world->blocks + WORLD_COLUMN(dx, dz) * world->top;
+      for (int y = 0; y < world->top; y++) {
+        if (column[y]) {
+          map_set(map, x, y, z, column[y] * flag);
+        }
+      }
+    }
+  }
+}
+
+#define XZ_SIZE (CHUNK_SIZE * 3 + 2)
+#define XZ_LO (CHUNK_SIZE)
+#define XZ_HI (CHUNK_SIZE * 2 + 1)
+#define XYZ(x, y, z) ((y) * XZ_SIZE * XZ_SIZE + (x) * XZ_SIZE + (z))
+#define XZ(x, z) ((x) * XZ_SIZE + (z))
+// light reaches 15 blocks and shading looks 8 blocks up
+#define SECTION_MARGIN 16
+
+void light_fill(const char *const opaque, char *light, int y_size, int x,
+                int y, int z, int w, int force) {
+  if (x + w < XZ_LO || z + w < XZ_LO) {
+    return;
+  }
+  if (x - w > XZ_HI || z - w > XZ_HI) {
+    return;
+  }
+  if (y < 0 || y >= y_size) {
+    return;
+  }
+  if (light[XYZ(x, y, z)] >= w) {
+    return;
+  }
+  if (!force && opaque[XYZ(x, y, z)]) {
+    return;
+  }
+  light[XYZ(x, y, z)] = w--;
+  light_fill(opaque, light, y_size, x - 1, y, z, w, 0);
+  light_fill(opaque, light, y_size, x + 1, y, z, w, 0);
+  light_fill(opaque, light, y_size, x, y - 1, z, w, 0);
+  light_fill(opaque, light, y_size, x, y + 1, z, w, 0);
+  light_fill(opaque, light, y_size, x, y, z - 1, w, 0);
+  light_fill(opaque, light, y_size, x, y, z + 1, w, 0);
+}
+
+// the chunk and its ring, which is all that faces are extracted from
+#define CORE_SIZE (CHUNK_SIZE + 2)
+#define CORE(x, z) ((x) * CORE_SIZE + (z))
+#define ROW(y, x) ((y) * CORE_SIZE + (x))
+#define SOLID(x, y, z) ((solid[ROW(y, x)] >> (z)) & 1)
+#if CORE_SIZE > 64
+#error "a row of a chunk and its ring must fit in 64 bits"
+#endif
+
+static int _popcount(uint64_t bits) {
+#ifdef __GNUC__
+  return __builtin_popcountll(bits);
+#else
+  int count = 0;
+  for (; bits; bits &= bits - 1) {
+    count++;
+  }
+  return count;
+#endif
+}
+
+static int _lowest_bit(uint64_t bits) {
+#ifdef __GNUC__
+  return __builtin_ctzll(bits);
+#else
+  int index = 0;
+  for (; !(bits & 1); bits >>= 1) {
+    index++;
+  }
+  return index;
+#endif
+}
+
+/*
+ * The exposed faces of one row of blocks along z, in the order make_cube
+ * takes them: a bit for each block whose neighbour on that side is not
+ * opaque.  Returns the blocks with any face exposed.
+ */
+static uint64_t _row_faces(const uint64_t *solid, const uint64_t *present,
+                           int y, int x, int bottom, uint64_t *faces) {
+  const uint64_t row = present[ROW(y, x)];
+  const uint64_t center = solid[ROW(y, x)];
+  faces[0] = row & ~solid[ROW(y, x - 1)];
+  faces[1] = row & ~solid[ROW(y, x + 1)];
+  faces[2] = row & ~solid[ROW(y + 1, x)];
+  faces[3] = bottom ? 0 : row & ~solid[ROW(y - 1, x)];
+  faces[4] = row & ~(center << 1);
+  faces[5] = row & ~(center >> 1);
+  return faces[0] | faces[1] | faces[2] | faces[3] | faces[4] | faces[5];
+}
+
+// The index of the bit for faces a and b, in the order make_cube takes
+// them, in Section.connected.
+int face_pair(int a, int b) {
+  if (a > b) {
+    const int c = a;
+    a = b;
+    b = c;
+  }
+  return a * (11 - a) / 2 + b - a - 1;
+}
+
+int section_sees(const Section *const section, int a, int b) {
+  return a != b && (section->connected >> face_pair(a, b) & 1);
+}
+
+// The runs of open blocks in a row that have any of `seeds` in them.
+static uint64_t _fill_row(uint64_t seeds, uint64_t open) {
+  uint64_t up = seeds & open;
+  uint64_t down = up;
+  uint64_t up_open = open;
+  uint64_t down_open = open;
+  for (int shift = 1; shift < 64; shift <<= 1) {
+    up |= up_open & (up << shift);
+    up_open &= up_open << shift;
+    down |= down_open & (down >> shift);
+    down_open &= down_open >> shift;
+  }
+  return up | down;
+}
+
+// The blocks that are not opaque in row i of the section from layer y0 of
+// the slice, with rows counted along x and then up.
+static uint64_t _open_row(const uint64_t *solid, int y0, int i) {
+  const uint64_t inner = (((uint64_t)1 << CHUNK_SIZE) - 1) << 1;
+  return inner & ~solid[ROW(y0 + i / CHUNK_SIZE, 1 + i % CHUNK_SIZE)];
+}
+
+/*
+ * Which pairs of its faces the section from layer y0 of the slice
+ * connects through blocks that are not opaque.  Each open region is
+ * flooded a run of a row at a time, noting the faces it reaches.
+ */
+static int _section_connections(const uint64_t *solid, int y0) {
+  const int rows = SECTION_SIZE * CHUNK_SIZE;
+  uint64_t visited[SECTION_SIZE * CHUNK_SIZE] = {0};
+  uint64_t pending[SECTION_SIZE * CHUNK_SIZE] = {0};
+  short stack[SECTION_SIZE * CHUNK_SIZE];  // each row at most once
+  int connected = 0;
+  for (int i = 0; i < rows; i++) {
+    uint64_t left;
+    while ((left = _open_row(solid, y0, i) & ~visited[i])) {
+      // a region not seen yet, from the lowest block left in the row
+      int faces = 0;
+      int top = 0;
+      pending[i] = left & (~left + 1);
+      stack[top++] = i;
+      while (top) {
+        const int j = stack[--top];
+        const int x = j % CHUNK_SIZE;
+        const uint64_t run =
+            _fill_row(pending[j] & ~visited[j], _open_row(solid, y0, j));
+        pending[j] = 0;
+        if (!run) {
+          continue;  // reached another way since
+        }
+        visited[j] |= run;
+        faces |= (x == 0) | (x == CHUNK_SIZE - 1) << 1 |
+                 (j >= rows - CHUNK_SIZE) << 2 | (j < CHUNK_SIZE) << 3 |
+                 (int)(run >> 1 & 1) << 4 | (int)(run >> CHUNK_SIZE & 1) << 5;
+        const int next[4] = {x > 0 ? j - 1 : -1,
+                             x < CHUNK_SIZE - 1 ? j + 1 : -1,
+                             j - CHUNK_SIZE, j + CHUNK_SIZE};
+        for (int k = 0; k < 4; k++) {
+          const int n = next[k];
+          if (n < 0 || n >= rows) {
+            continue;
+          }
+          const uint64_t spread = run & _open_row(solid, y0, n) & ~visited[n];
+          if (spread) {
+            if (!pending[n]) {
+              stack[top++] = n;
+            }
+            pending[n] |= spread;
+          }
+        }
+      }
+      for (int a = 0; a < 6; a++) {
+        for (int b = a + 1; b < 6; b++) {
+          if ((faces >> a & 1) && (faces >> b & 1)) {
+            connected |= 1 << face_pair(a, b);
+          }
+        }
+      }
+    }
+  }
+  return connected;
+}
+
+/*
+ * The occlusion of the corners where blocks a, b, c and d meet, a and d
+ * across from each other, for 64 corners at once in two bit planes: 3
+ * when either diagonal pair is opaque, otherwise how many are.  A cube
+ * face always has an open block in front of it, so this is what its
+ * corner makes of the block across from it and the two beside it.
+ */
+static void _corner_planes(uint64_t a, uint64_t b, uint64_t c, uint64_t d,
+                           uint64_t *planes) {
+  const uint64_t diagonal = (a & d) | (b & c);
+  planes[0] = diagonal | (a ^ b ^ c ^ d);
+  planes[1] = diagonal | ((a | d) & (b | c));
+}
+
+/*
+ * Work out the occlusion of every corner the faces of rows y0 to y1 - 1
+ * can have, once, into scratch->corners: a table for each axis a face
+ * can point along, of where four blocks in one layer across it meet.
+ * Faces along x take the corner at (yv, zv) of layer x from entry
+ * ROW(yv, x), faces along y the corner at (xv, zv) of layer y from
+ * ROW(y, xv), and faces along z the corner at (xv, yv) of layer z from
+ * ROW(yv, xv); the last bit plane index is zv, or z along z.
+ */
+static void _find_corners(Scratch *scratch, int y0, int y1) {
+  const uint64_t *const solid = scratch->solid;
+  const int size = 2 * scratch->layers * CORE_SIZE;
+  uint64_t *const along_x = scratch->corners;
+  uint64_t *const along_y = along_x + size;
+  uint64_t *const along_z = along_y + size;
+  for (int yv = y0; yv <= y1; yv++) {
+    for (int x = 0; x < CORE_SIZE; x++) {
+      const uint64_t below = solid[ROW(yv - 1, x)];
+      const uint64_t above = solid[ROW(yv, x)];
+      _corner_planes(below << 1, below, above << 1, above,
+                     along_x + 2 * ROW(yv, x));
+    }
+    for (int xv = 1; xv < CORE_SIZE; xv++) {
+      _corner_planes(solid[ROW(yv - 1, xv - 1)], solid[ROW(yv, xv - 1)],
+                     solid[ROW(yv - 1, xv)], solid[ROW(yv, xv)],
+                     along_z + 2 * ROW(yv, xv));
+    }
+  }
+  for (int y = y0 - 1; y <= y1; y++) {
+    for (int xv = 1; xv < CORE_SIZE; xv++) {
+      const uint64_t back = solid[ROW(y, xv - 1)];
+      const uint64_t front = solid[ROW(y, xv)];
+      _corner_planes(back << 1, back, front << 1, front,
+                     along_y + 2 * ROW(y, xv));
+    }
+  }
+}
+
+/*
+ * Shade the faces of the block at (x, y, z) of the slice: the occlusion
+ * and light of each corner of the faces in `faces`, or of all of them
+ * for a plant.  Each corner takes the shade and light of the four blocks
+ * that meet at it in the layer in front of the face.  Cube faces look
+ * their occlusion up in scratch->corners; a plant can have an opaque
+ * block in front of a face, so it counts the block across from the
+ * corner and the two beside it itself.
+ */
+static void _shade_block(const Scratch *scratch, int has_light, int x, int y,
+                         int z, int plant, const int *faces,
+                         float ambient_occlusion[6][4], float light[6][4]) {
+  // the axis each face points along, its axes across, and which way
+  static const int axes[6][3] = {{0, 1, 2}, {0, 1, 2}, {1, 0, 2},
+                                 {1, 0, 2}, {2, 0, 1}, {2, 0, 1}};
+  static const int sides[6] = {-1, 1, 1, -1, -1, 1};
+  static const float curve[4] = {0.0, 0.25, 0.5, 0.75};
+  const uint64_t *const solid = scratch->solid;
+  const int size = 2 * scratch->layers * CORE_SIZE;
+  const int block[3] = {x, y, z};
+  const int is_light =
+      has_light && scratch->light[XYZ(x + XZ_LO, y, z + XZ_LO)] == 15;
+  for (int i = 0; i < 6; i++) {
+    if (!plant && !faces[i]) {
+      continue;
+    }
+    const int n = axes[i][0];
+    const int u = axes[i][1];
+    const int v = axes[i][2];
+    const uint64_t *const corners = scratch->corners + n * size;
+    int at[3];
+    at[n] = block[n] + sides[i];
+    for (int j = 0; j < 4; j++) {
+      const int uv = block[u] + (j >> 1);
+      const int vv = block[v] + (j & 1);
+      int value;
+      if (plant) {
+        const int du = (j >> 1) * 2 - 1;
+        const int dv = (j & 1) * 2 - 1;
+        at[u] = block[u] + du;
+        at[v] = block[v] + dv;
+        const int corner = SOLID(at[0], at[1], at[2]);
+        at[v] = block[v];
+        const int side1 = SOLID(at[0], at[1], at[2]);
+        at[u] = block[u];
+        at[v] = block[v] + dv;
+        const int side2 = SOLID(at[0], at[1], at[2]);
+        value = side1 && side2 ? 3 : corner + side1 + side2;
+      } else {
+        const int row = n == 0   ? ROW(uv, at[0])
+                        : n == 1 ? ROW(at[1], uv)
+                                 : ROW(vv, uv);
+        const int lane = n == 2 ? at[2] : vv;
+        value = (corners[2 * row] >> lane & 1) |
+                (corners[2 * row + 1] >> lane & 1) << 1;
+      }
+      float shade_sum = 0, light_sum = 0;
+      for (int k = 0; k < 4; k++) {
+        at[u] = uv - 1 + (k >> 1);
+        at[v] = vv - 1 + (k & 1);
+        shade_sum +=
+            scratch->shade[ROW(at[1], at[0]) * CORE_SIZE + at[2]] * 0.125f;
+        if (has_light) {
+          light_sum +=
+              scratch->light[XYZ(at[0] + XZ_LO, at[1], at[2] + XZ_LO)];
+        }
+      }
+      if (is_light) {
+        light_sum = 15 * 4 * 10;
+      }
+      const float total = curve[value] + shade_sum / 4.0;
+      ambient_occlusion[i][j] = MIN_NUMBER(total, 1.0);
+      light[i][j] = light_sum / 15.0 / 4.0;
+    }
+  }
+}
+
+/*
+ * Write the faces of block ew at (ex, ey, ez), shaded as _shade_block
+ * shades them.  Returns the number of faces written.
+ */
+static int _make_block(float *data, float ambient_occlusion[6][4],
+                       float light[6][4], const int *faces, int ex, int ey,
+                       int ez, int ew) {
+  if (is_plant(ew)) {
+    float min_ambient_occlusion = 1, max_light = 0;
+    for (int a = 0; a < 6; a++) {
+      for (int b = 0; b < 4; b++) {
+        min_ambient_occlusion =
+            MIN_NUMBER(min_ambient_occlusion, ambient_occlusion[a][b]);
+        max_light = MAX_NUMBER(max_light, light[a][b]);
+      }
+    }
+    float rotation = simplex2(ex, ez, 4, 0.5, 2) * 360;
+    make_plant(data, min_ambient_occlusion, max_light, ex, ey, ez, 0.5, ew,
+               rotation);
+    return 4;
+  }
+  make_cube(data, ambient_occlusion, light, faces[0], faces[1], faces[2],
+            faces[3], faces[4], faces[5], ex, ey, ez, 0.5, ew);
+  return faces[0] + faces[1] + faces[2] + faces[3] + faces[4] + faces[5];
+}
+
+/*
+ * Move the `faces` faces in *data to a pool buffer with room for at least
+ * `want` faces, or start one if there is none.  Returns the faces it has
+ * room for.
+ */
+static int _grow_faces(float **data, int faces, int want) {
+  float *const grown = pool_faces(&g->pool, 10, MAX_NUMBER(want, 64));
+  if (*data) {
+    memcpy(grown, *data, sizeof(float) * 60 * faces);
+    pool_release(&g->pool, *data);
+  }
+  *data = grown;
+  return pool_capacity(grown) / (sizeof(float) * 60);
+}
+
+// Make room for `want` faces in scratch->cutout, keeping those in it.
+static void _reserve_cutout(Scratch *scratch, int want) {
+  if (scratch->cutout_room < want) {
+    scratch->cutout_room = MAX_NUMBER(want, scratch->cutout_room * 2);
+    scratch->cutout = (float *)realloc(
+        scratch->cutout, sizeof(float) * 60 * scratch->cutout_room);
+  }
+}
+
+/*
+ * Move the `faces` faces in scratch->cutout to the end of section s's
+ * mesh, after its opaque faces, so they can be drawn in a pass of their
+ * own.
+ */
+static void _append_cutout(WorkerItem *item, Scratch *scratch, int s,
+                           int faces) {
+  Section *const mesh = item->meshes + s;
+  mesh->cutout_faces = faces;
+  if (!faces) {
+    return;
+  }
+  const int total = mesh->faces + faces;
+  if (!item->data[s] ||
+      pool_capacity(item->data[s]) < sizeof(float) * 60 * total) {
+    _grow_faces(item->data + s, mesh->faces, total);
+  }
+  memcpy(item->data[s] + mesh->faces * 60, scratch->cutout,
+         sizeof(float) * 60 * faces);
+  mesh->faces = total;
+}
+
+/*
+ * How many of the w by h by d blocks from core (x, y, z) are set in
+ * `bits`.  Layers outside the slice count as empty.
+ */
+static int _lod_count(const uint64_t *bits, int y_size, int x, int y, int z,
+                      int w, int h, int d) {
+  const uint64_t mask = (((uint64_t)1 << d) - 1) << z;
+  int count = 0;
+  for (int dy = MAX_NUMBER(-y, 0); dy < h && y + dy < y_size; dy++) {
+    for (int dx = 0; dx < w; dx++) {
+      count += _popcount(bits[ROW(y + dy, x + dx)] & mask);
+    }
+  }
+  return count;
+}
+
+// whether a cell of `size` from core (x, y, z) is drawn at all
+static int _lod_filled(const uint64_t *bits, int y_size, int x, int y, int z,
+                       int size) {
+  return _lod_count(bits, y_size, x, y, z, size, size, size) * 2 >=
+         size * size * size;
+}
+
+// whether the ring past a side of the chunk, one block deep, is solid
+static int _lod_solid(const uint64_t *bits, int y_size, int x, int y, int z,
+                      int w, int d, int size) {
+  return _lod_count(bits, y_size, x, y, z, w, size, d) == w * size * d;
+}
+
+/*
+ * The block a cell of `size` from core (x, y, z) is drawn as: its
+ * highest one, so that the ground keeps its grass.
+ */
+static int _lod_block(const uint64_t *bits, const char *blocks, int x, int y,
+                      int z, int size) {
+  const uint64_t mask = (((uint64_t)1 << size) - 1) << z;
+  for (int dy = size - 1; dy >= 0; dy--) {
+    for (int dx = 0; dx < size; dx++) {
+      const uint64_t row = bits[ROW(y + dy, x + dx)] & mask;
+      if (row) {
+        return blocks[ROW(y + dy, x + dx) * CORE_SIZE + _lowest_bit(row)];
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ * Mesh the sections of a distant chunk from cells of 2 or 4 blocks a
+ * side, each filled if at least half of its blocks are.  Cells along the
+ * chunk's sides are tested against the ring, a block deep, and hide their
+ * face only where all of it is filled: the neighbour may be meshed at
+ * another level, and a hole in it would otherwise show a crack.  There is
+ * no ambient occlusion or light at this distance.
+ */
+static void _compute_lod(WorkerItem *item, Scratch *scratch, int sections,
+                         int oy, int y_size) {
+  const uint64_t *const bits = scratch->present;
+  const int size = 1 << item->lod;
+  const int last = CHUNK_SIZE + 1 - size;  // the core x or z of the last cell
+  const float n = size / 2.0f;
+  float ambient_occlusion[6][4] = {{0}};
+  float light[6][4] = {{0}};
+  for (int s = 0; s < CHUNK_SECTIONS; s++) {
+    if (!(sections >> s & 1)) {
+      continue;
+    }
+    Section *const mesh = item->meshes + s;
+    int room = 0;
+    int cutout = 0;
+    for (int y = s * SECTION_SIZE - oy; y < (s + 1) * SECTION_SIZE - oy;
+         y += size) {
+      for (int x = 1; x <= last; x += size) {
+        for (int z = 1; z <= last; z += size) {
+          if (!_lod_filled(bits, y_size, x, y, z, size)) {
+            continue;
+          }
+          // the cells around it, or a block of the ring past the chunk
+          const int f1 =
+              x == 1 ? !_lod_solid(bits, y_size, 0, y, z, 1, size, size)
+                     : !_lod_filled(bits, y_size, x - size, y, z, size);
+          const int f2 =
+              x == last
+                  ? !_lod_solid(bits, y_size, x + size, y, z, 1, size, size)
+                  : !_lod_filled(bits, y_size, x + size, y, z, size);
+          const int f3 = !_lod_filled(bits, y_size, x, y + size, z, size);
+          const int f4 =
+              y + oy > 0 && !_lod_filled(bits, y_size, x, y - size, z, size);
+          const int f5 =
+              z == 1 ? !_lod_solid(bits, y_size, x, y, 0, size, 1, size)
+                     : !_lod_filled(bits, y_size, x, y, z - size, size);
+          const int f6 =
+              z == last
+                  ? !_lod_solid(bits, y_size, x, y, z + size, size, 1, size)
+                  : !_lod_filled(bits, y_size, x, y, z + size, size);
+          const int faces = f1 + f2 + f3 + f4 + f5 + f6;
+          if (!faces) {
+            continue;
+          }
+          const int w = _lod_block(bits, scratch->blocks, x, y, z, size);
+          float *data;
+          if (is_transparent(w)) {
+            _reserve_cutout(scratch, cutout + 6);
+            data = scratch->cutout + cutout * 60;
+            cutout += faces;
+          } else {
+            if (room < mesh->faces + 6) {
+              room = _grow_faces(
+                  item->data + s, mesh->faces,
+                  MAX_NUMBER(scratch->faces[s], mesh->faces * 2));
+            }
+            data = item->data[s] + mesh->faces * 60;
+            mesh->faces += faces;
+          }
+          make_cube(data, ambient_occlusion, light, f1, f2, f3, f4, f5, f6,
+                    item->p * CHUNK_SIZE + x - 1 + n - 0.5f, y + oy + n - 0.5f,
+                    item->q * CHUNK_SIZE + z - 1 + n - 0.5f, n, w);
+          mesh->miny = MIN_NUMBER(mesh->miny, y + oy);
+          mesh->maxy = MAX_NUMBER(mesh->maxy, y + oy + size - 1);
+        }
+      }
+    }
+    _append_cutout(item, scratch, s, cutout);
+    scratch->faces[s] = mesh->faces;
+  }
+}
+
+/*
+ * Make room for `layers` y layers in the scratch arrays, and clear what
+ * the last chunk left in them.
+ */
+void _scratch_reserve(Scratch *scratch, int layers) {
+  const int layer = XZ_SIZE * XZ_SIZE;
+  const int rows = CORE_SIZE * layers;
+  if (scratch->layers < layers) {
+    free(scratch->opaque);
+    free(scratch->light);
+    free(scratch->solid);
+    free(scratch->present);
+    free(scratch->blocks);
+    free(scratch->shade);
+    free(scratch->corners);
+    scratch->opaque = (char *)calloc(layer * layers, sizeof(char));
+    scratch->light = (char *)calloc(layer * layers, sizeof(char));
+    scratch->solid = (uint64_t *)malloc(rows * sizeof(uint64_t));
+    scratch->present = (uint64_t *)malloc(rows * sizeof(uint64_t));
+    scratch->blocks = (char *)malloc(rows * CORE_SIZE);
+    scratch->shade = (char *)malloc(rows * CORE_SIZE);
+    scratch->corners = (uint64_t *)malloc(rows * 6 * sizeof(uint64_t));
+    scratch->layers = layers;
+  } else {
+    const int x0 = scratch->opaque_x0;
+    const int count = scratch->opaque_x1 - x0 + 1;
+    for (int y = 0; y < scratch->opaque_layers; y++) {
+      memset(scratch->opaque + y * layer + x0 * XZ_SIZE, 0, count * XZ_SIZE);
+    }
+    memset(scratch->light, 0, layer * scratch->light_layers);
+  }
+  if (!scratch->highest) {
+    scratch->highest = (short *)malloc(CORE_SIZE * CORE_SIZE * sizeof(short));
+  }
+  memset(scratch->solid, 0, rows * sizeof(uint64_t));
+  memset(scratch->present, 0, rows * sizeof(uint64_t));
+  memset(scratch->highest, 0, CORE_SIZE * CORE_SIZE * sizeof(short));
+  scratch->opaque_layers = 0;
+  scratch->opaque_x0 = XZ_SIZE;
+  scratch->opaque_x1 = -1;
+  scratch->light_layers = 0;
+}
+
+/*
+ * Mesh the sections of a chunk in item->sections.  Only the slice of the
+ * column those sections span, plus SECTION_MARGIN above and below, is
+ * loaded.  Opacity is kept as a bit per block in rows along z, so the
+ * exposed faces of a row come out of a few shifts and masks; the opaque
+ * and light arrays, a byte per block and three chunks wide, are only
+ * filled in when there are lights to spread.
+ */
+void compute_chunk(WorkerItem *item, Scratch *scratch) {
+  const Map *const map = item->block_maps[1][1];
+
+  // empty and full sections
+  int block_count[CHUNK_SECTIONS] = {0};
+  int solid_count[CHUNK_SECTIONS] = {0};
+  for (unsigned int i = 0; i <= map->mask; i++) {
+    const MapEntry *const entry = map->data + i;
+    const int ey = entry->e.y + map->dy;
+    const int ew = entry->e.w;
+    if (EMPTY_ENTRY(entry) || ew <= 0 || ey < 0 || ey > 255) {
+      continue;
+    }
+    block_count[ey / SECTION_SIZE]++;
+    solid_count[ey / SECTION_SIZE] += !is_transparent(ew);
+  }
+  int sections = 0;
+  for (int s = 0; s < CHUNK_SECTIONS; s++) {
+    Section *const mesh = item->meshes + s;
+    mesh->faces = 0;
+    mesh->cutout_faces = 0;
+    mesh->miny = 256;
+    mesh->maxy = 0;
+    mesh->empty = block_count[s] == 0;
+    mesh->full = solid_count[s] == CHUNK_SIZE * CHUNK_SIZE * SECTION_SIZE;
+    mesh->solid_layers = mesh->full ? SECTION_SIZE : 0;
+    mesh->connected = mesh->empty ? ALL_CONNECTED : 0;
+    item->data[s] = NULL;
+    if ((item->sections >> s & 1) && !mesh->empty) {
+      sections |= 1 << s;
+    }
+  }
+  if (!sections) {
+    return;
+  }
+  int lo = CHUNK_SECTIONS;
+  int hi = 0;
+  for (int s = 0; s < CHUNK_SECTIONS; s++) {
+    if (sections >> s & 1) {
+      lo = MIN_NUMBER(lo, s);
+      hi = s;
+    }
+  }
+  const int oy = MAX_NUMBER(lo * SECTION_SIZE - SECTION_MARGIN, -1);
+  const int y_size =
+      MIN_NUMBER((hi + 1) * SECTION_SIZE + SECTION_MARGIN, 256) - oy + 1;
+
+  _scratch_reserve(scratch, y_size);
+  char *const opaque = scratch->opaque;
+  char *const light = scratch->light;
+  uint64_t *const solid = scratch->solid;
+  uint64_t *const present = scratch->present;
+  char *const blocks = scratch->blocks;
+  char *const shade = scratch->shade;
+  short *const highest = scratch->highest;
+
+  const int ox = item->p * CHUNK_SIZE - CHUNK_SIZE - 1;
+  const int oz = item->q * CHUNK_SIZE - CHUNK_SIZE - 1;
+
+  // check for lights
+  int has_light = 0;
+  if (SHOW_LIGHTS) {
+    for (int a = 0; a < 3; a++) {
+      for (int b = 0; b < 3; b++) {
+        Map *map = item->light_maps[a][b];
+        if (map && map->size) {
+          has_light = 1;
+        }
+      }
+    }
+  }
+
+  // populate the bitsets from the chunk's own map, which holds the ring
+  // of neighbouring blocks as well
+  for (unsigned int i = 0; i <= map->mask; i++) {
+    const MapEntry *const entry = map->data + i;
+    if (EMPTY_ENTRY(entry)) {
+      continue;
+    }
+    const int ey = entry->e.y + map->dy;
+    const int ew = entry->e.w;
+    const int x = entry->e.x + map->dx - ox - XZ_LO;
+    const int y = ey - oy;
+    const int z = entry->e.z + map->dz - oz - XZ_LO;
+    if (x < 0 || y < 0 || z < 0 || x >= CORE_SIZE || z >= CORE_SIZE) {
+      continue;
+    }
+    if (y >= y_size) {
+      // above the slice, but it still decides whether to shade
+      if (!is_transparent(ew)) {
+        highest[CORE(x, z)] = y_size - 1;
+      }
+      continue;
+    }
+    const uint64_t bit = (uint64_t)1 << z;
+    if (!is_transparent(ew)) {
+      solid[ROW(y, x)] |= bit;
+      highest[CORE(x, z)] = MAX_NUMBER(highest[CORE(x, z)], y);
+    }
+    if (item->lod) {
+      // every block but plants fills its cell, in the ring too
+      if (ew && !is_plant(ABS(ew))) {
+        present[ROW(y, x)] |= bit;
+        blocks[ROW(y, x) * CORE_SIZE + z] = ABS(ew);
+      }
+      continue;
+    }
+    if (ew > 0 && ey <= 255 && (sections >> ey / SECTION_SIZE & 1)) {
+      present[ROW(y, x)] |= bit;
+      blocks[ROW(y, x) * CORE_SIZE + z] = ew;
+    }
+  }
+
+  // what can be seen through each section, and what it hides
+  const uint64_t inner = (((uint64_t)1 << CHUNK_SIZE) - 1) << 1;
+  for (int s = 0; s < CHUNK_SECTIONS; s++) {
+    Section *const mesh = item->meshes + s;
+    if (!(sections >> s & 1) || mesh->full) {
+      continue;
+    }
+    const int y0 = s * SECTION_SIZE - oy;
+    mesh->connected = _section_connections(solid, y0);
+    for (int y = y0; y < y0 + SECTION_SIZE; y++) {
+      int x = 1;
+      while (x <= CHUNK_SIZE && (solid[ROW(y, x)] & inner) == inner) {
+        x++;
+      }
+      if (x <= CHUNK_SIZE) {
+        break;
+      }
+      mesh->solid_layers++;
+    }
+  }
+
+  if (item->lod) {
+    _compute_lod(item, scratch, sections, oy, y_size);
+    return;
+  }
+
+  // sky shade: the nearest opaque block at most 7 above, swept down each
+  // column once rather than looked up again for every face that sees it
+  const int y0 = lo * SECTION_SIZE - oy;
+  const int y1 = (hi + 1) * SECTION_SIZE - oy;
+  for (int x = 0; x < CORE_SIZE; x++) {
+    for (int z = 0; z < CORE_SIZE; z++) {
+      const int top = highest[CORE(x, z)];
+      for (int y = y1; y > top; y--) {
+        shade[ROW(y, x) * CORE_SIZE + z] = 0;
+      }
+      int distance = 8;
+      for (int y = top; y >= y0 - 1; y--) {
+        distance = SOLID(x, y, z) ? 0 : MIN_NUMBER(distance + 1, 8);
+        if (y <= y1) {
+          shade[ROW(y, x) * CORE_SIZE + z] = 8 - distance;
+        }
+      }
+    }
+  }
+
+  // flood fill light intensities
+  if (has_light) {
+    scratch->light_layers = y_size;
+    for (int a = 0; a < 3; a++) {
+      for (int b = 0; b < 3; b++) {
+        const Map *const map = item->block_maps[a][b];
+        if (!map) {
+          continue;
+        }
+        for (unsigned int i = 0; i <= map->mask; i++) {
+          const MapEntry *const entry = map->data + i;
+          if (EMPTY_ENTRY(entry)) {
+            continue;
+          }
+          const int x = entry->e.x + map->dx - ox;
+          const int y = entry->e.y + map->dy - oy;
+          const int z = entry->e.z + map->dz - oz;
+          if (x < 0 || y < 0 || z < 0 || x >= XZ_SIZE || y >= y_size ||
+              z >= XZ_SIZE || is_transparent(entry->e.w)) {
+            continue;
+          }
+          opaque[XYZ(x, y, z)] = 1;
+          scratch->opaque_layers = MAX_NUMBER(scratch->opaque_layers, y + 1);
+          scratch->opaque_x0 = MIN_NUMBER(scratch->opaque_x0, x);
+          scratch->opaque_x1 = MAX_NUMBER(scratch->opaque_x1, x);
+        }
+      }
+    }
+    for (int a = 0; a < 3; a++) {
+      for (int b = 0; b < 3; b++) {
+        const Map *const map = item->light_maps[a][b];
+        if (!map) {
+          continue;
+        }
+        for (unsigned int i = 0; i <= map->mask; i++) {
+          const MapEntry *const entry = map->data + i;
+          if (EMPTY_ENTRY(entry)) {
+            continue;
+          }
+          const int ex = entry->e.x + map->dx;
+          const int ey = entry->e.y + map->dy;
+          const int ez = entry->e.z + map->dz;
+          const int ew = entry->e.w;
+          const int x = ex - ox;
+          const int y = ey - oy;
+          const int z = ez - oz;
+          light_fill(opaque, light, y_size, x, y, z, ew, 1);
+        }
+      }
+    }
+  }
+
+  _find_corners(scratch, y0, y1);
+
+  // generate geometry, a row at a time, growing each section's buffer as
+  // it fills; cutout faces are gathered apart and go after the rest
+  int room[CHUNK_SECTIONS] = {0};
+  int cutout = 0;
+  for (int y = y0; y < y1; y++) {
+    const int s = (y + oy) / SECTION_SIZE;
+    Section *const mesh = item->meshes + s;
+    float *data = item->data[s];
+    int count = mesh->faces;
+    for (int x = 1; x <= CHUNK_SIZE; x++) {
+      if (!present[ROW(y, x)]) {
+        continue;
+      }
+      uint64_t faces[6];
+      uint64_t exposed = _row_faces(solid, present, y, x, y + oy == 0, faces);
+      if (!exposed) {
+        continue;
+      }
+      mesh->miny = MIN_NUMBER(mesh->miny, y + oy);
+      mesh->maxy = MAX_NUMBER(mesh->maxy, y + oy);
+      // at most six faces a block
+      const uint64_t holes = exposed & ~solid[ROW(y, x)];
+      const int most = count + 6 * _popcount(exposed & ~holes);
+      _reserve_cutout(scratch, cutout + 6 * _popcount(holes));
+      if (room[s] < most) {
+        room[s] = _grow_faces(item->data + s, count,
+                              MAX_NUMBER(scratch->faces[s], most * 2));
+        data = item->data[s];
+      }
+      for (; exposed; exposed &= exposed - 1) {
+        const int z = _lowest_bit(exposed);
+        const int ex = x + XZ_LO + ox;
+        const int ey = y + oy;
+        const int ez = z + XZ_LO + oz;
+        const int ew = blocks[ROW(y, x) * CORE_SIZE + z];
+        int face[6];
+        for (int i = 0; i < 6; i++) {
+          face[i] = faces[i] >> z & 1;
+        }
+        float ambient_occlusion[6][4];
+        float shading[6][4];
+        _shade_block(scratch, has_light, x, y, z, is_plant(ew), face,
+                     ambient_occlusion, shading);
+        if (holes >> z & 1) {
+          cutout += _make_block(scratch->cutout + cutout * 60,
+                                ambient_occlusion, shading, face, ex, ey, ez,
+                                ew);
+        } else {
+          count += _make_block(data + count * 60, ambient_occlusion, shading,
+                               face, ex, ey, ez, ew);
+        }
+      }
+    }
+    mesh->faces = count;
+    if (y + 1 == y1 || (y + 1 + oy) % SECTION_SIZE == 0) {
+      _append_cutout(item, scratch, s, cutout);
+      cutout = 0;
+    }
+  }
+
+  // hand the buffers over as they are, and start the next mesh of each
+  // section at the size this one came to
+  for (int s = 0; s < CHUNK_SECTIONS; s++) {
+    if (sections >> s & 1) {
+      scratch->faces[s] = item->meshes[s].faces;
+    }
+  }
+}
@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * craft-meshbench: meshes a fixed set of chunks with compute_chunk, in
+ * full detail, next to lights and at each coarser level, hashes each
+ * mesh's faces in sorted order and compares the hashes with the golden
+ * ones below.  It then times compute_chunk.  A mismatch means a change
+ * to the mesher draws something different, not just faster or in
+ * another order; when that is intended, paste the output of -g here.
+ */
+
+#include "config.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "tinycthread.h"
+
+#include "sign.h"
+
+#include "map.h"
+
+#include "main.h"
+
+#include "mesh.h"
+#include "world.h"
+
+#define DEFAULT_ROUNDS 20
+#define FACE_FLOATS 60
+#define CORPUS_SIZE (sizeof(corpus) / sizeof(corpus[0]))
+
+// what compute_chunk takes its vertex buffers from
+static Model model;
+Model *g = &model;
+
+typedef struct {
+  int p;
+  int q;
+  int lod;
+  int lit;  // with a light in the chunk and one across its side
+  uint64_t golden;
+} Case;
+
+// ground around the origin and far out, lit next to its sides, and the
+// same chunks at each coarser level
+static const Case corpus[] = {
+    {0, 0, 0, 0, 0xd2bb8b31ea210bcdULL},
+    {2, -1, 0, 0, 0x043fecb8c334b9eaULL},
+    {-5, 2, 0, 0, 0x6e0cb1709d830d5bULL},
+    {2, -1, 0, 1, 0x2abc51ad4dfbe9b8ULL},
+    {-5, 2, 0, 1, 0xa6999fc5007ac442ULL},
+    {7, 7, 0, 1, 0xba06416fa0a30964ULL},
+    {7, 7, 1, 0, 0x1739edf29b8c2f29ULL},
+    {0, 3, 1, 0, 0xa3246021f9c7f693ULL},
+    {7, 7, 2, 0, 0xf6a4693d587cd35dULL},
+    {0, 3, 2, 0, 0x2f347192b3493849ULL},
+    {-250, 40, 0, 0, 0x77ea2ff600896e80ULL},
+    {-250, 40, 2, 0, 0x8778a6403f20ce91ULL},
+};
+
+typedef struct {
+  Map blocks[3][3];
+  Map lights[3][3];
+} Neighborhood;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// one above the highest block of column (x, z), as a player would place it
+static int _above(const Map *map, int x, int z) {
+  for (int y = 255; y > 0; y--) {
+    if (map_get(map, x, y, z)) {
+      return y + 1;
+    }
+  }
+  return 1;
+}
+
+// the chunk and its neighbours as the client loads them, without a db
+static void _load(Neighborhood *hood, const Case *c) {
+  WorldChunk world = {0};
+  for (int dp = 0; dp < 3; dp++) {
+    for (int dq = 0; dq < 3; dq++) {
+      const int p = c->p + dp - 1;
+      const int q = c->q + dq - 1;
+      const int x = p * CHUNK_SIZE - 1;
+      const int z = q * CHUNK_SIZE - 1;
+      map_alloc(&hood->blocks[dp][dq], x, 0, z, 0x7fff);
+      map_alloc(&hood->lights[dp][dq], x, 0, z, 0xf);
+      world_generate(NULL, NULL, p, q, &world);
+      map_set_world(&hood->blocks[dp][dq], &world);
+    }
+  }
+  world_chunk_free(&world);
+  if (c->lit) {
+    const int x = c->p * CHUNK_SIZE + 6;
+    const int z = c->q * CHUNK_SIZE + 6;
+    const int y = _above(&hood->blocks[1][1], x, z);
+    map_set(&hood->lights[1][1], x, y, z, 15);
+    // two blocks into the next chunk along x, in reach of this one
+    const int nx = (c->p + 1) * CHUNK_SIZE + 2;
+    const int nz = c->q * CHUNK_SIZE + 20;
+    const int ny = _above(&hood->blocks[2][1], nx, nz);
+    map_set(&hood->lights[2][1], nx, ny, nz, 15);
+  }
+}
+
+static void _free(Neighborhood *hood) {
+  for (int dp = 0; dp < 3; dp++) {
+    for (int dq = 0; dq < 3; dq++) {
+      map_free(&hood->blocks[dp][dq]);
+      map_free(&hood->lights[dp][dq]);
+    }
+  }
+}
+
+static void _mesh(WorkerItem *item, Neighborhood *hood, const Case *c,
+                  Scratch *scratch) {
+  memset(item, 0, sizeof(WorkerItem));
+  item->p = c->p;
+  item->q = c->q;
+  item->sections = ALL_SECTIONS;
+  item->lod = c->lod;
+  for (int dp = 0; dp < 3; dp++) {
+    for (int dq = 0; dq < 3; dq++) {
+      item->block_maps[dp][dq] = &hood->blocks[dp][dq];
+      item->light_maps[dp][dq] = &hood->lights[dp][dq];
+    }
+  }
+  compute_chunk(item, scratch);
+}
+
+static void _release(WorkerItem *item) {
+  for (int s = 0; s < CHUNK_SECTIONS; s++) {
+    pool_release(&g->pool, item->data[s]);
+  }
+}
+
+static int _compare_faces(const void *a, const void *b) {
+  return memcmp(a, b, sizeof(int32_t) * FACE_FLOATS);
+}
+
+// FNV-1a over the faces of every section, sorted so that the order the
+// mesher emits them in does not matter, and rounded to 1/256 so that
+// neither does how the compiler contracts the arithmetic
+static uint64_t _hash_mesh(const WorkerItem *item) {
+  int count = 0;
+  for (int s = 0; s < CHUNK_SECTIONS; s++) {
+    count += item->meshes[s].faces;
+  }
+  int32_t *faces = malloc(sizeof(int32_t) * FACE_FLOATS * (count + 1));
+  int32_t *face = faces;
+  for (int s = 0; s < CHUNK_SECTIONS; s++) {
+    const int n = item->meshes[s].faces * FACE_FLOATS;
+    for (int i = 0; i < n; i++) {
+      *face++ = (int32_t)lrintf(item->data[s][i] * 256);
+    }
+  }
+  qsort(faces, count, sizeof(int32_t) * FACE_FLOATS, _compare_faces);
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  const unsigned char *bytes = (const unsigned char *)faces;
+  for (size_t i = 0; i < sizeof(int32_t) * FACE_FLOATS * count; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  }
+  free(faces);
+  return hash;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-g] [-v] [-n ROUNDS]\n", name);
+}
+
+int main(int argc, char **argv) {
+  int golden = 0;
+  int verbose = 0;
+  int rounds = DEFAULT_ROUNDS;
+  int option;
+  while ((option = getopt(argc, argv, "gvn:h")) != -1) {
+    switch (option) {
+      case 'g':
+        golden = 1;
+        break;
+      case 'v':
+        verbose = 1;
+        break;
+      case 'n':
+        rounds = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (argc != optind || rounds < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  pool_alloc(&g->pool);
+  static Scratch scratch;
+  static WorkerItem item;
+  static Neighborhood hood;
+  int failures = 0;
+  double elapsed[MAX_LOD + 1] = {0};
+  int meshed[MAX_LOD + 1] = {0};
+  for (size_t i = 0; i < CORPUS_SIZE; i++) {
+    const Case *c = corpus + i;
+    _load(&hood, c);
+    _mesh(&item, &hood, c, &scratch);
+    int faces = 0;
+    for (int s = 0; s < CHUNK_SECTIONS; s++) {
+      faces += item.meshes[s].faces;
+    }
+    const uint64_t hash = _hash_mesh(&item);
+    _release(&item);
+    if (golden) {
+      printf("    {%d, %d, %d, %d, 0x%016llxULL},\n", c->p, c->q, c->lod,
+             c->lit, (unsigned long long)hash);
+    } else if (hash != c->golden || verbose) {
+      printf("%-4s %5d %5d lod %d%s, %d faces, %016llx\n",
+             hash == c->golden ? "ok" : "FAIL", c->p, c->q, c->lod,
+             c->lit ? " lit" : "", faces, (unsigned long long)hash);
+    }
+    failures += !golden && hash != c->golden;
+    for (int round = 0; round < rounds; round++) {
+      const double t0 = now();
+      _mesh(&item, &hood, c, &scratch);
+      elapsed[c->lod] += now() - t0;
+      meshed[c->lod]++;
+      _release(&item);
+    }
+    _free(&hood);
+  }
+  if (!golden && rounds) {
+    printf("compute_chunk:");
+    for (int lod = 0; lod <= MAX_LOD; lod++) {
+      printf("%s lod %d %.3f ms", lod ? "," : "", lod,
+             meshed[lod] ? elapsed[lod] * 1000 / meshed[lod] : 0.0);
+    }
+    printf("\n");
+  }
+  pool_free(&g->pool);
+  fflush(stdout);
+  if (failures) {
+    fprintf(stderr, "%d of %d meshes do not match\n", failures,
+            (int)CORPUS_SIZE);
+  } else if (!golden) {
+    printf("ok   %d meshes\n", (int)CORPUS_SIZE);
+  }
+  return failures != 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "occlusion.h"
+#include <math.h>
+#include <string.h>
+
+// nearer than this to the eye, a corner cannot be projected
+#define NEAR_W 0.01f
+#define FAR_DEPTH 2.0f
+
+// the corners of each face of a box, in order around it, with corner i
+// at x1 if i & 1, y1 if i & 2 and z1 if i & 4
+static const int faces[6][4] = {{0, 2, 6, 4}, {1, 3, 7, 5}, {0, 1, 5, 4},
+                                {2, 3, 7, 6}, {0, 1, 3, 2}, {4, 5, 7, 6}};
+
+void occlusion_clear(Occlusion *occlusion, const float *matrix) {
+  memcpy(occlusion->matrix, matrix, sizeof(occlusion->matrix));
+  for (int j = 0; j < OCCLUSION_HEIGHT; j++) {
+    for (int i = 0; i < OCCLUSION_WIDTH; i++) {
+      occlusion->depth[j][i] = FAR_DEPTH;
+    }
+  }
+}
+
+/*
+ * Project the corners of a box into buffer cells, with depth as
+ * normalized device z.  Returns 0 if any corner is behind the eye.
+ */
+static int _project(const float *m, float x0, float y0, float z0, float x1,
+                    float y1, float z1, float points[8][3]) {
+  for (int i = 0; i < 8; i++) {
+    const float x = i & 1 ? x1 : x0;
+    const float y = i & 2 ? y1 : y0;
+    const float z = i & 4 ? z1 : z0;
+    const float w = m[3] * x + m[7] * y + m[11] * z + m[15];
+    if (w < NEAR_W) {
+      return 0;
+    }
+    points[i][0] = (m[0] * x + m[4] * y + m[8] * z + m[12]) / w;
+    points[i][1] = (m[1] * x + m[5] * y + m[9] * z + m[13]) / w;
+    points[i][2] = (m[2] * x + m[6] * y + m[10] * z + m[14]) / w;
+    points[i][0] = (points[i][0] * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+    points[i][1] = (points[i][1] * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+  }
+  return 1;
+}
+
+// Whether (x, y) is inside the convex quad, in either winding.
+static int _inside(const float quad[4][2], float sign, float x, float y) {
+  for (int i = 0; i < 4; i++) {
+    const float *a = quad[i];
+    const float *b = quad[(i + 1) % 4];
+    const float cross = (b[0] - a[0]) * (y - a[1]) - (b[1] - a[1]) * (x - a[0]);
+    if (cross * sign < 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Mark the cells each face of the box covers completely, as far away as
+ * the farthest corner of that face.
+ */
+void occlusion_add_box(Occlusion *occlusion, float x0, float y0, float z0,
+                       float x1, float y1, float z1) {
+  float points[8][3];
+  if (!_project(occlusion->matrix, x0, y0, z0, x1, y1, z1, points)) {
+    return;
+  }
+  for (int f = 0; f < 6; f++) {
+    float quad[4][2];
+    float depth = -FAR_DEPTH;
+    float lo[2] = {OCCLUSION_WIDTH, OCCLUSION_HEIGHT};
+    float hi[2] = {0, 0};
+    for (int k = 0; k < 4; k++) {
+      const float *point = points[faces[f][k]];
+      quad[k][0] = point[0];
+      quad[k][1] = point[1];
+      depth = fmaxf(depth, point[2]);
+      for (int d = 0; d < 2; d++) {
+        lo[d] = fminf(lo[d], point[d]);
+        hi[d] = fmaxf(hi[d], point[d]);
+      }
+    }
+    const float area = (quad[2][0] - quad[0][0]) * (quad[3][1] - quad[1][1]) -
+                       (quad[3][0] - quad[1][0]) * (quad[2][1] - quad[0][1]);
+    if (fabsf(area) < 1.0f) {
+      continue;  // edge on, or smaller than a cell
+    }
+    const float sign = area > 0 ? 1 : -1;
+    const int i0 = fmaxf(ceilf(lo[0]), 0);
+    const int j0 = fmaxf(ceilf(lo[1]), 0);
+    const int i1 = fminf(floorf(hi[0]), OCCLUSION_WIDTH);
+    const int j1 = fminf(floorf(hi[1]), OCCLUSION_HEIGHT);
+    for (int j = j0; j < j1; j++) {
+      for (int i = i0; i < i1; i++) {
+        if (occlusion->depth[j][i] > depth &&
+            _inside(quad, sign, i, j) && _inside(quad, sign, i + 1, j) &&
+            _inside(quad, sign, i, j + 1) &&
+            _inside(quad, sign, i + 1, j + 1)) {
+          occlusion->depth[j][i] = depth;
+        }
+      }
+    }
+  }
+}
+
+/*
+ * Whether every cell the box could touch already has an occluder nearer
+ * than the nearest corner of the box.
+ */
+int occlusion_hidden(const Occlusion *occlusion, float x0, float y0, float z0,
+                     float x1, float y1, float z1) {
+  float points[8][3];
+  if (!_project(occlusion->matrix, x0, y0, z0, x1, y1, z1, points)) {
+    return 0;
+  }
+  float depth = FAR_DEPTH;
+  float lo[2] = {OCCLUSION_WIDTH, OCCLUSION_HEIGHT};
+  float hi[2] = {0, 0};
+  for (int k = 0; k < 8; k++) {
+    depth = fminf(depth, points[k][2]);
+    for (int d = 0; d < 2; d++) {
+      lo[d] = fminf(lo[d], points[k][d]);
+      hi[d] = fmaxf(hi[d], points[k][d]);
+    }
+  }
+  if (hi[0] <= 0 || hi[1] <= 0 || lo[0] >= OCCLUSION_WIDTH ||
+      lo[1] >= OCCLUSION_HEIGHT) {
+    return 0;  // off screen, which is for the frustum test to decide
+  }
+  const int i0 = fmaxf(floorf(lo[0]), 0);
+  const int j0 = fmaxf(floorf(lo[1]), 0);
+  const int i1 = fminf(ceilf(hi[0]), OCCLUSION_WIDTH);
+  const int j1 = fminf(ceilf(hi[1]), OCCLUSION_HEIGHT);
+  for (int j = j0; j < j1; j++) {
+    for (int i = i0; i < i1; i++) {
+      if (occlusion->depth[j][i] >= depth) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
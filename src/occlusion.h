@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _occlusion_h_
+#define _occlusion_h_
+
+#define OCCLUSION_WIDTH 64
+#define OCCLUSION_HEIGHT 32
+
+/*
+ * A coarse software depth buffer of the occluders drawn so far, to skip
+ * boxes that are wholly behind them.  An occluder only marks the cells of
+ * the buffer it covers completely, at its farthest depth, so a box is
+ * never skipped while any part of it could still show.
+ */
+typedef struct {
+  float matrix[16];
+  float depth[OCCLUSION_HEIGHT][OCCLUSION_WIDTH];
+} Occlusion;
+
+void occlusion_clear(Occlusion *occlusion, const float *matrix);
+void occlusion_add_box(Occlusion *occlusion, float x0, float y0, float z0,
+                       float x1, float y1, float z1);
+int occlusion_hidden(const Occlusion *occlusion, float x0, float y0, float z0,
+                     float x1, float y1, float z1);
+
+#endif
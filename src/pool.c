@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pool.h"
+#include <stdlib.h>
+
+// ahead of the data, keeping it 16 byte aligned
+#define HEADER_SIZE 16
+
+typedef struct {
+  int size_class;
+  size_t capacity;
+} Header;
+
+void pool_alloc(Pool *pool) {
+  mtx_init(&pool->mtx, mtx_plain);
+  for (int i = 0; i < POOL_CLASSES; i++) {
+    pool->count[i] = 0;
+  }
+}
+
+void pool_free(Pool *pool) {
+  for (int i = 0; i < POOL_CLASSES; i++) {
+    for (int j = 0; j < pool->count[i]; j++) {
+      free(pool->free[i][j]);
+    }
+    pool->count[i] = 0;
+  }
+  mtx_destroy(&pool->mtx);
+}
+
+/*
+ * Room for `faces` faces of `components` floats per vertex, like
+ * malloc_faces.  Give it back with pool_release, not free.
+ */
+float *pool_faces(Pool *pool, int components, int faces) {
+  const size_t size = sizeof(float) * 6 * components * faces;
+  int size_class = 0;
+  size_t capacity = (size_t)1 << POOL_MIN_SHIFT;
+  while (size_class < POOL_CLASSES && capacity < size) {
+    size_class++;
+    capacity <<= 1;
+  }
+  char *buffer = NULL;
+  if (size_class < POOL_CLASSES) {
+    mtx_lock(&pool->mtx);
+    if (pool->count[size_class]) {
+      buffer = pool->free[size_class][--pool->count[size_class]];
+    }
+    mtx_unlock(&pool->mtx);
+  } else {
+    capacity = size;
+  }
+  if (!buffer) {
+    buffer = malloc(HEADER_SIZE + capacity);
+  }
+  Header *const header = (Header *)buffer;
+  header->size_class = size_class;
+  header->capacity = capacity;
+  return (float *)(buffer + HEADER_SIZE);
+}
+
+// The bytes a buffer from pool_faces has room for, at least what was asked.
+size_t pool_capacity(const float *data) {
+  return ((const Header *)((const char *)data - HEADER_SIZE))->capacity;
+}
+
+void pool_release(Pool *pool, float *data) {
+  if (!data) {
+    return;
+  }
+  char *const buffer = (char *)data - HEADER_SIZE;
+  const int size_class = ((Header *)buffer)->size_class;
+  if (size_class < POOL_CLASSES) {
+    mtx_lock(&pool->mtx);
+    if (pool->count[size_class] < POOL_KEEP) {
+      pool->free[size_class][pool->count[size_class]++] = buffer;
+      mtx_unlock(&pool->mtx);
+      return;
+    }
+    mtx_unlock(&pool->mtx);
+  }
+  free(buffer);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _pool_h_
+#define _pool_h_
+
+#include "tinycthread.h"
+#include <stddef.h>
+
+#define POOL_MIN_SHIFT 12  // the smallest buffer, 4 KB
+#define POOL_CLASSES 13    // up to 16 MB, anything larger is not kept
+#define POOL_KEEP 8        // free buffers kept per size class
+
+/*
+ * A Pool keeps freed vertex buffers by power of two size so that meshing
+ * a chunk reuses the memory of the last mesh instead of going back to
+ * malloc.  Buffers can be taken and given back from any thread.
+ */
+typedef struct {
+  mtx_t mtx;
+  int count[POOL_CLASSES];
+  void *free[POOL_CLASSES][POOL_KEEP];
+} Pool;
+
+void pool_alloc(Pool *pool);
+void pool_free(Pool *pool);
+float *pool_faces(Pool *pool, int components, int faces);
+size_t pool_capacity(const float *data);
+void pool_release(Pool *pool, float *data);
+
+#endif
@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * craft-pregen: generates a rectangle of chunks on every core and stores
+ * them in the terrain table of a world database, so that craft-server and
+ * the client load them instead of generating them.  Chunks go in row
+ * order, one transaction per batch; chunks already stored are skipped, so
+ * an interrupted run picks up where it stopped.
+ */
+
+#include "config.h"
+#include "generator.h"
+#include "sqlite3.h"
+#include "terrain.h"
+#include "tinycthread.h"
+#include "world.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_DB_PATH "craft.db"
+#define DEFAULT_BATCH 1024
+#define MAX_WORKERS 64
+
+typedef struct {
+  int p;
+  int q;
+  int length;
+  char *data;
+} Slot;
+
+static Generator *generator;
+static Slot *slots;
+static int slot_count;
+static int next_slot;
+static int done_slots;
+static mtx_t mtx;
+static cnd_t work_cnd;
+static cnd_t done_cnd;
+static int running = 1;
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(int signal) { stopping = 1; }
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int worker_run(void *arg) {
+  WorldChunk world = {0};
+  mtx_lock(&mtx);
+  while (1) {
+    while (running && next_slot >= slot_count) {
+      cnd_wait(&work_cnd, &mtx);
+    }
+    if (!running) {
+      break;
+    }
+    Slot *slot = slots + next_slot++;
+    mtx_unlock(&mtx);
+    generator_generate(generator, slot->p, slot->q, &world);
+    slot->data = terrain_encode(&world, &slot->length);
+    mtx_lock(&mtx);
+    if (++done_slots == slot_count) {
+      cnd_signal(&done_cnd);
+    }
+  }
+  mtx_unlock(&mtx);
+  world_chunk_free(&world);
+  return 0;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-d DB] [-g GENERATOR] [-s SEED] [-w WORKERS] "
+          "[-b BATCH] [--] P1 Q1 P2 Q2\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  const char *db_path = DEFAULT_DB_PATH;
+  const char *generator_path = GENERATOR_DEFAULT;
+  int use_seed = 0;
+  unsigned int seed = 0;
+  int worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+  int batch = DEFAULT_BATCH;
+  int option;
+  while ((option = getopt(argc, argv, "d:g:s:w:b:h")) != -1) {
+    switch (option) {
+      case 'd':
+        db_path = optarg;
+        break;
+      case 'g':
+        generator_path = optarg;
+        break;
+      case 's':
+        seed = atoi(optarg);
+        use_seed = 1;
+        break;
+      case 'w':
+        worker_count = atoi(optarg);
+        break;
+      case 'b':
+        batch = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (argc - optind != 4 || batch < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  const int p1 = atoi(argv[optind]);
+  const int q1 = atoi(argv[optind + 1]);
+  const int p2 = atoi(argv[optind + 2]);
+  const int q2 = atoi(argv[optind + 3]);
+  if (p1 > p2 || q1 > q2) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (worker_count < 1) {
+    worker_count = 1;
+  }
+  if (worker_count > MAX_WORKERS) {
+    worker_count = MAX_WORKERS;
+  }
+
+  generator = generator_create(generator_path, use_seed, seed);
+  if (!generator) {
+    fprintf(stderr, "unknown generator %s\n", generator_path);
+    return 1;
+  }
+  sqlite3 *db;
+  TerrainStore store;
+  char world_key[MAX_TERRAIN_WORLD_LENGTH];
+  terrain_world(world_key, generator_name(generator), use_seed, seed);
+  if (sqlite3_open(db_path, &db) || terrain_open(&store, db)) {
+    fprintf(stderr, "could not open %s\n", db_path);
+    return 1;
+  }
+  sqlite3_busy_timeout(db, 1000);
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  slots = malloc(sizeof(Slot) * batch);
+  mtx_init(&mtx, mtx_plain);
+  cnd_init(&work_cnd);
+  cnd_init(&done_cnd);
+  thrd_t workers[MAX_WORKERS];
+  for (int i = 0; i < worker_count; i++) {
+    thrd_create(&workers[i], worker_run, NULL);
+  }
+
+  const int rows = q2 - q1 + 1;
+  const long total = (long)(p2 - p1 + 1) * rows;
+  const double start = now();
+  double last_report = start;
+  long next = 0, generated = 0, skipped = 0;
+  while (next < total && !stopping) {
+    // the next batch of chunks that are not stored yet
+    int count = 0;
+    while (count < batch && next < total) {
+      const int p = p1 + next / rows;
+      const int q = q1 + next % rows;
+      next++;
+      if (terrain_exists(&store, world_key, p, q)) {
+        skipped++;
+        continue;
+      }
+      slots[count].p = p;
+      slots[count].q = q;
+      count++;
+    }
+    mtx_lock(&mtx);
+    slot_count = count;
+    next_slot = 0;
+    done_slots = 0;
+    // tinycthread's cnd_broadcast is a plain signal on posix
+    for (int i = 0; i < worker_count; i++) {
+      cnd_signal(&work_cnd);
+    }
+    while (done_slots < slot_count) {
+      cnd_wait(&done_cnd, &mtx);
+    }
+    slot_count = 0;
+    mtx_unlock(&mtx);
+
+    sqlite3_exec(db, "begin;", NULL, NULL, NULL);
+    for (int i = 0; i < count; i++) {
+      terrain_save(&store, world_key, slots[i].p, slots[i].q, slots[i].data,
+                   slots[i].length);
+      free(slots[i].data);
+    }
+    sqlite3_exec(db, "commit;", NULL, NULL, NULL);
+    generated += count;
+
+    const double t = now();
+    if (t - last_report >= 1 || next == total) {
+      const double rate = generated / (t - start);
+      const double eta = rate > 0 ? (total - next) / rate : 0;
+      printf("%ld / %ld chunks (%ld already stored), %.0f chunks/s, "
+             "%.0f s left\n",
+             next, total, skipped, rate, eta);
+      fflush(stdout);
+      last_report = t;
+    }
+  }
+  if (stopping) {
+    printf("stopped; run again to resume\n");
+  }
+
+  mtx_lock(&mtx);
+  running = 0;
+  for (int i = 0; i < worker_count; i++) {
+    cnd_signal(&work_cnd);
+  }
+  mtx_unlock(&mtx);
+  for (int i = 0; i < worker_count; i++) {
+    thrd_join(workers[i], NULL);
+  }
+  free(slots);
+  generator_destroy(generator);
+  terrain_close(&store);
+  sqlite3_close(db);
+  return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "protocol.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void quantize_position(int *result, float x, float y, float z, float rx,
+                       float ry) {
+  result[0] = lroundf(x * POSITION_SCALE);
+  result[1] = lroundf(y * POSITION_SCALE);
+  result[2] = lroundf(z * POSITION_SCALE);
+  result[3] = lroundf(rx * ROTATION_SCALE);
+  result[4] = lroundf(ry * ROTATION_SCALE);
+}
+
+// teleports and the like are cheaper to send whole
+int needs_keyframe(const int *state, const int *baseline) {
+  for (int i = 0; i < 3; i++) {
+    if (abs(state[i] - baseline[i]) > MAX_POSITION_DELTA) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Write "<prefix>,d0,d1,...\n" with the change from `baseline` to
+ * `state`, leaving off trailing zeros.  Returns the length written, or
+ * 0 if nothing changed.
+ */
+int format_delta(char *buffer, int length, const char *prefix,
+                 const int *state, const int *baseline) {
+  int count = POSITION_FIELDS;
+  while (count && state[count - 1] == baseline[count - 1]) {
+    count--;
+  }
+  if (!count) {
+    return 0;
+  }
+  int n = snprintf(buffer, length, "%s", prefix);
+  for (int i = 0; i < count && n < length; i++) {
+    n += snprintf(buffer + n, length - n, ",%d", state[i] - baseline[i]);
+  }
+  if (n < length) {
+    n += snprintf(buffer + n, length - n, "\n");
+  }
+  return n;
+}
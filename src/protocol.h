@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _protocol_h_
+#define _protocol_h_
+
+/*
+ * Player positions travel as integers: hundredths of a block and of a
+ * radian, the same precision the "P" message has always had with its
+ * two decimals.  A "P" keyframe sets the baseline and each "M" line that
+ * follows carries only the change from the previous one, with trailing
+ * zero fields left off:
+ *
+ *   client to server  M,dx,dy,dz,drx,dry
+ *   server to client  M,pid,dx,dy,dz,drx,dry
+ *
+ * A server that understands "M" says "V,2" when a client connects, and
+ * the client answers "V,2" in turn.  Neither side sends "M" otherwise.
+ * craft-server follows the version with the world's generator and seed,
+ * "V,2,NAME,USE_SEED,SEED", for the client to generate the same terrain;
+ * without them the client uses the default generator.
+ */
+#define PROTOCOL_VERSION_DELTA 2
+#define POSITION_SCALE 100
+#define ROTATION_SCALE 100
+#define POSITION_FIELDS 5
+// send a keyframe at least this often, or when a delta would be larger
+#define KEYFRAME_INTERVAL 64
+#define MAX_POSITION_DELTA (16 * POSITION_SCALE)
+
+void quantize_position(int *result, float x, float y, float z, float rx,
+                       float ry);
+int needs_keyframe(const int *state, const int *baseline);
+int format_delta(char *buffer, int length, const char *prefix,
+                 const int *state, const int *baseline);
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "record.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+double record_clock() {
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int record_open(Record *record, const char *path) {
+  const uint32_t version = RECORD_VERSION;
+  record->file = fopen(path, "wb");
+  if (!record->file) {
+    return -1;
+  }
+  fwrite(RECORD_MAGIC, 1, strlen(RECORD_MAGIC), record->file);
+  fwrite(&version, sizeof(version), 1, record->file);
+  record->start = record_clock();
+  return 0;
+}
+
+void record_close(Record *record) {
+  if (record->file) {
+    fclose(record->file);
+    record->file = NULL;
+  }
+}
+
+void record_write(Record *record, char direction, const char *data,
+                  int length) {
+  if (!record->file) {
+    return;
+  }
+  const double time = record_clock() - record->start;
+  const uint32_t size = length;
+  fwrite(&time, sizeof(time), 1, record->file);
+  fwrite(&direction, 1, 1, record->file);
+  fwrite(&size, sizeof(size), 1, record->file);
+  fwrite(data, 1, length, record->file);
+}
+
+/*
+ * Read a whole recording into memory.  Each entry's data is terminated
+ * so it can be used as a string.  Returns 0 on success.
+ */
+int record_load(const char *path, RecordEntry **entries, int *count) {
+  char magic[sizeof(RECORD_MAGIC)] = {0};
+  uint32_t version;
+  int capacity = 1024;
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return -1;
+  }
+  if (fread(magic, 1, strlen(RECORD_MAGIC), file) != strlen(RECORD_MAGIC) ||
+      strcmp(magic, RECORD_MAGIC) ||
+      fread(&version, sizeof(version), 1, file) != 1 ||
+      version != RECORD_VERSION) {
+    fclose(file);
+    return -1;
+  }
+  *count = 0;
+  *entries = malloc(sizeof(RecordEntry) * capacity);
+  while (1) {
+    RecordEntry entry;
+    uint32_t size;
+    if (fread(&entry.time, sizeof(entry.time), 1, file) != 1 ||
+        fread(&entry.direction, 1, 1, file) != 1 ||
+        fread(&size, sizeof(size), 1, file) != 1) {
+      break;
+    }
+    entry.length = size;
+    entry.data = malloc(size + 1);
+    if (fread(entry.data, 1, size, file) != size) {
+      free(entry.data);
+      break;
+    }
+    entry.data[size] = '\0';
+    if (*count == capacity) {
+      capacity *= 2;
+      *entries = realloc(*entries, sizeof(RecordEntry) * capacity);
+    }
+    (*entries)[(*count)++] = entry;
+  }
+  fclose(file);
+  return 0;
+}
+
+void record_free(RecordEntry *entries, int count) {
+  for (int i = 0; i < count; i++) {
+    free(entries[i].data);
+  }
+  free(entries);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _record_h_
+#define _record_h_
+
+#include <stdio.h>
+
+/*
+ * A recording of one client session, for replaying with craft-loadgen.
+ * The file is "CRAFTREC", a 32 bit format version, then one entry per
+ * buffer sent or received:
+ *
+ *   double   seconds since the recording started
+ *   char     RECORD_SEND or RECORD_RECV
+ *   uint32   length
+ *   char[]   the protocol text, as sent or received
+ *
+ * Numbers are in the byte order of the machine that recorded.
+ */
+#define RECORD_MAGIC "CRAFTREC"
+#define RECORD_VERSION 1
+#define RECORD_SEND 'S'
+#define RECORD_RECV 'R'
+
+typedef struct {
+  FILE *file;
+  double start;
+} Record;
+
+typedef struct {
+  double time;
+  char direction;
+  int length;
+  char *data;
+} RecordEntry;
+
+double record_clock();
+int record_open(Record *record, const char *path);
+void record_close(Record *record);
+void record_write(Record *record, char direction, const char *data,
+                  int length);
+int record_load(const char *path, RecordEntry **entries, int *count);
+void record_free(RecordEntry *entries, int count);
+
+#endif
@@ -0,0 +1,1549 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "server.h"
+#include "auth.h"
+#include "config.h"
+#include "generator.h"
+#include "sqlite3.h"
+#include "terrain.h"
+#include "tinycthread.h"
+#include "util.h"
+#include "world.h"
+#include <curl/curl.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "server_db.h"
+
+#define MAX_WORKERS 64
+#define MAX_SIGN_LENGTH 48
+#define MAX_USERNAME_LENGTH 128
+#define MAX_GENERATOR_PATH_LENGTH 256
+#define CHUNK_WRITES_SIZE 1024
+#define GRID_CELL_SIZE 8
+#define GRID_BUCKETS 1024
+#define MAX_VIEW_RADIUS 32
+#define VIEW_MARGIN (DELETE_CHUNK_RADIUS - CREATE_CHUNK_RADIUS)
+#define FLUSH_INTERVAL 0.05
+#define SPAWN_X 0
+#define SPAWN_Y 0
+#define SPAWN_Z 0
+#define PREGEN_BATCH 16
+#define PREGEN_REPORT_INTERVAL 10
+
+typedef enum { JOB_CHUNK, JOB_AUTH, JOB_PREGEN } JobType;
+
+/*
+ * Work handed to the worker threads.  Chunk jobs run the chunk queries
+ * against a private read-only connection, auth jobs talk to the login
+ * server.  Both would otherwise stall every other player.  The result
+ * is matched back to its client by serial, since the client may have
+ * disconnected (and its id been reused) in the meantime.  Pregen jobs
+ * generate a batch of chunks for /pregen; they complete whether or not
+ * the client that asked is still around, and carry the run they belong
+ * to so that a batch outliving its run is stored but not counted.
+ */
+typedef struct Job {
+  JobType type;
+  unsigned int serial;
+  int p;
+  int q;
+  int key;
+  unsigned int write_seq;
+  char username[MAX_USERNAME_LENGTH];
+  char access_token[MAX_USERNAME_LENGTH];
+  int user_id;
+  int authenticated;
+  unsigned int run;
+  int chunk_count;
+  int chunks[PREGEN_BATCH][2];
+  ServerBuffer result;
+  struct Job *next;
+} Job;
+
+typedef struct {
+  Job *head;
+  Job *tail;
+} JobQueue;
+
+typedef struct {
+  unsigned int last_used;
+  WorldChunk world;
+} WorldEntry;
+
+/*
+ * A /pregen run: chunks p1..p2 by q1..q2, taken in row order.  Chunks
+ * already in the terrain table are skipped, so a run that was stopped or
+ * cut short by a restart resumes where it left off.
+ */
+typedef struct {
+  int active;
+  unsigned int run;
+  unsigned int serial;
+  int p1;
+  int q1;
+  int p2;
+  int q2;
+  long next;
+  long total;
+  long generated;
+  long skipped;
+  int in_flight;
+  double started;
+  double last_report;
+} Pregen;
+
+static ServerConfig config;
+static ServerClient **clients;
+static int client_count;
+static int client_capacity;
+static unsigned int next_serial = 1;
+
+static thrd_t workers[MAX_WORKERS];
+static int worker_count;
+static int running;
+static mtx_t job_mtx;
+static cnd_t job_cnd;
+static JobQueue pending_jobs;
+static mtx_t done_mtx;
+static JobQueue done_jobs;
+
+static ServerClient **by_id;
+static int by_id_size;
+static ServerClient *grid[GRID_BUCKETS];
+static ServerClient **nearby;
+static int nearby_capacity;
+
+static Generator *generator;
+static char generator_path[MAX_GENERATOR_PATH_LENGTH];
+static char world_key[MAX_TERRAIN_WORLD_LENGTH];
+static Pregen pregen;
+static WorldEntry world_cache[SERVER_WORLD_CACHE_SIZE];
+static int world_count;
+static unsigned int world_clock;
+
+// highest write sequence number seen per (hashed) chunk
+static unsigned int chunk_writes[CHUNK_WRITES_SIZE];
+static unsigned int write_seq;
+static double last_commit;
+static double last_flush;
+static int pending_count;
+
+static const int allowed_items[] = {
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15, 17,
+    18, 19, 20, 21, 22, 23, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42,
+    43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59,
+    60, 61, 62, 63};
+static const int indestructible_items[] = {16};
+
+static double _now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void server_log(const char *format, ...) {
+  char text[SERVER_MAX_LINE_LENGTH];
+  char stamp[64];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  time_t seconds = tv.tv_sec;
+  struct tm tm;
+  gmtime_r(&seconds, &tm);
+  strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+  printf("%s.%06ld %s\n", stamp, (long)tv.tv_usec, text);
+  fflush(stdout);
+  FILE *file = fopen(SERVER_LOG_PATH, "a");
+  if (file) {
+    fprintf(file, "%s.%06ld %s\n", stamp, (long)tv.tv_usec, text);
+    fclose(file);
+  }
+}
+
+static int _chunked(float x) { return floorf(roundf(x) / CHUNK_SIZE); }
+
+static int _contains(const int *items, int count, int w) {
+  for (int i = 0; i < count; i++) {
+    if (items[i] == w) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void server_buffer_alloc(ServerBuffer *buffer, int capacity) {
+  buffer->size = 0;
+  buffer->capacity = capacity;
+  buffer->data = malloc(capacity);
+}
+
+void server_buffer_free(ServerBuffer *buffer) {
+  free(buffer->data);
+  buffer->data = NULL;
+  buffer->size = buffer->capacity = 0;
+}
+
+static void _buffer_reserve(ServerBuffer *buffer, int length) {
+  if (buffer->size + length <= buffer->capacity) {
+    return;
+  }
+  int capacity = buffer->capacity ? buffer->capacity : 256;
+  while (capacity < buffer->size + length) {
+    capacity *= 2;
+  }
+  buffer->data = realloc(buffer->data, capacity);
+  buffer->capacity = capacity;
+}
+
+void server_buffer_append(ServerBuffer *buffer, const char *data, int length) {
+  _buffer_reserve(buffer, length);
+  memcpy(buffer->data + buffer->size, data, length);
+  buffer->size += length;
+}
+
+void server_buffer_printf(ServerBuffer *buffer, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+  _buffer_reserve(buffer, length + 1);
+  va_start(args, format);
+  vsnprintf(buffer->data + buffer->size, length + 1, format, args);
+  va_end(args);
+  buffer->size += length;
+}
+
+void server_buffer_consume(ServerBuffer *buffer, int length) {
+  if (length >= buffer->size) {
+    buffer->size = 0;
+    return;
+  }
+  memmove(buffer->data, buffer->data + length, buffer->size - length);
+  buffer->size -= length;
+}
+
+// sending
+
+static void _send(ServerClient *client, const char *format, ...) {
+  if (client->closed) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  char text[SERVER_MAX_LINE_LENGTH];
+  int length = vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  if (length >= (int)sizeof(text)) {
+    // keep the line terminated even when it had to be cut short
+    length = sizeof(text) - 1;
+    text[length - 1] = '\n';
+  }
+  server_buffer_append(&client->output, text, length);
+  if (client->output.size > SERVER_MAX_OUTPUT) {
+    // the client is not reading; drop it rather than grow without bound
+    client->closed = 1;
+  }
+}
+
+static void _send_you(ServerClient *client) {
+  _send(client, "U,%d,%.2f,%.2f,%.2f,%.2f,%.2f\n", client->id, client->x,
+        client->y, client->z, client->rx, client->ry);
+}
+
+// interest management
+
+static int _cell(int p) {
+  return p >= 0 ? p / GRID_CELL_SIZE : (p + 1) / GRID_CELL_SIZE - 1;
+}
+
+static ServerClient **_grid_bucket(int cell_p, int cell_q) {
+  unsigned int hash =
+      (unsigned int)cell_p * 73856093u ^ (unsigned int)cell_q * 19349663u;
+  return grid + hash % GRID_BUCKETS;
+}
+
+static void _grid_remove(ServerClient *client) {
+  if (!client->in_grid) {
+    return;
+  }
+  ServerClient **link = _grid_bucket(client->cell_p, client->cell_q);
+  while (*link != client) {
+    link = &(*link)->grid_next;
+  }
+  *link = client->grid_next;
+  client->in_grid = 0;
+}
+
+static void _grid_insert(ServerClient *client) {
+  client->cell_p = _cell(client->p);
+  client->cell_q = _cell(client->q);
+  ServerClient **bucket = _grid_bucket(client->cell_p, client->cell_q);
+  client->grid_next = *bucket;
+  *bucket = client;
+  client->in_grid = 1;
+}
+
+static void _grid_move(ServerClient *client) {
+  if (client->in_grid && client->cell_p == _cell(client->p) &&
+      client->cell_q == _cell(client->q)) {
+    return;
+  }
+  _grid_remove(client);
+  _grid_insert(client);
+}
+
+/*
+ * Collect into `nearby` every client in a grid cell that the largest
+ * possible view radius around chunk (p, q) touches.  Callers still have
+ * to check each client's own radius.
+ */
+static int _nearby(int p, int q) {
+  const int r = MAX_VIEW_RADIUS + VIEW_MARGIN;
+  int count = 0;
+  for (int cell_p = _cell(p - r); cell_p <= _cell(p + r); cell_p++) {
+    for (int cell_q = _cell(q - r); cell_q <= _cell(q + r); cell_q++) {
+      ServerClient *other = *_grid_bucket(cell_p, cell_q);
+      for (; other; other = other->grid_next) {
+        if (other->cell_p != cell_p || other->cell_q != cell_q) {
+          continue;
+        }
+        if (count == nearby_capacity) {
+          nearby_capacity = nearby_capacity ? nearby_capacity * 2 : 64;
+          nearby = realloc(nearby, sizeof(ServerClient *) * nearby_capacity);
+        }
+        nearby[count++] = other;
+      }
+    }
+  }
+  return count;
+}
+
+static int _chunk_distance(const ServerClient *client, int p, int q) {
+  int dp = ABS(client->p - p);
+  int dq = ABS(client->q - q);
+  return MAX_NUMBER(dp, dq);
+}
+
+// the client keeps chunks loaded out to its delete radius
+static int _covers(const ServerClient *client, int p, int q) {
+  return _chunk_distance(client, p, q) <= client->radius + VIEW_MARGIN;
+}
+
+static ServerView *_view(ServerClient *observer, int id) {
+  if (id >= observer->view_count) {
+    int count = id + 16;
+    observer->views = realloc(observer->views, sizeof(ServerView) * count);
+    memset(observer->views + observer->view_count, 0,
+           sizeof(ServerView) * (count - observer->view_count));
+    observer->view_count = count;
+  }
+  return observer->views + id;
+}
+
+static int _sees(const ServerClient *observer, int id) {
+  return id < observer->view_count && observer->views[id].visible;
+}
+
+// seconds between position updates for an observer this many chunks away
+static double _position_interval(int distance) {
+  if (distance <= 1) {
+    return 0;
+  }
+  if (distance <= 4) {
+    return 0.2;
+  }
+  return 0.5;
+}
+
+/*
+ * Tell `observer` where `subject` is: a delta against what it was last
+ * told when the observer understands "M", otherwise (or periodically,
+ * or after a jump) a full "P" keyframe.
+ */
+static void _send_view_position(ServerClient *observer,
+                                ServerClient *subject, int keyframe) {
+  ServerView *view = _view(observer, subject->id);
+  int state[POSITION_FIELDS];
+  quantize_position(state, subject->x, subject->y, subject->z, subject->rx,
+                    subject->ry);
+  if (observer->version < PROTOCOL_VERSION_DELTA ||
+      view->updates >= KEYFRAME_INTERVAL ||
+      needs_keyframe(state, view->state)) {
+    keyframe = 1;
+  }
+  if (keyframe) {
+    _send(observer, "P,%d,%.2f,%.2f,%.2f,%.2f,%.2f\n", subject->id,
+          state[0] / (double)POSITION_SCALE, state[1] / (double)POSITION_SCALE,
+          state[2] / (double)POSITION_SCALE, state[3] / (double)ROTATION_SCALE,
+          state[4] / (double)ROTATION_SCALE);
+    view->updates = 0;
+  } else {
+    char prefix[32];
+    char text[128];
+    snprintf(prefix, sizeof(prefix), "M,%d", subject->id);
+    if (format_delta(text, sizeof(text), prefix, state, view->state)) {
+      _send(observer, "%s", text);
+      view->updates++;
+    }
+  }
+  memcpy(view->state, state, sizeof(state));
+  view->dirty = 0;
+  view->last_sent = _now();
+}
+
+/*
+ * Bring what `observer` knows about `subject` up to date.  A player
+ * appears (with its nick, since the client would otherwise call it
+ * "playerN") once inside the view radius, and only disappears again
+ * past the delete radius so players near the edge do not flicker.
+ * Movement of far away players is sent less often; server_tick sends
+ * whatever was held back.
+ */
+static void _update_pair(ServerClient *observer, ServerClient *subject,
+                         int send_position) {
+  if (observer == subject) {
+    return;
+  }
+  const int distance = _chunk_distance(observer, subject->p, subject->q);
+  if (!_sees(observer, subject->id)) {
+    if (distance <= observer->radius) {
+      _view(observer, subject->id)->visible = 1;
+      _send_view_position(observer, subject, 1);
+      _send(observer, "N,%d,%s\n", subject->id, subject->nick);
+    }
+  } else if (distance > observer->radius + VIEW_MARGIN) {
+    _send(observer, "D,%d\n", subject->id);
+    observer->views[subject->id].visible = 0;
+    observer->views[subject->id].dirty = 0;
+  } else if (send_position) {
+    ServerView *view = observer->views + subject->id;
+    view->dirty = 1;
+    if (_now() - view->last_sent >= _position_interval(distance)) {
+      _send_view_position(observer, subject, 0);
+    }
+  }
+}
+
+/*
+ * Called after `client` moved from chunk (old_p, old_q) or changed its
+ * radius.  Everyone around sees the new position; when `refresh` is set
+ * the client's own view of the others is recomputed as well.  Observers
+ * around the old chunk are visited too, to hide the client from those
+ * it has left behind.
+ */
+static void _update_interest(ServerClient *client, int old_p, int old_q,
+                             int refresh) {
+  _grid_move(client);
+  int count = _nearby(client->p, client->q);
+  for (int i = 0; i < count; i++) {
+    _update_pair(nearby[i], client, 1);
+    if (refresh) {
+      _update_pair(client, nearby[i], 0);
+    }
+  }
+  if (old_p == client->p && old_q == client->q) {
+    return;
+  }
+  count = _nearby(old_p, old_q);
+  for (int i = 0; i < count; i++) {
+    _update_pair(nearby[i], client, 0);
+    _update_pair(client, nearby[i], 0);
+  }
+}
+
+static void _send_nick(ServerClient *client) {
+  _send(client, "N,%d,%s\n", client->id, client->nick);
+  int count = _nearby(client->p, client->q);
+  for (int i = 0; i < count; i++) {
+    if (_sees(nearby[i], client->id)) {
+      _send(nearby[i], "N,%d,%s\n", client->id, client->nick);
+    }
+  }
+}
+
+static void _send_talk(const char *text) {
+  server_log("%s", text);
+  for (int i = 0; i < client_count; i++) {
+    _send(clients[i], "T,%s\n", text);
+  }
+}
+
+static void _send_block(ServerClient *client, int p, int q, int x, int y,
+                        int z, int w) {
+  int count = _nearby(p, q);
+  for (int i = 0; i < count; i++) {
+    ServerClient *other = nearby[i];
+    if (other == client || !_covers(other, p, q)) {
+      continue;
+    }
+    _send(other, "B,%d,%d,%d,%d,%d,%d\n", p, q, x, y, z, w);
+    _send(other, "R,%d,%d\n", p, q);
+  }
+}
+
+static void _send_light(ServerClient *client, int p, int q, int x, int y,
+                        int z, int w) {
+  int count = _nearby(p, q);
+  for (int i = 0; i < count; i++) {
+    ServerClient *other = nearby[i];
+    if (other == client || !_covers(other, p, q)) {
+      continue;
+    }
+    _send(other, "L,%d,%d,%d,%d,%d,%d\n", p, q, x, y, z, w);
+    _send(other, "R,%d,%d\n", p, q);
+  }
+}
+
+static void _send_sign(ServerClient *client, int p, int q, int x, int y,
+                       int z, int face, const char *text) {
+  int count = _nearby(p, q);
+  for (int i = 0; i < count; i++) {
+    ServerClient *other = nearby[i];
+    if (other == client || !_covers(other, p, q)) {
+      continue;
+    }
+    _send(other, "S,%d,%d,%d,%d,%d,%d,%s\n", p, q, x, y, z, face, text);
+  }
+}
+
+// world
+
+/*
+ * The generated terrain of chunk (p, q), for telling which block a
+ * player is building on when the database has no row for it.  A small
+ * LRU cache of chunks is kept, like world.py does for server.py.
+ * Chunks stored by /pregen or craft-pregen are loaded, not generated.
+ */
+static const WorldChunk *_world_chunk(int p, int q) {
+  WorldEntry *entry = NULL;
+  world_clock++;
+  for (int i = 0; i < world_count; i++) {
+    if (world_cache[i].world.p == p && world_cache[i].world.q == q) {
+      world_cache[i].last_used = world_clock;
+      return &world_cache[i].world;
+    }
+  }
+  if (world_count < SERVER_WORLD_CACHE_SIZE) {
+    entry = world_cache + world_count++;
+  } else {
+    entry = world_cache;
+    for (int i = 1; i < world_count; i++) {
+      if (world_cache[i].last_used < entry->last_used) {
+        entry = world_cache + i;
+      }
+    }
+  }
+  entry->last_used = world_clock;
+  if (!server_db_load_terrain(world_key, p, q, &entry->world)) {
+    generator_generate(generator, p, q, &entry->world);
+  }
+  return &entry->world;
+}
+
+static int _get_block(int x, int y, int z) {
+  const int p = _chunked(x);
+  const int q = _chunked(z);
+  int w;
+  if (server_db_get_block(p, q, x, y, z, &w)) {
+    return w;
+  }
+  w = world_chunk_get(_world_chunk(p, q), x, y, z);
+  return w > 0 ? w : 0;
+}
+
+static unsigned int *_chunk_write(int p, int q) {
+  unsigned int hash = (unsigned int)p * 73856093u ^ (unsigned int)q * 19349663u;
+  return chunk_writes + hash % CHUNK_WRITES_SIZE;
+}
+
+static void _mark_written(int p, int q) {
+  *_chunk_write(p, q) = ++write_seq;
+}
+
+// jobs
+
+static void _queue_push(JobQueue *queue, Job *job) {
+  job->next = NULL;
+  if (queue->tail) {
+    queue->tail->next = job;
+  } else {
+    queue->head = job;
+  }
+  queue->tail = job;
+}
+
+static Job *_queue_pop(JobQueue *queue) {
+  Job *job = queue->head;
+  if (job) {
+    queue->head = job->next;
+    if (!queue->head) {
+      queue->tail = NULL;
+    }
+  }
+  return job;
+}
+
+static void _dispatch(Job *job) {
+  if (job->type == JOB_CHUNK) {
+    // workers read through their own connections, so they only see
+    // what has been committed
+    server_db_commit();
+    last_commit = _now();
+    job->write_seq = write_seq;
+  }
+  mtx_lock(&job_mtx);
+  _queue_push(&pending_jobs, job);
+  pending_count++;
+  cnd_signal(&job_cnd);
+  mtx_unlock(&job_mtx);
+}
+
+static void _generate_batch(Job *job, WorldChunk *world) {
+  job->result.size = 0;
+  for (int i = 0; i < job->chunk_count; i++) {
+    const int p = job->chunks[i][0];
+    const int q = job->chunks[i][1];
+    int length;
+    generator_generate(generator, p, q, world);
+    char *data = terrain_encode(world, &length);
+    server_buffer_append(&job->result, (const char *)&length, sizeof(int));
+    server_buffer_append(&job->result, data, length);
+    free(data);
+  }
+}
+
+static int worker_run(void *arg) {
+  WorldChunk world = {0};
+  ServerDbReader reader;
+  if (server_db_reader_open(&reader, config.db_path)) {
+    server_log("ERROR could not open %s for reading", config.db_path);
+    return 1;
+  }
+  while (1) {
+    mtx_lock(&job_mtx);
+    while (running && !pending_jobs.head) {
+      cnd_wait(&job_cnd, &job_mtx);
+    }
+    Job *job = _queue_pop(&pending_jobs);
+    if (job) {
+      pending_count--;
+    }
+    mtx_unlock(&job_mtx);
+    if (!job) {
+      break;
+    }
+    if (job->type == JOB_CHUNK) {
+      job->result.size = 0;
+      server_db_reader_chunk(&reader, &job->result, job->p, job->q, job->key);
+    } else if (job->type == JOB_AUTH) {
+      job->authenticated = 0;
+      if (job->username[0] && job->access_token[0]) {
+        job->authenticated = get_user_id(&job->user_id, config.auth_url,
+                                         job->username, job->access_token);
+      }
+    } else if (job->type == JOB_PREGEN) {
+      _generate_batch(job, &world);
+    }
+    mtx_lock(&done_mtx);
+    _queue_push(&done_jobs, job);
+    mtx_unlock(&done_mtx);
+    if (config.notify) {
+      config.notify(config.notify_arg);
+    }
+  }
+  server_db_reader_close(&reader);
+  world_chunk_free(&world);
+  return 0;
+}
+
+static void _free_job(Job *job) {
+  server_buffer_free(&job->result);
+  free(job);
+}
+
+static Job *_new_job(JobType type, ServerClient *client) {
+  Job *job = calloc(1, sizeof(Job));
+  job->type = type;
+  job->serial = client->serial;
+  return job;
+}
+
+static void _set_nick(ServerClient *client, const char *nick) {
+  size_t length = strnlen(nick, SERVER_MAX_NICK_LENGTH - 1);
+  memcpy(client->nick, nick, length);
+  client->nick[length] = '\0';
+}
+
+static ServerClient *_find_serial(unsigned int serial) {
+  for (int i = 0; i < client_count; i++) {
+    if (clients[i]->serial == serial) {
+      return clients[i];
+    }
+  }
+  return NULL;
+}
+
+static ServerClient *_find_nick(const char *nick) {
+  for (int i = 0; i < client_count; i++) {
+    if (!strcmp(clients[i]->nick, nick)) {
+      return clients[i];
+    }
+  }
+  return NULL;
+}
+
+static void _complete_auth(ServerClient *client, Job *job) {
+  char text[SERVER_MAX_LINE_LENGTH];
+  if (job->authenticated) {
+    client->user_id = job->user_id;
+    _set_nick(client, job->username);
+  } else {
+    client->user_id = 0;
+    snprintf(client->nick, SERVER_MAX_NICK_LENGTH, "guest%d", client->id);
+    if (config.auth_url) {
+      _send(client, "T,Visit craft.michaelfogleman.com to register!\n");
+    }
+  }
+  _send_nick(client);
+  snprintf(text, sizeof(text), "%s has joined the game.", client->nick);
+  _send_talk(text);
+}
+
+static void _pregen_report(int finished) {
+  ServerClient *client = _find_serial(pregen.serial);
+  const double elapsed = _now() - pregen.started;
+  const long done = pregen.generated + pregen.skipped;
+  const double rate = elapsed > 0 ? pregen.generated / elapsed : 0;
+  char text[SERVER_MAX_LINE_LENGTH];
+  if (finished) {
+    snprintf(text, sizeof(text),
+             "Pregen: done, %ld chunks generated, %ld already stored, "
+             "%.0f chunks/s",
+             pregen.generated, pregen.skipped, rate);
+  } else {
+    const double eta = rate > 0 ? (pregen.total - done) / rate : 0;
+    snprintf(text, sizeof(text),
+             "Pregen: %ld of %ld chunks, %.0f chunks/s, %.0f s left", done,
+             pregen.total, rate, eta);
+  }
+  server_log("%s", text);
+  if (client) {
+    _send(client, "T,%s\n", text);
+  }
+  pregen.last_report = _now();
+}
+
+/*
+ * Keep the workers busy with batches of chunks that are not stored yet,
+ * leaving room in the queue for players' chunk requests.
+ */
+static void _pregen_dispatch() {
+  const int rows = pregen.q2 - pregen.q1 + 1;
+  const int limit = worker_count > 1 ? worker_count / 2 : 1;
+  while (pregen.active && pregen.in_flight < limit &&
+         pregen.next < pregen.total) {
+    Job *job = calloc(1, sizeof(Job));
+    job->type = JOB_PREGEN;
+    job->serial = pregen.serial;
+    job->run = pregen.run;
+    while (job->chunk_count < PREGEN_BATCH && pregen.next < pregen.total) {
+      const int p = pregen.p1 + pregen.next / rows;
+      const int q = pregen.q1 + pregen.next % rows;
+      pregen.next++;
+      if (server_db_terrain_exists(world_key, p, q)) {
+        pregen.skipped++;
+        continue;
+      }
+      job->chunks[job->chunk_count][0] = p;
+      job->chunks[job->chunk_count][1] = q;
+      job->chunk_count++;
+    }
+    if (!job->chunk_count) {
+      _free_job(job);
+      continue;
+    }
+    pregen.in_flight++;
+    _dispatch(job);
+  }
+  if (pregen.active && !pregen.in_flight && pregen.next == pregen.total) {
+    pregen.active = 0;
+    _pregen_report(1);
+  }
+}
+
+static void _complete_pregen(Job *job) {
+  const char *data = job->result.data;
+  for (int i = 0; i < job->chunk_count; i++) {
+    int length;
+    memcpy(&length, data, sizeof(int));
+    data += sizeof(int);
+    server_db_save_terrain(world_key, job->chunks[i][0], job->chunks[i][1],
+                           data, length);
+    data += length;
+  }
+  if (job->run != pregen.run) {
+    return;
+  }
+  pregen.generated += job->chunk_count;
+  pregen.in_flight--;
+  if (pregen.active && _now() - pregen.last_report > PREGEN_REPORT_INTERVAL) {
+    _pregen_report(0);
+  }
+  _pregen_dispatch();
+}
+
+void server_complete_jobs() {
+  mtx_lock(&done_mtx);
+  Job *job = done_jobs.head;
+  done_jobs.head = done_jobs.tail = NULL;
+  mtx_unlock(&done_mtx);
+  while (job) {
+    Job *next = job->next;
+    ServerClient *client = _find_serial(job->serial);
+    if (job->type == JOB_PREGEN) {
+      _complete_pregen(job);
+      _free_job(job);
+    } else if (!client) {
+      _free_job(job);
+    } else if (job->type == JOB_AUTH) {
+      _complete_auth(client, job);
+      _free_job(job);
+    } else if (*_chunk_write(job->p, job->q) > job->write_seq) {
+      // the chunk changed while it was being read; the broadcast of
+      // that change may already be queued ahead of this reply, so read
+      // it again rather than send stale rows after it
+      _dispatch(job);
+    } else {
+      server_buffer_append(&client->output, job->result.data,
+                           job->result.size);
+      _free_job(job);
+    }
+    job = next;
+  }
+}
+
+// handlers
+
+/*
+ * Clients open with "V,1" and answer our "V,2" with their own once they
+ * know this server speaks the delta protocol.
+ */
+static void on_version(ServerClient *client, int version) {
+  if (version < 1 || version > PROTOCOL_VERSION_DELTA) {
+    if (!client->version) {
+      client->closed = 1;
+    }
+    return;
+  }
+  if (version > client->version) {
+    client->version = version;
+  }
+}
+
+static void on_authenticate(ServerClient *client, const char *username,
+                            const char *access_token) {
+  Job *job = _new_job(JOB_AUTH, client);
+  snprintf(job->username, MAX_USERNAME_LENGTH, "%s", username);
+  snprintf(job->access_token, MAX_USERNAME_LENGTH, "%s", access_token);
+  if (!config.auth_url) {
+    // no login server: everyone plays as a guest and may build
+    _complete_auth(client, job);
+    _free_job(job);
+    return;
+  }
+  _dispatch(job);
+}
+
+static void on_chunk(ServerClient *client, int p, int q, int key) {
+  Job *job = _new_job(JOB_CHUNK, client);
+  job->p = p;
+  job->q = q;
+  job->key = key;
+  _dispatch(job);
+}
+
+static int _can_build(ServerClient *client) {
+  return !config.auth_url || client->user_id;
+}
+
+static int _is_operator(ServerClient *client) {
+  if (client->local) {
+    return 1;
+  }
+  if (!config.auth_url || !client->user_id || !config.operators) {
+    return 0;
+  }
+  const size_t length = strlen(client->nick);
+  for (const char *name = config.operators; *name;) {
+    const size_t n = strcspn(name, ",");
+    if (n == length && !strncmp(name, client->nick, n)) {
+      return 1;
+    }
+    name += n + (name[n] == ',');
+  }
+  return 0;
+}
+
+static void on_block(ServerClient *client, int x, int y, int z, int w) {
+  const int p = _chunked(x);
+  const int q = _chunked(z);
+  const int previous = _get_block(x, y, z);
+  const char *message = NULL;
+  if (!_can_build(client)) {
+    message = "Only logged in users are allowed to build.";
+  } else if (y <= 0 || y > 255) {
+    message = "Invalid block coordinates.";
+  } else if (!_contains(allowed_items,
+                        sizeof(allowed_items) / sizeof(allowed_items[0]),
+                        w)) {
+    message = "That item is not allowed.";
+  } else if (w && previous) {
+    message = "Cannot create blocks in a non-empty space.";
+  } else if (!w && !previous) {
+    message = "That space is already empty.";
+  } else if (_contains(indestructible_items,
+                       sizeof(indestructible_items) /
+                           sizeof(indestructible_items[0]),
+                       previous)) {
+    message = "Cannot destroy that type of block.";
+  }
+  if (message) {
+    _send(client, "B,%d,%d,%d,%d,%d,%d\n", p, q, x, y, z, previous);
+    _send(client, "R,%d,%d\n", p, q);
+    _send(client, "T,%s\n", message);
+    return;
+  }
+  server_db_insert_block(p, q, x, y, z, w);
+  _mark_written(p, q);
+  _send_block(client, p, q, x, y, z, w);
+  // neighbouring chunks keep a copy of border blocks for face culling
+  for (int dx = -1; dx <= 1; dx++) {
+    for (int dz = -1; dz <= 1; dz++) {
+      if (dx == 0 && dz == 0) {
+        continue;
+      }
+      if (dx && _chunked(x + dx) == p) {
+        continue;
+      }
+      if (dz && _chunked(z + dz) == q) {
+        continue;
+      }
+      const int np = p + dx;
+      const int nq = q + dz;
+      server_db_insert_block(np, nq, x, y, z, -w);
+      _mark_written(np, nq);
+      _send_block(client, np, nq, x, y, z, -w);
+    }
+  }
+  if (w == 0) {
+    server_db_delete_signs(x, y, z);
+    server_db_clear_lights(x, y, z);
+  }
+}
+
+static void on_light(ServerClient *client, int x, int y, int z, int w) {
+  const int p = _chunked(x);
+  const int q = _chunked(z);
+  const int block = _get_block(x, y, z);
+  const char *message = NULL;
+  if (!_can_build(client)) {
+    message = "Only logged in users are allowed to build.";
+  } else if (block == 0) {
+    message = "Lights must be placed on a block.";
+  } else if (w < 0 || w > 15) {
+    message = "Invalid light value.";
+  }
+  if (message) {
+    _send(client, "R,%d,%d\n", p, q);
+    _send(client, "T,%s\n", message);
+    return;
+  }
+  server_db_insert_light(p, q, x, y, z, w);
+  _mark_written(p, q);
+  _send_light(client, p, q, x, y, z, w);
+}
+
+static void on_sign(ServerClient *client, int x, int y, int z, int face,
+                    const char *text) {
+  if (!_can_build(client)) {
+    _send(client, "T,Only logged in users are allowed to build.\n");
+    return;
+  }
+  if (y <= 0 || y > 255 || face < 0 || face > 7) {
+    return;
+  }
+  if (strlen(text) > MAX_SIGN_LENGTH) {
+    return;
+  }
+  const int p = _chunked(x);
+  const int q = _chunked(z);
+  if (text[0]) {
+    server_db_insert_sign(p, q, x, y, z, face, text);
+  } else {
+    server_db_delete_sign(x, y, z, face);
+  }
+  _mark_written(p, q);
+  _send_sign(client, p, q, x, y, z, face, text);
+}
+
+static void _move(ServerClient *client, float x, float y, float z, float rx,
+                  float ry) {
+  const int old_p = client->p;
+  const int old_q = client->q;
+  client->x = x;
+  client->y = y;
+  client->z = z;
+  client->rx = rx;
+  client->ry = ry;
+  client->p = _chunked(x);
+  client->q = _chunked(z);
+  _update_interest(client, old_p, old_q,
+                   old_p != client->p || old_q != client->q);
+}
+
+static void on_position(ServerClient *client, float x, float y, float z,
+                        float rx, float ry) {
+  quantize_position(client->received, x, y, z, rx, ry);
+  _move(client, x, y, z, rx, ry);
+}
+
+static void on_move(ServerClient *client, const int *delta) {
+  int *state = client->received;
+  for (int i = 0; i < POSITION_FIELDS; i++) {
+    state[i] += delta[i];
+  }
+  _move(client, state[0] / (float)POSITION_SCALE,
+        state[1] / (float)POSITION_SCALE, state[2] / (float)POSITION_SCALE,
+        state[3] / (float)ROTATION_SCALE, state[4] / (float)ROTATION_SCALE);
+}
+
+static void _teleport(ServerClient *client, float x, float y, float z,
+                      float rx, float ry) {
+  _move(client, x, y, z, rx, ry);
+  _send_you(client);
+}
+
+static void on_help(ServerClient *client, const char *topic) {
+  if (!topic) {
+    _send(client, "T,Type \"t\" to chat. Type \"/\" to type commands:\n");
+    _send(client, "T,/goto [NAME], /help [TOPIC], /list, /login NAME, "
+                  "/logout, /nick\n");
+    _send(client, "T,/offline [FILE], /online HOST [PORT], /pq P Q, "
+                  "/pregen, /spawn, /view N\n");
+    return;
+  }
+  static const char *const topics[][3] = {
+      {"goto", "/goto [NAME]", "Teleport to another user."},
+      {"list", "/list", "Display a list of connected users."},
+      {"login", "/login NAME", "Switch to another registered username."},
+      {"logout", "/logout", "Unauthenticate and become a guest user."},
+      {"offline", "/offline [FILE]", "Switch to offline mode."},
+      {"online", "/online HOST [PORT]", "Connect to the specified server."},
+      {"nick", "/nick [NICK]", "Get or set your nickname."},
+      {"pq", "/pq P Q", "Teleport to the specified chunk."},
+      {"pregen", "/pregen [P1 Q1 P2 Q2 | stop]",
+       "Generate and store the chunks in a range ahead of time."},
+      {"spawn", "/spawn", "Teleport back to the spawn point."},
+      {"view", "/view N", "Set viewing distance, 1 - 32."},
+  };
+  for (unsigned int i = 0; i < sizeof(topics) / sizeof(topics[0]); i++) {
+    if (!strcasecmp(topic, topics[i][0])) {
+      _send(client, "T,Help: %s\n", topics[i][1]);
+      _send(client, "T,%s\n", topics[i][2]);
+      return;
+    }
+  }
+}
+
+static void on_list(ServerClient *client) {
+  ServerBuffer text;
+  server_buffer_alloc(&text, 256);
+  server_buffer_printf(&text, "T,Players: ");
+  for (int i = 0; i < client_count; i++) {
+    server_buffer_printf(&text, i ? ", %s" : "%s", clients[i]->nick);
+  }
+  server_buffer_printf(&text, "\n");
+  server_buffer_append(&client->output, text.data, text.size);
+  server_buffer_free(&text);
+}
+
+// what craft-loadgen polls to see how the server is coping
+static void on_stats(ServerClient *client) {
+  mtx_lock(&job_mtx);
+  const int pending = pending_count;
+  mtx_unlock(&job_mtx);
+  _send(client,
+        "T,Stats: clients %d, ticks %d, tick avg %.3f ms, max %.3f ms, "
+        "jobs %d\n",
+        client_count, client->tick_count,
+        client->tick_count ? client->tick_total / client->tick_count * 1000
+                           : 0.0,
+        client->tick_max * 1000, pending);
+  client->tick_count = 0;
+  client->tick_total = 0;
+  client->tick_max = 0;
+}
+
+static void on_pregen(ServerClient *client, int p1, int q1, int p2, int q2) {
+  if (pregen.active) {
+    _send(client, "T,A pregen is already running; \"/pregen stop\" it.\n");
+    return;
+  }
+  if (p1 > p2 || q1 > q2 || abs(p1) > 1000 || abs(q1) > 1000 ||
+      abs(p2) > 1000 || abs(q2) > 1000) {
+    _send(client, "T,Usage: /pregen P1 Q1 P2 Q2, from -1000 to 1000\n");
+    return;
+  }
+  const unsigned int run = pregen.run + 1;
+  memset(&pregen, 0, sizeof(pregen));
+  pregen.active = 1;
+  pregen.run = run;
+  pregen.serial = client->serial;
+  pregen.p1 = p1;
+  pregen.q1 = q1;
+  pregen.p2 = p2;
+  pregen.q2 = q2;
+  pregen.total = (long)(p2 - p1 + 1) * (q2 - q1 + 1);
+  pregen.started = pregen.last_report = _now();
+  _send(client, "T,Pregenerating %ld chunks.\n", pregen.total);
+  _pregen_dispatch();
+}
+
+static void on_command(ServerClient *client, const char *text) {
+  char name[SERVER_MAX_LINE_LENGTH];
+  char extra;
+  int p, q, p1, q1, p2, q2;
+  if (!strcmp(text, "/nick")) {
+    if (config.auth_url) {
+      _send(client, "T,You cannot change your nick on this server.\n");
+    } else {
+      _send(client, "T,Your nickname is %s\n", client->nick);
+    }
+  } else if (sscanf(text, "/nick %4095[^, ] %c", name, &extra) == 1) {
+    if (config.auth_url) {
+      _send(client, "T,You cannot change your nick on this server.\n");
+      return;
+    }
+    char message[SERVER_MAX_LINE_LENGTH];
+    snprintf(message, sizeof(message), "%s is now known as %.31s",
+             client->nick, name);
+    _send_talk(message);
+    _set_nick(client, name);
+    _send_nick(client);
+  } else if (!strcmp(text, "/spawn")) {
+    _teleport(client, SPAWN_X, SPAWN_Y, SPAWN_Z, 0, 0);
+  } else if (!strcmp(text, "/goto") ||
+             sscanf(text, "/goto %4095s %c", name, &extra) == 1) {
+    ServerClient *other = NULL;
+    if (!strcmp(text, "/goto")) {
+      if (client_count > 1) {
+        do {
+          other = clients[rand() % client_count];
+        } while (other == client);
+      }
+    } else {
+      other = _find_nick(name);
+    }
+    if (other) {
+      _teleport(client, other->x, other->y, other->z, other->rx, other->ry);
+    }
+  } else if (sscanf(text, "/pq %d %d %c", &p, &q, &extra) == 2 ||
+             sscanf(text, "/pq %d , %d %c", &p, &q, &extra) == 2) {
+    if (abs(p) > 1000 || abs(q) > 1000) {
+      return;
+    }
+    _teleport(client, p * CHUNK_SIZE, 0, q * CHUNK_SIZE, 0, 0);
+  } else if (!strcmp(text, "/help")) {
+    on_help(client, NULL);
+  } else if (sscanf(text, "/help %4095s %c", name, &extra) == 1) {
+    on_help(client, name);
+  } else if (!strcmp(text, "/list")) {
+    on_list(client);
+  } else if (!strcmp(text, "/stats")) {
+    on_stats(client);
+  } else if ((!strcmp(text, "/pregen") || !strncmp(text, "/pregen ", 8)) &&
+             !_is_operator(client)) {
+    _send(client, "T,Only server operators can use /pregen.\n");
+  } else if (!strcmp(text, "/pregen")) {
+    if (pregen.active) {
+      pregen.serial = client->serial;
+      _pregen_report(0);
+    } else {
+      _send(client, "T,No pregen is running.\n");
+    }
+  } else if (!strcmp(text, "/pregen stop")) {
+    // batches already queued still complete and are stored
+    pregen.active = 0;
+    _send(client, "T,Pregen stopped.\n");
+  } else if (sscanf(text, "/pregen %d %d %d %d %c", &p1, &q1, &p2, &q2,
+                    &extra) == 4) {
+    on_pregen(client, p1, q1, p2, q2);
+  } else if (sscanf(text, "/view %d %c", &p, &extra) == 1) {
+    // sent by the client along with its own /view, not typed at us
+    if (p >= 1 && p <= MAX_VIEW_RADIUS) {
+      client->radius = p;
+      _update_interest(client, client->p, client->q, 1);
+    }
+  } else {
+    _send(client, "T,Unrecognized command: \"%s\"\n", text);
+  }
+}
+
+static void on_talk(ServerClient *client, const char *text) {
+  char message[SERVER_MAX_LINE_LENGTH];
+  if (text[0] == '/') {
+    on_command(client, text);
+  } else if (text[0] == '@') {
+    char nick[SERVER_MAX_LINE_LENGTH];
+    sscanf(text + 1, "%4095[^ ]", nick);
+    ServerClient *other = _find_nick(nick);
+    if (other) {
+      snprintf(message, sizeof(message), "%s> %s", client->nick, text);
+      _send(client, "T,%s\n", message);
+      _send(other, "T,%s\n", message);
+    } else {
+      _send(client, "T,Unrecognized nick: \"%s\"\n", nick);
+    }
+  } else {
+    snprintf(message, sizeof(message), "%s> %s", client->nick, text);
+    _send_talk(message);
+  }
+}
+
+/*
+ * Dispatch one line of the protocol.  Malformed lines are ignored, as
+ * server.py does when a handler raises.
+ */
+static void on_data(ServerClient *client, char *line) {
+  int x, y, z, w, face;
+  float fx, fy, fz, rx, ry;
+  int delta[POSITION_FIELDS];
+  int offset;
+  char username[MAX_USERNAME_LENGTH];
+  char access_token[MAX_USERNAME_LENGTH];
+  switch (line[0]) {
+    case 'V':
+      if (sscanf(line, "V,%d", &x) == 1) {
+        on_version(client, x);
+      }
+      break;
+    case 'A':
+      username[0] = access_token[0] = '\0';
+      sscanf(line, "A,%127[^,],%127[^,]", username, access_token);
+      on_authenticate(client, username, access_token);
+      break;
+    case 'C':
+      w = 0;
+      if (sscanf(line, "C,%d,%d,%d", &x, &z, &w) >= 2) {
+        on_chunk(client, x, z, w);
+      }
+      break;
+    case 'B':
+      if (sscanf(line, "B,%d,%d,%d,%d", &x, &y, &z, &w) == 4) {
+        on_block(client, x, y, z, w);
+      }
+      break;
+    case 'L':
+      if (sscanf(line, "L,%d,%d,%d,%d", &x, &y, &z, &w) == 4) {
+        on_light(client, x, y, z, w);
+      }
+      break;
+    case 'S':
+      offset = 0;
+      if (sscanf(line, "S,%d,%d,%d,%d,%n", &x, &y, &z, &face, &offset) == 4 &&
+          offset) {
+        on_sign(client, x, y, z, face, line + offset);
+      }
+      break;
+    case 'P':
+      if (sscanf(line, "P,%f,%f,%f,%f,%f", &fx, &fy, &fz, &rx, &ry) == 5) {
+        on_position(client, fx, fy, fz, rx, ry);
+      }
+      break;
+    case 'M':
+      memset(delta, 0, sizeof(delta));
+      if (sscanf(line, "M,%d,%d,%d,%d,%d", delta, delta + 1, delta + 2,
+                 delta + 3, delta + 4) >= 1) {
+        on_move(client, delta);
+      }
+      break;
+    case 'T':
+      if (line[1] == ',') {
+        on_talk(client, line + 2);
+      }
+      break;
+  }
+}
+
+void server_receive(ServerClient *client, const char *data, int length) {
+  ServerBuffer *input = &client->input;
+  server_buffer_append(input, data, length);
+  int start = 0;
+  for (int i = 0; i < input->size && !client->closed; i++) {
+    if (input->data[i] != '\n') {
+      continue;
+    }
+    input->data[i] = '\0';
+    if (i > start && input->data[i - 1] == '\r') {
+      input->data[i - 1] = '\0';
+    }
+    if (input->data[start]) {
+      on_data(client, input->data + start);
+    }
+    start = i + 1;
+  }
+  server_buffer_consume(input, start);
+  if (input->size > SERVER_MAX_LINE_LENGTH) {
+    client->closed = 1;
+  }
+}
+
+// connections
+
+static int _next_client_id() {
+  int result = 1;
+  int taken = 1;
+  while (taken) {
+    taken = 0;
+    for (int i = 0; i < client_count; i++) {
+      if (clients[i]->id == result) {
+        taken = 1;
+        result++;
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+ServerClient *server_connect(const char *address, void *transport) {
+  ServerClient *client = calloc(1, sizeof(ServerClient));
+  client->id = _next_client_id();
+  client->serial = next_serial++;
+  client->transport = transport;
+  // only the in-process loopback transport; a proxy or tunnel on this
+  // host would make any remote player look like 127.0.0.1
+  client->local = !strcmp(address, "loopback");
+  snprintf(client->nick, SERVER_MAX_NICK_LENGTH, "guest%d", client->id);
+  client->x = SPAWN_X;
+  client->y = SPAWN_Y;
+  client->z = SPAWN_Z;
+  client->p = _chunked(client->x);
+  client->q = _chunked(client->z);
+  client->radius = CREATE_CHUNK_RADIUS;
+  server_buffer_alloc(&client->input, 1024);
+  server_buffer_alloc(&client->output, 4096);
+  if (client_count == client_capacity) {
+    client_capacity = client_capacity ? client_capacity * 2 : 16;
+    clients = realloc(clients, sizeof(ServerClient *) * client_capacity);
+  }
+  clients[client_count++] = client;
+  if (client->id >= by_id_size) {
+    int size = client->id + 16;
+    by_id = realloc(by_id, sizeof(ServerClient *) * size);
+    memset(by_id + by_id_size, 0, sizeof(ServerClient *) * (size - by_id_size));
+    by_id_size = size;
+  }
+  by_id[client->id] = client;
+  server_log("CONN %d %s", client->id, address);
+  _send(client, "V,%d,%s,%d,%u\n", PROTOCOL_VERSION_DELTA,
+        generator_name(generator), config.use_seed, (unsigned int)config.seed);
+  _send_you(client);
+  _send(client, "E,%f,%d\n", _now(), config.day_length);
+  _send(client, "T,Welcome to Craft!\n");
+  _send(client, "T,Type \"/help\" for a list of commands.\n");
+  _send(client, "N,%d,%s\n", client->id, client->nick);
+  _update_interest(client, client->p, client->q, 1);
+  return client;
+}
+
+void server_disconnect(ServerClient *client) {
+  char text[SERVER_MAX_LINE_LENGTH];
+  for (int i = 0; i < client_count; i++) {
+    if (clients[i] == client) {
+      clients[i] = clients[--client_count];
+      break;
+    }
+  }
+  server_log("DISC %d", client->id);
+  _grid_remove(client);
+  int count = _nearby(client->p, client->q);
+  for (int i = 0; i < count; i++) {
+    if (_sees(nearby[i], client->id)) {
+      _send(nearby[i], "D,%d\n", client->id);
+      nearby[i]->views[client->id].visible = 0;
+      nearby[i]->views[client->id].dirty = 0;
+    }
+  }
+  snprintf(text, sizeof(text), "%s has disconnected from the server.",
+           client->nick);
+  _send_talk(text);
+  server_buffer_free(&client->input);
+  server_buffer_free(&client->output);
+  by_id[client->id] = NULL;
+  free(client->views);
+  free(client);
+}
+
+/*
+ * The transport reports how long each pass of its loop took, not
+ * counting time spent waiting for input.  /stats summarizes them for
+ * each client since its last /stats.
+ */
+void server_tick_time(double seconds) {
+  for (int i = 0; i < client_count; i++) {
+    ServerClient *client = clients[i];
+    client->tick_count++;
+    client->tick_total += seconds;
+    client->tick_max = MAX_NUMBER(client->tick_max, seconds);
+  }
+}
+
+int server_client_count() { return client_count; }
+
+ServerClient *server_client(int index) { return clients[index]; }
+
+void server_tick() {
+  const double now = _now();
+  if (now - last_commit > COMMIT_INTERVAL) {
+    server_db_commit();
+    last_commit = now;
+  }
+  // position updates held back for distant observers
+  if (now - last_flush < FLUSH_INTERVAL) {
+    return;
+  }
+  last_flush = now;
+  for (int i = 0; i < client_count; i++) {
+    ServerClient *observer = clients[i];
+    for (int id = 0; id < observer->view_count; id++) {
+      ServerView *view = observer->views + id;
+      if (!view->visible || !view->dirty) {
+        continue;
+      }
+      ServerClient *subject = id < by_id_size ? by_id[id] : NULL;
+      if (!subject) {
+        continue;
+      }
+      const int distance = _chunk_distance(observer, subject->p, subject->q);
+      if (now - view->last_sent >= _position_interval(distance)) {
+        _send_view_position(observer, subject, 0);
+      }
+    }
+  }
+}
+
+int server_init(const ServerConfig *server_config) {
+  config = *server_config;
+  if (!config.db_path) {
+    config.db_path = SERVER_DB_PATH;
+  }
+  if (config.workers <= 0) {
+    config.workers = 1;
+  }
+  if (config.workers > MAX_WORKERS) {
+    config.workers = MAX_WORKERS;
+  }
+  if (server_db_init(config.db_path)) {
+    server_log("ERROR could not open %s", config.db_path);
+    return -1;
+  }
+  if (!config.generator && !config.use_seed &&
+      server_db_load_generator(generator_path, sizeof(generator_path),
+                               &config.use_seed, &config.seed)) {
+    config.generator = generator_path;
+  }
+  if (!config.generator) {
+    config.generator = GENERATOR_DEFAULT;
+  }
+  generator = generator_create(config.generator, config.use_seed, config.seed);
+  if (!generator) {
+    server_log("ERROR unknown generator %s", config.generator);
+    server_db_close();
+    return -1;
+  }
+  server_db_save_generator(config.generator, config.use_seed, config.seed);
+  server_db_commit();
+  terrain_world(world_key, generator_name(generator), config.use_seed,
+                config.seed);
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  last_commit = _now();
+  running = 1;
+  mtx_init(&job_mtx, mtx_plain);
+  cnd_init(&job_cnd);
+  mtx_init(&done_mtx, mtx_plain);
+  for (worker_count = 0; worker_count < config.workers; worker_count++) {
+    thrd_create(&workers[worker_count], worker_run, NULL);
+  }
+  return 0;
+}
+
+void server_shutdown() {
+  mtx_lock(&job_mtx);
+  running = 0;
+  // tinycthread's cnd_broadcast is a plain signal on posix
+  for (int i = 0; i < worker_count; i++) {
+    cnd_signal(&job_cnd);
+  }
+  mtx_unlock(&job_mtx);
+  for (int i = 0; i < worker_count; i++) {
+    thrd_join(workers[i], NULL);
+  }
+  while (client_count) {
+    server_disconnect(clients[client_count - 1]);
+  }
+  // with every client gone this only frees the finished jobs, and with
+  // pregen stopped it queues no new batches that nothing would run
+  pregen.active = 0;
+  server_complete_jobs();
+  free(clients);
+  clients = NULL;
+  client_capacity = 0;
+  free(nearby);
+  nearby = NULL;
+  nearby_capacity = 0;
+  free(by_id);
+  by_id = NULL;
+  by_id_size = 0;
+  for (int i = 0; i < world_count; i++) {
+    world_chunk_free(&world_cache[i].world);
+  }
+  world_count = 0;
+  generator_destroy(generator);
+  generator = NULL;
+  mtx_destroy(&job_mtx);
+  cnd_destroy(&job_cnd);
+  mtx_destroy(&done_mtx);
+  server_db_close();
+  curl_global_cleanup();
+}
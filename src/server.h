@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _server_h_
+#define _server_h_
+
+#include "protocol.h"
+
+#define SERVER_DEFAULT_HOST "0.0.0.0"
+#define SERVER_DB_PATH "craft.db"
+#define SERVER_LOG_PATH "log.txt"
+#define SERVER_WORLD_CACHE_SIZE 64
+#define SERVER_MAX_NICK_LENGTH 32
+#define SERVER_MAX_LINE_LENGTH 4096
+#define SERVER_MAX_OUTPUT 67108864
+
+/*
+ * A growable byte buffer, used for both the unparsed input and the
+ * pending output of a connected client.
+ */
+typedef struct {
+  int size;
+  int capacity;
+  char *data;
+} ServerBuffer;
+
+void server_buffer_alloc(ServerBuffer *buffer, int capacity);
+void server_buffer_free(ServerBuffer *buffer);
+void server_buffer_append(ServerBuffer *buffer, const char *data, int length);
+void server_buffer_printf(ServerBuffer *buffer, const char *format, ...);
+void server_buffer_consume(ServerBuffer *buffer, int length);
+
+/*
+ * What one client was last told about another: whether it knows about
+ * the player at all, and the position its "M" deltas are relative to.
+ * `dirty` is set when the player moved but the update was held back
+ * because the observer is far away.
+ */
+typedef struct {
+  int visible;
+  int dirty;
+  int updates;
+  int state[POSITION_FIELDS];
+  double last_sent;
+} ServerView;
+
+/*
+ * A connected player, as seen by the server.  The transport (sockets,
+ * or anything else that can move lines of text) owns the connection and
+ * drains `output`; the model only ever appends to it.
+ *
+ * Each client also sits in a spatial grid keyed by the chunk it is in,
+ * and only hears about blocks and players within its view radius.
+ * `views` is indexed by the id of the other player.  `received` is the
+ * last position the client itself sent, the base for its "M" deltas.
+ * The tick fields cover the transport's passes since the client last
+ * asked for /stats, so that several pollers don't reset each other.
+ */
+typedef struct ServerClient {
+  int id;
+  unsigned int serial;
+  int version;
+  int user_id;
+  int local;  // connected through the in-process loopback transport
+  int closed;
+  char nick[SERVER_MAX_NICK_LENGTH];
+  float x;
+  float y;
+  float z;
+  float rx;
+  float ry;
+  int p;
+  int q;
+  int radius;
+  int cell_p;
+  int cell_q;
+  int in_grid;
+  struct ServerClient *grid_next;
+  ServerView *views;
+  int view_count;
+  int received[POSITION_FIELDS];
+  ServerBuffer input;
+  ServerBuffer output;
+  void *transport;
+  int tick_count;
+  double tick_total;
+  double tick_max;
+} ServerClient;
+
+typedef struct {
+  const char *db_path;
+  const char *auth_url;
+  const char *operators;  // users who may run /pregen, comma separated
+  int workers;
+  int day_length;
+  // a registered name or a plugin's path, with the seed; without either
+  // the world's own, as stored when it was made
+  const char *generator;
+  int seed;
+  int use_seed;
+  void (*notify)(void *arg);
+  void *notify_arg;
+} ServerConfig;
+
+int server_init(const ServerConfig *config);
+void server_shutdown();
+ServerClient *server_connect(const char *address, void *transport);
+void server_disconnect(ServerClient *client);
+void server_receive(ServerClient *client, const char *data, int length);
+void server_complete_jobs();
+void server_tick();
+void server_tick_time(double seconds);
+int server_client_count();
+ServerClient *server_client(int index);
+
+#endif
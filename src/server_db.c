@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "server.h"
+#include "sqlite3.h"
+#include "terrain.h"
+
+#include "server_db.h"
+#include <string.h>
+
+static sqlite3 *db;
+static sqlite3_stmt *get_block_stmt;
+static sqlite3_stmt *insert_block_stmt;
+static sqlite3_stmt *insert_light_stmt;
+static sqlite3_stmt *clear_lights_stmt;
+static sqlite3_stmt *insert_sign_stmt;
+static sqlite3_stmt *delete_sign_stmt;
+static sqlite3_stmt *delete_signs_stmt;
+static TerrainStore terrain;
+static int pending = 0;
+
+static const char *const load_blocks_query =
+    "select rowid, x, y, z, w from block "
+    "where p = ? and q = ? and rowid > ?;";
+static const char *const load_lights_query =
+    "select x, y, z, w from light where p = ? and q = ?;";
+static const char *const load_signs_query =
+    "select x, y, z, face, text from sign where p = ? and q = ?;";
+
+int server_db_init(const char *path) {
+  static const char *const create_query = WORLD_SCHEMA;
+  static const char *const get_block_query =
+      "select w from block where p = ? and q = ? and x = ? and y = ? and "
+      "z = ?;";
+  static const char *const insert_block_query =
+      "insert or replace into block (p, q, x, y, z, w) "
+      "values (?, ?, ?, ?, ?, ?);";
+  static const char *const insert_light_query =
+      "insert or replace into light (p, q, x, y, z, w) "
+      "values (?, ?, ?, ?, ?, ?);";
+  static const char *const clear_lights_query =
+      "update light set w = 0 where x = ? and y = ? and z = ?;";
+  static const char *const insert_sign_query =
+      "insert or replace into sign (p, q, x, y, z, face, text) "
+      "values (?, ?, ?, ?, ?, ?, ?);";
+  static const char *const delete_sign_query =
+      "delete from sign where x = ? and y = ? and z = ? and face = ?;";
+  static const char *const delete_signs_query =
+      "delete from sign where x = ? and y = ? and z = ?;";
+  int rc;
+  rc = sqlite3_open(path, &db);
+  if (rc) return rc;
+  sqlite3_busy_timeout(db, 1000);
+  // readers on the worker threads must not block the writer
+  rc = sqlite3_exec(db, "pragma journal_mode = wal;", NULL, NULL, NULL);
+  if (rc) return rc;
+  rc = sqlite3_exec(db, create_query, NULL, NULL, NULL);
+  if (rc) return rc;
+  rc = sqlite3_prepare_v2(db, get_block_query, -1, &get_block_stmt, NULL);
+  if (rc) return rc;
+  rc = sqlite3_prepare_v2(db, insert_block_query, -1, &insert_block_stmt, NULL);
+  if (rc) return rc;
+  rc = sqlite3_prepare_v2(db, insert_light_query, -1, &insert_light_stmt, NULL);
+  if (rc) return rc;
+  rc = sqlite3_prepare_v2(db, clear_lights_query, -1, &clear_lights_stmt, NULL);
+  if (rc) return rc;
+  rc = sqlite3_prepare_v2(db, insert_sign_query, -1, &insert_sign_stmt, NULL);
+  if (rc) return rc;
+  rc = sqlite3_prepare_v2(db, delete_sign_query, -1, &delete_sign_stmt, NULL);
+  if (rc) return rc;
+  rc = sqlite3_prepare_v2(db, delete_signs_query, -1, &delete_signs_stmt, NULL);
+  if (rc) return rc;
+  rc = terrain_open(&terrain, db);
+  if (rc) return rc;
+  sqlite3_exec(db, "begin;", NULL, NULL, NULL);
+  pending = 0;
+  return 0;
+}
+
+void server_db_close() {
+  sqlite3_exec(db, "commit;", NULL, NULL, NULL);
+  sqlite3_finalize(get_block_stmt);
+  sqlite3_finalize(insert_block_stmt);
+  sqlite3_finalize(insert_light_stmt);
+  sqlite3_finalize(clear_lights_stmt);
+  sqlite3_finalize(insert_sign_stmt);
+  sqlite3_finalize(delete_sign_stmt);
+  sqlite3_finalize(delete_signs_stmt);
+  terrain_close(&terrain);
+  sqlite3_close(db);
+}
+
+/*
+ * Make every write so far visible to the reader connections.
+ */
+void server_db_commit() {
+  if (!pending) {
+    return;
+  }
+  sqlite3_exec(db, "commit; begin;", NULL, NULL, NULL);
+  pending = 0;
+}
+
+int server_db_pending() { return pending; }
+
+int server_db_get_block(int p, int q, int x, int y, int z, int *w) {
+  int result = 0;
+  sqlite3_reset(get_block_stmt);
+  sqlite3_bind_int(get_block_stmt, 1, p);
+  sqlite3_bind_int(get_block_stmt, 2, q);
+  sqlite3_bind_int(get_block_stmt, 3, x);
+  sqlite3_bind_int(get_block_stmt, 4, y);
+  sqlite3_bind_int(get_block_stmt, 5, z);
+  if (sqlite3_step(get_block_stmt) == SQLITE_ROW) {
+    *w = sqlite3_column_int(get_block_stmt, 0);
+    result = 1;
+  }
+  return result;
+}
+
+void server_db_insert_block(int p, int q, int x, int y, int z, int w) {
+  sqlite3_reset(insert_block_stmt);
+  sqlite3_bind_int(insert_block_stmt, 1, p);
+  sqlite3_bind_int(insert_block_stmt, 2, q);
+  sqlite3_bind_int(insert_block_stmt, 3, x);
+  sqlite3_bind_int(insert_block_stmt, 4, y);
+  sqlite3_bind_int(insert_block_stmt, 5, z);
+  sqlite3_bind_int(insert_block_stmt, 6, w);
+  sqlite3_step(insert_block_stmt);
+  pending = 1;
+}
+
+int server_db_load_terrain(const char *world, int p, int q,
+                           WorldChunk *chunk) {
+  return terrain_load(&terrain, world, p, q, chunk);
+}
+
+int server_db_terrain_exists(const char *world, int p, int q) {
+  return terrain_exists(&terrain, world, p, q);
+}
+
+void server_db_save_terrain(const char *world, int p, int q, const char *data,
+                            int length) {
+  terrain_save(&terrain, world, p, q, data, length);
+  pending = 1;
+}
+
+void server_db_insert_light(int p, int q, int x, int y, int z, int w) {
+  sqlite3_reset(insert_light_stmt);
+  sqlite3_bind_int(insert_light_stmt, 1, p);
+  sqlite3_bind_int(insert_light_stmt, 2, q);
+  sqlite3_bind_int(insert_light_stmt, 3, x);
+  sqlite3_bind_int(insert_light_stmt, 4, y);
+  sqlite3_bind_int(insert_light_stmt, 5, z);
+  sqlite3_bind_int(insert_light_stmt, 6, w);
+  sqlite3_step(insert_light_stmt);
+  pending = 1;
+}
+
+void server_db_clear_lights(int x, int y, int z) {
+  sqlite3_reset(clear_lights_stmt);
+  sqlite3_bind_int(clear_lights_stmt, 1, x);
+  sqlite3_bind_int(clear_lights_stmt, 2, y);
+  sqlite3_bind_int(clear_lights_stmt, 3, z);
+  sqlite3_step(clear_lights_stmt);
+  pending = 1;
+}
+
+void server_db_insert_sign(int p, int q, int x, int y, int z, int face,
+                           const char *text) {
+  sqlite3_reset(insert_sign_stmt);
+  sqlite3_bind_int(insert_sign_stmt, 1, p);
+  sqlite3_bind_int(insert_sign_stmt, 2, q);
+  sqlite3_bind_int(insert_sign_stmt, 3, x);
+  sqlite3_bind_int(insert_sign_stmt, 4, y);
+  sqlite3_bind_int(insert_sign_stmt, 5, z);
+  sqlite3_bind_int(insert_sign_stmt, 6, face);
+  sqlite3_bind_text(insert_sign_stmt, 7, text, -1, NULL);
+  sqlite3_step(insert_sign_stmt);
+  pending = 1;
+}
+
+void server_db_delete_sign(int x, int y, int z, int face) {
+  sqlite3_reset(delete_sign_stmt);
+  sqlite3_bind_int(delete_sign_stmt, 1, x);
+  sqlite3_bind_int(delete_sign_stmt, 2, y);
+  sqlite3_bind_int(delete_sign_stmt, 3, z);
+  sqlite3_bind_int(delete_sign_stmt, 4, face);
+  sqlite3_step(delete_sign_stmt);
+  pending = 1;
+}
+
+void server_db_delete_signs(int x, int y, int z) {
+  sqlite3_reset(delete_signs_stmt);
+  sqlite3_bind_int(delete_signs_stmt, 1, x);
+  sqlite3_bind_int(delete_signs_stmt, 2, y);
+  sqlite3_bind_int(delete_signs_stmt, 3, z);
+  sqlite3_step(delete_signs_stmt);
+  pending = 1;
+}
+
+/*
+ * The generator the world was made with, by name or plugin path, and its
+ * seed, so that the server does not have to be told again.
+ */
+void server_db_save_generator(const char *name, int use_seed, int seed) {
+  static const char *const query =
+      "insert into generator (name, use_seed, seed) values (?, ?, ?);";
+  sqlite3_stmt *stmt;
+  sqlite3_exec(db, "delete from generator;", NULL, NULL, NULL);
+  sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+  sqlite3_bind_text(stmt, 1, name, -1, NULL);
+  sqlite3_bind_int(stmt, 2, use_seed);
+  sqlite3_bind_int(stmt, 3, seed);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  pending = 1;
+}
+
+int server_db_load_generator(char *name, int length, int *use_seed,
+                             int *seed) {
+  static const char *const query =
+      "select name, use_seed, seed from generator;";
+  int result = 0;
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    const char *a = (const char *)sqlite3_column_text(stmt, 0);
+    strncpy(name, a, length - 1);
+    name[length - 1] = '\0';
+    *use_seed = sqlite3_column_int(stmt, 1);
+    *seed = sqlite3_column_int(stmt, 2);
+    result = 1;
+  }
+  sqlite3_finalize(stmt);
+  return result;
+}
+
+int server_db_reader_open(ServerDbReader *reader, const char *path) {
+  int rc;
+  rc = sqlite3_open_v2(path, &reader->db, SQLITE_OPEN_READONLY, NULL);
+  if (rc) return rc;
+  sqlite3_busy_timeout(reader->db, 1000);
+  rc = sqlite3_prepare_v2(reader->db, load_blocks_query, -1,
+                          &reader->load_blocks_stmt, NULL);
+  if (rc) return rc;
+  rc = sqlite3_prepare_v2(reader->db, load_lights_query, -1,
+                          &reader->load_lights_stmt, NULL);
+  if (rc) return rc;
+  rc = sqlite3_prepare_v2(reader->db, load_signs_query, -1,
+                          &reader->load_signs_stmt, NULL);
+  if (rc) return rc;
+  return 0;
+}
+
+void server_db_reader_close(ServerDbReader *reader) {
+  sqlite3_finalize(reader->load_blocks_stmt);
+  sqlite3_finalize(reader->load_lights_stmt);
+  sqlite3_finalize(reader->load_signs_stmt);
+  sqlite3_close(reader->db);
+}
+
+/*
+ * Append the reply to a "C,p,q,key" request: every block changed since
+ * `key`, all lights and signs, then the new key, a redraw and the chunk
+ * terminator.  This is the same packet sequence that server.py sends.
+ */
+void server_db_reader_chunk(ServerDbReader *reader, ServerBuffer *buffer,
+                            int p, int q, int key) {
+  sqlite3_stmt *stmt;
+  int blocks = 0, lights = 0, signs = 0, max_rowid = 0;
+  stmt = reader->load_blocks_stmt;
+  sqlite3_reset(stmt);
+  sqlite3_bind_int(stmt, 1, p);
+  sqlite3_bind_int(stmt, 2, q);
+  sqlite3_bind_int(stmt, 3, key);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    int rowid = sqlite3_column_int(stmt, 0);
+    server_buffer_printf(buffer, "B,%d,%d,%d,%d,%d,%d\n", p, q,
+                         sqlite3_column_int(stmt, 1),
+                         sqlite3_column_int(stmt, 2),
+                         sqlite3_column_int(stmt, 3),
+                         sqlite3_column_int(stmt, 4));
+    max_rowid = rowid > max_rowid ? rowid : max_rowid;
+    blocks++;
+  }
+  stmt = reader->load_lights_stmt;
+  sqlite3_reset(stmt);
+  sqlite3_bind_int(stmt, 1, p);
+  sqlite3_bind_int(stmt, 2, q);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    server_buffer_printf(buffer, "L,%d,%d,%d,%d,%d,%d\n", p, q,
+                         sqlite3_column_int(stmt, 0),
+                         sqlite3_column_int(stmt, 1),
+                         sqlite3_column_int(stmt, 2),
+                         sqlite3_column_int(stmt, 3));
+    lights++;
+  }
+  stmt = reader->load_signs_stmt;
+  sqlite3_reset(stmt);
+  sqlite3_bind_int(stmt, 1, p);
+  sqlite3_bind_int(stmt, 2, q);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    server_buffer_printf(buffer, "S,%d,%d,%d,%d,%d,%d,%s\n", p, q,
+                         sqlite3_column_int(stmt, 0),
+                         sqlite3_column_int(stmt, 1),
+                         sqlite3_column_int(stmt, 2),
+                         sqlite3_column_int(stmt, 3),
+                         (const char *)sqlite3_column_text(stmt, 4));
+    signs++;
+  }
+  if (blocks) {
+    server_buffer_printf(buffer, "K,%d,%d,%d\n", p, q, max_rowid);
+  }
+  if (blocks || lights || signs) {
+    server_buffer_printf(buffer, "R,%d,%d\n", p, q);
+  }
+  server_buffer_printf(buffer, "C,%d,%d\n", p, q);
+}
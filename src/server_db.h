@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _server_db_h_
+#define _server_db_h_
+
+/*
+ * Storage for craft-server.  The main thread owns the one writable
+ * connection; chunk queries run on worker threads, each with its own
+ * read-only ServerDbReader.  The database uses the same block, light
+ * and sign tables as server.py, so the two servers can share a file.
+ */
+
+typedef struct {
+  sqlite3 *db;
+  sqlite3_stmt *load_blocks_stmt;
+  sqlite3_stmt *load_lights_stmt;
+  sqlite3_stmt *load_signs_stmt;
+} ServerDbReader;
+
+int server_db_init(const char *path);
+void server_db_close();
+void server_db_commit();
+int server_db_pending();
+int server_db_get_block(int p, int q, int x, int y, int z, int *w);
+void server_db_insert_block(int p, int q, int x, int y, int z, int w);
+int server_db_load_terrain(const char *world, int p, int q,
+                           WorldChunk *chunk);
+int server_db_terrain_exists(const char *world, int p, int q);
+void server_db_save_terrain(const char *world, int p, int q, const char *data,
+                            int length);
+void server_db_insert_light(int p, int q, int x, int y, int z, int w);
+void server_db_clear_lights(int x, int y, int z);
+void server_db_insert_sign(int p, int q, int x, int y, int z, int face,
+                           const char *text);
+void server_db_delete_sign(int x, int y, int z, int face);
+void server_db_delete_signs(int x, int y, int z);
+void server_db_save_generator(const char *name, int use_seed, int seed);
+int server_db_load_generator(char *name, int length, int *use_seed,
+                             int *seed);
+
+int server_db_reader_open(ServerDbReader *reader, const char *path);
+void server_db_reader_close(ServerDbReader *reader);
+void server_db_reader_chunk(ServerDbReader *reader, ServerBuffer *buffer,
+                            int p, int q, int key);
+
+#endif
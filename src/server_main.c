@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * craft-server: a native replacement for server.py.  This file is only
+ * the transport, an epoll loop over non-blocking sockets; the game
+ * itself lives in server.c.
+ */
+
+#include "server.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_PORT "4080"
+#define DEFAULT_WORKERS 4
+#define DEFAULT_DAY_LENGTH 600
+#define MAX_EVENTS 64
+#define RECV_SIZE 4096
+#define TICK_MILLISECONDS 50
+
+typedef struct {
+  int fd;
+  int writing;
+  ServerClient *client;
+} Connection;
+
+static int epoll_fd;
+static int wake_fd;
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(int signal) { stopping = 1; }
+
+static void notify(void *arg) {
+  uint64_t one = 1;
+  if (write(wake_fd, &one, sizeof(one)) < 0) {
+    // the counter is already non-zero, the loop will wake anyway
+  }
+}
+
+static int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int listen_on(const char *host, const char *port) {
+  struct addrinfo hints, *result, *info;
+  int fd = -1;
+  int one = 1;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  if (getaddrinfo(host, port, &hints, &result)) {
+    return -1;
+  }
+  for (info = result; info; info = info->ai_next) {
+    fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, info->ai_addr, info->ai_addrlen) == 0 &&
+        listen(fd, SOMAXCONN) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  if (fd >= 0) {
+    set_nonblocking(fd);
+  }
+  return fd;
+}
+
+static void close_connection(Connection *connection) {
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+  close(connection->fd);
+  server_disconnect(connection->client);
+  free(connection);
+}
+
+/*
+ * Write as much of the pending output as the socket takes, and only ask
+ * for EPOLLOUT while something is left over.
+ */
+static void flush_connection(Connection *connection) {
+  ServerBuffer *output = &connection->client->output;
+  while (output->size) {
+    ssize_t sent = send(connection->fd, output->data, output->size,
+                        MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        connection->client->closed = 1;
+      }
+      break;
+    }
+    server_buffer_consume(output, sent);
+  }
+  int writing = output->size > 0;
+  if (writing != connection->writing) {
+    struct epoll_event event;
+    event.events = EPOLLIN | (writing ? EPOLLOUT : 0);
+    event.data.ptr = connection;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+    connection->writing = writing;
+  }
+}
+
+static void accept_connections(int listen_fd) {
+  while (1) {
+    struct sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    int fd = accept(listen_fd, (struct sockaddr *)&address, &length);
+    if (fd < 0) {
+      break;
+    }
+    char host[NI_MAXHOST] = "?";
+    char port[NI_MAXSERV] = "?";
+    char name[NI_MAXHOST + NI_MAXSERV + 1];
+    getnameinfo((struct sockaddr *)&address, length, host, sizeof(host), port,
+                sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV);
+    snprintf(name, sizeof(name), "%s %s", host, port);
+    set_nonblocking(fd);
+    Connection *connection = calloc(1, sizeof(Connection));
+    connection->fd = fd;
+    connection->client = server_connect(name, connection);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = connection;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+  }
+}
+
+static void read_connection(Connection *connection) {
+  char data[RECV_SIZE];
+  while (!connection->client->closed) {
+    ssize_t length = recv(connection->fd, data, sizeof(data), 0);
+    if (length > 0) {
+      server_receive(connection->client, data, length);
+    } else if (length == 0) {
+      connection->client->closed = 1;
+    } else if (errno == EINTR) {
+      continue;
+    } else {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        connection->client->closed = 1;
+      }
+      break;
+    }
+  }
+}
+
+/*
+ * After every batch of events: drop the clients that the model or the
+ * network gave up on, then send what the model queued for the rest.
+ * Dropping first lets their disconnect notices go out in the same pass.
+ */
+static void flush_all() {
+  for (int i = server_client_count() - 1; i >= 0; i--) {
+    ServerClient *client = server_client(i);
+    if (client->closed) {
+      close_connection(client->transport);
+    }
+  }
+  for (int i = 0; i < server_client_count(); i++) {
+    flush_connection(server_client(i)->transport);
+  }
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-d DB] [-w WORKERS] [-a AUTH_URL] [-o OPERATORS] "
+          "[-g GENERATOR] [-s SEED] [-t DAY_LENGTH] [HOST [PORT]]\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  ServerConfig config;
+  memset(&config, 0, sizeof(config));
+  config.db_path = SERVER_DB_PATH;
+  config.workers = DEFAULT_WORKERS;
+  config.day_length = DEFAULT_DAY_LENGTH;
+  config.notify = notify;
+  const char *host = SERVER_DEFAULT_HOST;
+  const char *port = DEFAULT_PORT;
+  int option;
+  while ((option = getopt(argc, argv, "d:w:a:o:g:s:t:h")) != -1) {
+    switch (option) {
+      case 'd':
+        config.db_path = optarg;
+        break;
+      case 'w':
+        config.workers = atoi(optarg);
+        break;
+      case 'a':
+        config.auth_url = optarg;
+        break;
+      case 'o':
+        config.operators = optarg;
+        break;
+      case 'g':
+        config.generator = optarg;
+        break;
+      case 's':
+        config.seed = atoi(optarg);
+        config.use_seed = 1;
+        break;
+      case 't':
+        config.day_length = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind < argc) {
+    host = argv[optind++];
+  }
+  if (optind < argc) {
+    port = argv[optind++];
+  }
+  int listen_fd = listen_on(host, port);
+  if (listen_fd < 0) {
+    fprintf(stderr, "could not listen on %s:%s\n", host, port);
+    return 1;
+  }
+  epoll_fd = epoll_create1(0);
+  wake_fd = eventfd(0, EFD_NONBLOCK);
+  if (server_init(&config)) {
+    return 1;
+  }
+  printf("SERV %s %s\n", host, port);
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  signal(SIGPIPE, SIG_IGN);
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = &listen_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+  event.data.ptr = &wake_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+  struct epoll_event events[MAX_EVENTS];
+  while (!stopping) {
+    int count = epoll_wait(epoll_fd, events, MAX_EVENTS, TICK_MILLISECONDS);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i++) {
+      void *ptr = events[i].data.ptr;
+      if (ptr == &listen_fd) {
+        accept_connections(listen_fd);
+      } else if (ptr == &wake_fd) {
+        uint64_t value;
+        if (read(wake_fd, &value, sizeof(value)) < 0) {
+          // spurious wakeup
+        }
+      } else {
+        Connection *connection = ptr;
+        if (events[i].events & EPOLLIN) {
+          read_connection(connection);
+        }
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+          connection->client->closed = 1;
+        }
+      }
+    }
+    server_complete_jobs();
+    server_tick();
+    flush_all();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    server_tick_time((end.tv_sec - start.tv_sec) +
+                     (end.tv_nsec - start.tv_nsec) / 1e9);
+  }
+  // close the sockets ourselves; server_shutdown only frees the clients
+  while (server_client_count()) {
+    close_connection(server_client(0)->transport);
+  }
+  server_shutdown();
+  close(listen_fd);
+  close(wake_fd);
+  close(epoll_fd);
+  return 0;
+}
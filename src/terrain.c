@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "terrain.h"
+#include "generator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HEADER_SIZE 3
+
+void terrain_world(char *world, const char *generator, int use_seed,
+                   unsigned int seed) {
+  char key[16];
+  if (use_seed) {
+    snprintf(key, sizeof(key), "%u", seed);
+  } else {
+    snprintf(key, sizeof(key), "%s", TERRAIN_DEFAULT_WORLD);
+  }
+  if (strcmp(generator, GENERATOR_DEFAULT) == 0) {
+    snprintf(world, MAX_TERRAIN_WORLD_LENGTH, "%s", key);
+  } else {
+    snprintf(world, MAX_TERRAIN_WORLD_LENGTH, "%s:%s", generator, key);
+  }
+}
+
+/*
+ * The version, top, every column's height (two bytes, little endian)
+ * and biome, then each column of the volume as runs of (length, block).
+ * Returns a malloc'd buffer.
+ */
+char *terrain_encode(const WorldChunk *chunk, int *length) {
+  const int columns = WORLD_ROW * WORLD_ROW;
+  // worst case: one run per block
+  char *data = malloc(HEADER_SIZE + columns * 3 + columns * chunk->top * 2);
+  unsigned char *out = (unsigned char *)data;
+  *out++ = TERRAIN_VERSION;
+  *out++ = chunk->top & 0xff;
+  *out++ = chunk->top >> 8;
+  for (int i = 0; i < columns; i++) {
+    *out++ = chunk->height[i] & 0xff;
+    *out++ = chunk->height[i] >> 8;
+  }
+  memcpy(out, chunk->biome, columns);
+  out += columns;
+  for (int i = 0; i < columns; i++) {
+    const char *column = chunk->blocks + i * chunk->top;
+    int y = 0;
+    while (y < chunk->top) {
+      int run = 1;
+      while (y + run < chunk->top && run < 255 &&
+             column[y + run] == column[y]) {
+        run++;
+      }
+      *out++ = run;
+      *out++ = column[y];
+      y += run;
+    }
+  }
+  *length = (char *)out - data;
+  return data;
+}
+
+/*
+ * Returns 0 on success, or -1 if the data is from another version or
+ * malformed.
+ */
+int terrain_decode(WorldChunk *chunk, int p, int q, const char *data,
+                   int length) {
+  const int columns = WORLD_ROW * WORLD_ROW;
+  const unsigned char *in = (const unsigned char *)data;
+  const unsigned char *end = in + length;
+  if (length < HEADER_SIZE + columns * 3 || in[0] != TERRAIN_VERSION) {
+    return -1;
+  }
+  const int top = in[1] | in[2] << 8;
+  in += HEADER_SIZE;
+  const int size = columns * top;
+  if (chunk->capacity < size) {
+    free(chunk->blocks);
+    chunk->blocks = malloc(size);
+    chunk->capacity = size;
+  }
+  chunk->p = p;
+  chunk->q = q;
+  chunk->top = top;
+  for (int i = 0; i < columns; i++) {
+    chunk->height[i] = in[0] | in[1] << 8;
+    in += 2;
+  }
+  memcpy(chunk->biome, in, columns);
+  in += columns;
+  int count = 0;
+  for (int i = 0; i < columns; i++) {
+    char *column = chunk->blocks + i * top;
+    int y = 0;
+    while (y < top) {
+      if (in + 2 > end || y + in[0] > top || in[0] == 0) {
+        return -1;
+      }
+      memset(column + y, (char)in[1], in[0]);
+      if (in[1]) {
+        count += in[0];
+      }
+      y += in[0];
+      in += 2;
+    }
+  }
+  chunk->count = count;
+  return 0;
+}
+
+int terrain_open(TerrainStore *store, sqlite3 *db) {
+  static const char *const create_query =
+      "create table if not exists terrain ("
+      "    world text not null,"
+      "    p int not null,"
+      "    q int not null,"
+      "    data blob not null"
+      ");"
+      "create unique index if not exists terrain_worldpq_idx on terrain "
+      "(world, p, q);";
+  static const char *const load_query =
+      "select data from terrain where world = ? and p = ? and q = ?;";
+  static const char *const save_query =
+      "insert or replace into terrain (world, p, q, data) "
+      "values (?, ?, ?, ?);";
+  static const char *const exists_query =
+      "select substr(data, 1, 1) from terrain "
+      "where world = ? and p = ? and q = ?;";
+  int rc;
+  memset(store, 0, sizeof(TerrainStore));
+  store->db = db;
+  rc = sqlite3_exec(db, create_query, NULL, NULL, NULL);
+  if (rc) return rc;
+  rc = sqlite3_prepare_v2(db, load_query, -1, &store->load_stmt, NULL);
+  if (rc) return rc;
+  rc = sqlite3_prepare_v2(db, save_query, -1, &store->save_stmt, NULL);
+  if (rc) return rc;
+  rc = sqlite3_prepare_v2(db, exists_query, -1, &store->exists_stmt, NULL);
+  if (rc) return rc;
+  return 0;
+}
+
+void terrain_close(TerrainStore *store) {
+  sqlite3_finalize(store->load_stmt);
+  sqlite3_finalize(store->save_stmt);
+  sqlite3_finalize(store->exists_stmt);
+}
+
+static void _bind_key(sqlite3_stmt *stmt, const char *world, int p, int q) {
+  sqlite3_reset(stmt);
+  sqlite3_bind_text(stmt, 1, world, -1, NULL);
+  sqlite3_bind_int(stmt, 2, p);
+  sqlite3_bind_int(stmt, 3, q);
+}
+
+/*
+ * Returns 1 if chunk (p, q) of `world` was stored and has been decoded
+ * into `chunk`, 0 if it has to be generated.
+ */
+int terrain_load(TerrainStore *store, const char *world, int p, int q,
+                 WorldChunk *chunk) {
+  int result = 0;
+  _bind_key(store->load_stmt, world, p, q);
+  if (sqlite3_step(store->load_stmt) == SQLITE_ROW) {
+    const char *data = sqlite3_column_blob(store->load_stmt, 0);
+    const int length = sqlite3_column_bytes(store->load_stmt, 0);
+    result = !terrain_decode(chunk, p, q, data, length);
+  }
+  sqlite3_reset(store->load_stmt);
+  return result;
+}
+
+// whether chunk (p, q) of `world` is stored in the current version
+int terrain_exists(TerrainStore *store, const char *world, int p, int q) {
+  int result = 0;
+  _bind_key(store->exists_stmt, world, p, q);
+  if (sqlite3_step(store->exists_stmt) == SQLITE_ROW &&
+      sqlite3_column_bytes(store->exists_stmt, 0) == 1) {
+    const char *version = sqlite3_column_blob(store->exists_stmt, 0);
+    result = version[0] == TERRAIN_VERSION;
+  }
+  sqlite3_reset(store->exists_stmt);
+  return result;
+}
+
+int terrain_save(TerrainStore *store, const char *world, int p, int q,
+                 const char *data, int length) {
+  _bind_key(store->save_stmt, world, p, q);
+  sqlite3_bind_blob(store->save_stmt, 4, data, length, NULL);
+  const int rc = sqlite3_step(store->save_stmt);
+  sqlite3_reset(store->save_stmt);
+  return rc == SQLITE_DONE ? 0 : rc;
+}
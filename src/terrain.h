@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2013 Michael Fogleman
+ *               2020 William Emerison Six
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _terrain_h_
+#define _terrain_h_
+
+#include "sqlite3.h"
+#include "world.h"
+
+#define TERRAIN_VERSION 3
+#define TERRAIN_DEFAULT_WORLD ""
+#define MAX_TERRAIN_WORLD_LENGTH 48
+
+/*
+ * The tables every world database has: its blocks, lights and signs, and
+ * the generator its terrain comes from, a single row.  Shared by the
+ * client's db.c and craft-server's server_db.c so that either can open a
+ * file written by the other.
+ */
+#define WORLD_SCHEMA                                                           \
+  "create table if not exists block ("                                         \
+  "    p int not null,"                                                        \
+  "    q int not null,"                                                        \
+  "    x int not null,"                                                        \
+  "    y int not null,"                                                        \
+  "    z int not null,"                                                        \
+  "    w int not null"                                                         \
+  ");"                                                                         \
+  "create table if not exists light ("                                         \
+  "    p int not null,"                                                        \
+  "    q int not null,"                                                        \
+  "    x int not null,"                                                        \
+  "    y int not null,"                                                        \
+  "    z int not null,"                                                        \
+  "    w int not null"                                                         \
+  ");"                                                                         \
+  "create table if not exists sign ("                                          \
+  "    p int not null,"                                                        \
+  "    q int not null,"                                                        \
+  "    x int not null,"                                                        \
+  "    y int not null,"                                                        \
+  "    z int not null,"                                                        \
+  "    face int not null,"                                                     \
+  "    text text not null"                                                     \
+  ");"                                                                         \
+  "create unique index if not exists block_pqxyz_idx on block (p, q, x, "      \
+  "y, z);"                                                                     \
+  "create unique index if not exists light_pqxyz_idx on light (p, q, x, "      \
+  "y, z);"                                                                     \
+  "create unique index if not exists sign_xyzface_idx on sign (x, y, z, "      \
+  "face);"                                                                     \
+  "create index if not exists sign_pq_idx on sign (p, q);"                     \
+  "create table if not exists generator ("                                     \
+  "    name text not null,"                                                    \
+  "    use_seed int not null,"                                                 \
+  "    seed int not null"                                                      \
+  ");"
+
+/*
+ * Generated chunks stored in the "terrain" table, so that a world can be
+ * generated ahead of time with craft-pregen and loaded instead of
+ * generated again.  Rows are keyed by world, which is "" for the
+ * built-in noise table and the decimal seed otherwise, prefixed with the
+ * generator's name and a ':' for any generator but the default one, and
+ * by (p, q).
+ * The chunk is stored run-length encoded; rows from another
+ * TERRAIN_VERSION are ignored.
+ */
+typedef struct {
+  sqlite3 *db;
+  sqlite3_stmt *load_stmt;
+  sqlite3_stmt *save_stmt;
+  sqlite3_stmt *exists_stmt;
+} TerrainStore;
+
+void terrain_world(char *world, const char *generator, int use_seed,
+                   unsigned int seed);
+char *terrain_encode(const WorldChunk *chunk, int *length);
+int terrain_decode(WorldChunk *chunk, int p, int q, const char *data,
+                   int length);
+
+int terrain_open(TerrainStore *store, sqlite3 *db);
+void terrain_close(TerrainStore *store);
+int terrain_load(TerrainStore *store, const char *world, int p, int q,
+                 WorldChunk *chunk);
+int terrain_exists(TerrainStore *store, const char *world, int p, int q);
+int terrain_save(TerrainStore *store, const char *world, int p, int q,
+                 const char *data, int length);
+
+#endif
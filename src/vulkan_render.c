@@ -66,6 +66,9 @@ uint32_t vulkan_gen_buffer(size_t size, const float *const data) { return 0; }
 
 void vulkan_del_buffer(uint32_t buffer) {}
 
+void vulkan_update_buffer(uint32_t buffer, size_t size,
+                          const float *const data) {}
+
 uint32_t vulkan_gen_faces(int components, int faces, float *data) { return 0; }
 
 uint32_t vulkan_make_shader(uint32_t type, const char *source) { return 0; }
@@ -88,7 +91,13 @@ void vulkan_setup_render_chunks(
     const float *const matrix,
     const PositionAndOrientation *const positionAndOrientation, float light) {}
 
-void vulkan_render_chunk(const Chunk *const chunk) {}
+void vulkan_render_section(const Section *const section) {}
+
+void vulkan_setup_render_cutout() {}
+
+void vulkan_render_section_cutout(const Section *const section) {}
+
+void vulkan_render_clouds(const Chunk *const chunk) {}
 
 void vulkan_draw_triangles_3d_text(uint32_t buffer, int count) {}
 
@@ -101,9 +110,10 @@ void vulkan_render_sign(const float *const matrix, int x, int y, int z,
 
 void vulkan_setup_render_players(
     const float *const matrix,
-    const PositionAndOrientation *const positionAndOrientation) {}
+    const PositionAndOrientation *const positionAndOrientation,
+    float light) {}
 
-void vulkan_render_player(const Player *const other_player) {}
+void vulkan_render_players(uint32_t buffer, uint32_t instances, int count) {}
 
 void vulkan_render_sky(uint32_t buffer, const float *const matrix) {}
 
@@ -112,8 +122,8 @@ void vulkan_draw_lines(uint32_t buffer, int components, int count) {}
 void vulkan_render_wireframe(const float *const matrix, int hx, int hy,
                              int hz) {}
 
-void vulkan_render_text(const float *const matrix, int justify, float x,
-                        float y, float n, const char *const text) {}
+void vulkan_render_text(const float *const matrix, uint32_t buffer,
+                        int length) {}
 
 void vulkan_render_item(const float *const matrix) {}
 
@@ -23,73 +23,490 @@
 #include "world.h"
 #include "config.h"
 #include "noise.h"
+#include "tinycthread.h"
 
-void create_world(int p, int q, world_func func, void *arg) {
-  int pad = 1;
-  for (int dx = -pad; dx < CHUNK_SIZE + pad; dx++) {
-    for (int dz = -pad; dz < CHUNK_SIZE + pad; dz++) {
-      int flag = 1;
-      if (dx < 0 || dz < 0 || dx >= CHUNK_SIZE || dz >= CHUNK_SIZE) {
-        flag = -1;
+#include <stdlib.h>
+#include <string.h>
+
+#define PAD WORLD_PAD
+#define ROW WORLD_ROW
+#define TREE_HEIGHT 8
+#define TREE_RADIUS 3
+#define WORLD_CACHE_SIZE 256
+
+/*
+ * Structures are decided per region, a chunk's worth of columns, from
+ * that region's own heightmap, so every chunk they overlap places them
+ * the same way.  A feature can reach at most CHUNK_SIZE - WORLD_PAD
+ * blocks out of its region, as only the eight neighbours are searched.
+ */
+typedef struct {
+  int p;
+  int q;
+  unsigned int last_used;
+  int count;
+  WorldFeature *features;
+} Region;
+
+struct WorldCache {
+  mtx_t mtx;
+  unsigned int clock;
+  Region regions[WORLD_CACHE_SIZE];
+};
+
+/*
+ * Noise for one row of columns, so that it can be evaluated with the
+ * batch noise functions.
+ */
+typedef struct {
+  float x[ROW];
+  float z[ROW];
+  float terrain[ROW];
+  float height[ROW];
+  float grass[ROW];
+  float flowers[ROW];
+} Row;
+
+static void _evaluate_terrain(const NoiseContext *noise, int x, int z0,
+                              Row *row) {
+  float in[2][ROW];
+  for (int i = 0; i < ROW; i++) {
+    const int z = z0 + i;
+    row->x[i] = x * 0.01;
+    row->z[i] = z * 0.01;
+    in[0][i] = -x * 0.01;
+    in[1][i] = -z * 0.01;
+  }
+  noise_simplex2_batch(noise, row->x, row->z, row->terrain, ROW, 4, 0.5, 2);
+  noise_simplex2_batch(noise, in[0], in[1], row->height, ROW, 2, 0.9, 2);
+}
+
+static void _evaluate_features(const NoiseContext *noise, int x, int z0,
+                               Row *row) {
+  float in[2][ROW];
+  if (SHOW_PLANTS) {
+    // plants in the ring are never seen, so only the chunk's own columns
+    for (int i = PAD; i < PAD + CHUNK_SIZE; i++) {
+      const int z = z0 + i;
+      in[0][i] = -x * 0.1;
+      in[1][i] = z * 0.1;
+    }
+    noise_simplex2_batch(noise, in[0] + PAD, in[1] + PAD, row->grass + PAD,
+                         CHUNK_SIZE, 4, 0.8, 2);
+    for (int i = PAD; i < PAD + CHUNK_SIZE; i++) {
+      const int z = z0 + i;
+      in[0][i] = x * 0.05;
+      in[1][i] = -z * 0.05;
+    }
+    noise_simplex2_batch(noise, in[0] + PAD, in[1] + PAD, row->flowers + PAD,
+                         CHUNK_SIZE, 4, 0.8, 2);
+  }
+}
+
+static int _surface(float f, float g, int *biome) {
+  int mh = g * 32 + 16;
+  int h = f * mh;
+  int w = WORLD_BIOME_GRASS;
+  int t = 12;
+  if (h <= t) {
+    h = t;
+    w = WORLD_BIOME_SAND;
+  }
+  *biome = w;
+  return h;
+}
+
+/*
+ * First pass: the surface height and biome of every column.  `top` only
+ * covers the terrain and plants; world_fill raises it for the structures.
+ */
+void world_heightmap(const NoiseContext *noise, int p, int q,
+                     WorldChunk *chunk) {
+  NoiseContext builtin;
+  if (!noise) {
+    noise_default(&builtin);
+    noise = &builtin;
+  }
+  Row row;
+  int highest = 0;
+  chunk->p = p;
+  chunk->q = q;
+  for (int dx = -PAD; dx < CHUNK_SIZE + PAD; dx++) {
+    _evaluate_terrain(noise, p * CHUNK_SIZE + dx, q * CHUNK_SIZE - PAD, &row);
+    for (int dz = -PAD; dz < CHUNK_SIZE + PAD; dz++) {
+      const int i = dz + PAD;
+      int w;
+      int h = _surface(row.terrain[i], row.height[i], &w);
+      chunk->height[WORLD_COLUMN(dx, dz)] = h;
+      chunk->biome[WORLD_COLUMN(dx, dz)] = w;
+      highest = h > highest ? h : highest;
+    }
+  }
+  chunk->top = highest + 1;
+}
+
+/*
+ * The trees rooted in region (p, q).  Uses the heights in `chunk` when it
+ * is that region's chunk; elsewhere only the few columns where the tree
+ * noise is high enough need their surface.
+ */
+static int _find_features(const NoiseContext *noise, int p, int q,
+                          const WorldChunk *chunk, WorldFeature **result) {
+  float in[2][CHUNK_SIZE];
+  float trees[CHUNK_SIZE];
+  int count = 0;
+  int capacity = 0;
+  WorldFeature *features = NULL;
+  const int own = chunk && chunk->p == p && chunk->q == q;
+  for (int dx = 0; dx < CHUNK_SIZE && SHOW_TREES; dx++) {
+    const int x = p * CHUNK_SIZE + dx;
+    const int z0 = q * CHUNK_SIZE;
+    for (int dz = 0; dz < CHUNK_SIZE; dz++) {
+      in[0][dz] = x;
+      in[1][dz] = z0 + dz;
+    }
+    noise_simplex2_batch(noise, in[0], in[1], trees, CHUNK_SIZE, 6, 0.5, 2);
+    for (int dz = 0; dz < CHUNK_SIZE; dz++) {
+      if (trees[dz] <= 0.84) {
+        continue;
       }
-      int x = p * CHUNK_SIZE + dx;
-      int z = q * CHUNK_SIZE + dz;
-      float f = simplex2(x * 0.01, z * 0.01, 4, 0.5, 2);
-      float g = simplex2(-x * 0.01, -z * 0.01, 2, 0.9, 2);
-      int mh = g * 32 + 16;
-      int h = f * mh;
-      int w = 1;
-      int t = 12;
-      if (h <= t) {
-        h = t;
-        w = 2;
+      const int z = z0 + dz;
+      int h, w;
+      if (own) {
+        h = chunk->height[WORLD_COLUMN(dx, dz)];
+        w = chunk->biome[WORLD_COLUMN(dx, dz)];
+      } else {
+        float f = noise_simplex2(noise, x * 0.01, z * 0.01, 4, 0.5, 2);
+        float g = noise_simplex2(noise, -x * 0.01, -z * 0.01, 2, 0.9, 2);
+        h = _surface(f, g, &w);
       }
-      // sand and grass terrain
-      for (int y = 0; y < h; y++) {
-        func(x, y, z, w * flag, arg);
+      if (w != WORLD_BIOME_GRASS) {
+        continue;
       }
-      if (w == 1) {
-        if (SHOW_PLANTS) {
-          // grass
-          if (simplex2(-x * 0.1, z * 0.1, 4, 0.8, 2) > 0.6) {
-            func(x, h, z, 17 * flag, arg);
-          }
-          // flowers
-          if (simplex2(x * 0.05, -z * 0.05, 4, 0.8, 2) > 0.7) {
-            int w = 18 + simplex2(x * 0.1, z * 0.1, 4, 0.8, 2) * 7;
-            func(x, h, z, w * flag, arg);
-          }
+      if (count == capacity) {
+        capacity = capacity ? capacity * 2 : 16;
+        features = realloc(features, sizeof(WorldFeature) * capacity);
+      }
+      WorldFeature *feature = features + count++;
+      feature->x = x;
+      feature->z = z;
+      feature->h = h;
+    }
+  }
+  *result = features;
+  return count;
+}
+
+WorldCache *world_cache_create(void) {
+  WorldCache *cache = calloc(1, sizeof(WorldCache));
+  mtx_init(&cache->mtx, mtx_plain);
+  return cache;
+}
+
+void world_cache_clear(WorldCache *cache) {
+  mtx_lock(&cache->mtx);
+  for (int i = 0; i < WORLD_CACHE_SIZE; i++) {
+    Region *region = cache->regions + i;
+    free(region->features);
+    region->features = NULL;
+    region->last_used = 0;
+  }
+  mtx_unlock(&cache->mtx);
+}
+
+void world_cache_destroy(WorldCache *cache) {
+  if (!cache) {
+    return;
+  }
+  world_cache_clear(cache);
+  mtx_destroy(&cache->mtx);
+  free(cache);
+}
+
+/*
+ * Appends the features of region (p, q) to `list`, taking them from the
+ * cache when a neighbouring chunk has already found them.
+ */
+static void _region_features(const NoiseContext *noise, WorldCache *cache,
+                             int p, int q, const WorldChunk *chunk,
+                             WorldFeature **list, int *count,
+                             int *capacity) {
+  WorldFeature *features = NULL;
+  int found = -1;
+  if (cache) {
+    mtx_lock(&cache->mtx);
+    for (int i = 0; i < WORLD_CACHE_SIZE; i++) {
+      Region *region = cache->regions + i;
+      if (region->last_used && region->p == p && region->q == q) {
+        region->last_used = ++cache->clock;
+        found = region->count;
+        features = malloc(sizeof(WorldFeature) * (found ? found : 1));
+        memcpy(features, region->features, sizeof(WorldFeature) * found);
+        break;
+      }
+    }
+    mtx_unlock(&cache->mtx);
+  }
+  const int n = found >= 0 ? found : _find_features(noise, p, q, chunk,
+                                                    &features);
+  if (cache && found < 0) {
+    mtx_lock(&cache->mtx);
+    Region *oldest = cache->regions;
+    for (int i = 0; i < WORLD_CACHE_SIZE; i++) {
+      Region *region = cache->regions + i;
+      if (region->last_used && region->p == p && region->q == q) {
+        oldest = NULL;  // another thread got here first
+        break;
+      }
+      if (region->last_used < oldest->last_used) {
+        oldest = region;
+      }
+    }
+    if (oldest) {
+      free(oldest->features);
+      oldest->p = p;
+      oldest->q = q;
+      oldest->last_used = ++cache->clock;
+      oldest->count = n;
+      oldest->features = malloc(sizeof(WorldFeature) * (n ? n : 1));
+      memcpy(oldest->features, features, sizeof(WorldFeature) * n);
+    }
+    mtx_unlock(&cache->mtx);
+  }
+  if (*count + n > *capacity) {
+    *capacity = (*count + n) * 2;
+    *list = realloc(*list, sizeof(WorldFeature) * *capacity);
+  }
+  memcpy(*list + *count, features, sizeof(WorldFeature) * n);
+  *count += n;
+  free(features);
+}
+
+/*
+ * Second pass: terrain and plants, then the trees of this region and its
+ * neighbours that reach into the chunk or its ring.  Leaves
+ * only fill empty blocks and trunks replace whatever is there, so the
+ * result does not depend on the order the trees are placed in, and a
+ * tree on a chunk edge is the same in both chunks.
+ */
+void world_fill(const NoiseContext *noise, WorldCache *cache,
+                WorldChunk *chunk) {
+  NoiseContext builtin;
+  if (!noise) {
+    noise_default(&builtin);
+    noise = &builtin;
+  }
+  const int p = chunk->p;
+  const int q = chunk->q;
+  const int x0 = p * CHUNK_SIZE;
+  const int z0 = q * CHUNK_SIZE;
+  WorldFeature *features = NULL;
+  int count = 0;
+  int capacity = 0;
+  for (int dp = -1; dp <= 1; dp++) {
+    for (int dq = -1; dq <= 1; dq++) {
+      int n = count;
+      _region_features(noise, cache, p + dp, q + dq, chunk, &features, &count,
+                       &capacity);
+      // keep only the trees that reach the chunk or its ring
+      for (int i = n; i < count; i++) {
+        const WorldFeature *f = features + i;
+        if (f->x + TREE_RADIUS >= x0 - PAD &&
+            f->x - TREE_RADIUS < x0 + CHUNK_SIZE + PAD &&
+            f->z + TREE_RADIUS >= z0 - PAD &&
+            f->z - TREE_RADIUS < z0 + CHUNK_SIZE + PAD) {
+          features[n++] = *f;
         }
-        // trees
-        int ok = SHOW_TREES;
-        if (dx - 4 < 0 || dz - 4 < 0 || dx + 4 >= CHUNK_SIZE ||
-            dz + 4 >= CHUNK_SIZE) {
-          ok = 0;
+      }
+      count = n;
+    }
+  }
+  int top = chunk->top;
+  for (int i = 0; i < count; i++) {
+    if (features[i].h + TREE_HEIGHT > top) {
+      top = features[i].h + TREE_HEIGHT;
+    }
+  }
+  world_chunk_clear(chunk, top);
+  const int size = ROW * ROW * top;
+  char *const blocks = chunk->blocks;
+#define INSIDE(dx, dz) \
+  ((dx) >= -PAD && (dz) >= -PAD && (dx) < CHUNK_SIZE + PAD && \
+   (dz) < CHUNK_SIZE + PAD)
+#define BLOCK(dx, y, dz) blocks[WORLD_COLUMN(dx, dz) * top + (y)]
+  Row row;
+  for (int dx = -PAD; dx < CHUNK_SIZE + PAD; dx++) {
+    const int x = x0 + dx;
+    if (dx >= 0 && dx < CHUNK_SIZE) {
+      _evaluate_features(noise, x, z0 - PAD, &row);
+    }
+    for (int dz = -PAD; dz < CHUNK_SIZE + PAD; dz++) {
+      const int i = dz + PAD;
+      const int z = z0 + dz;
+      const int h = chunk->height[WORLD_COLUMN(dx, dz)];
+      const int w = chunk->biome[WORLD_COLUMN(dx, dz)];
+      const int ring =
+          dx < 0 || dz < 0 || dx >= CHUNK_SIZE || dz >= CHUNK_SIZE;
+      // sand and grass terrain
+      memset(&BLOCK(dx, 0, dz), w, h);
+      if (SHOW_PLANTS && w == WORLD_BIOME_GRASS && !ring) {
+        // grass
+        if (row.grass[i] > 0.6) {
+          BLOCK(dx, h, dz) = 17;
         }
-        if (ok && simplex2(x, z, 6, 0.5, 2) > 0.84) {
-          for (int y = h + 3; y < h + 8; y++) {
-            for (int ox = -3; ox <= 3; ox++) {
-              for (int oz = -3; oz <= 3; oz++) {
-                int d = (ox * ox) + (oz * oz) + (y - (h + 4)) * (y - (h + 4));
-                if (d < 11) {
-                  func(x + ox, y, z + oz, 15, arg);
-                }
-              }
-            }
-          }
-          for (int y = h; y < h + 7; y++) {
-            func(x, y, z, 5, arg);
-          }
+        // flowers
+        if (row.flowers[i] > 0.7) {
+          int w = 18 + noise_simplex2(noise, x * 0.1, z * 0.1, 4, 0.8, 2) * 7;
+          BLOCK(dx, h, dz) = w;
         }
       }
-      // clouds
-      if (SHOW_CLOUDS) {
-        for (int y = 64; y < 72; y++) {
-          if (simplex3(x * 0.01, y * 0.1, z * 0.01, 8, 0.5, 2) > 0.75) {
-            func(x, y, z, 16 * flag, arg);
+    }
+  }
+  // trees: leaves first, then the trunks over them
+  for (int i = 0; i < count; i++) {
+    const int dx = features[i].x - x0;
+    const int dz = features[i].z - z0;
+    const int h = features[i].h;
+    for (int y = h + 3; y < h + 8; y++) {
+      for (int ox = -TREE_RADIUS; ox <= TREE_RADIUS; ox++) {
+        for (int oz = -TREE_RADIUS; oz <= TREE_RADIUS; oz++) {
+          int d = (ox * ox) + (oz * oz) + (y - (h + 4)) * (y - (h + 4));
+          if (d < 11 && INSIDE(dx + ox, dz + oz) &&
+              !BLOCK(dx + ox, y, dz + oz)) {
+            BLOCK(dx + ox, y, dz + oz) = 15;
           }
         }
       }
     }
   }
+  for (int i = 0; i < count; i++) {
+    const int dx = features[i].x - x0;
+    const int dz = features[i].z - z0;
+    if (INSIDE(dx, dz)) {
+      for (int y = features[i].h; y < features[i].h + 7; y++) {
+        BLOCK(dx, y, dz) = 5;
+      }
+    }
+  }
+#undef BLOCK
+#undef INSIDE
+  free(features);
+  int total = 0;
+  for (int i = 0; i < size; i++) {
+    total += blocks[i] != 0;
+  }
+  chunk->count = total;
+}
+
+void world_generate(const NoiseContext *noise, WorldCache *cache, int p,
+                    int q, WorldChunk *chunk) {
+  world_heightmap(noise, p, q, chunk);
+  world_fill(noise, cache, chunk);
+}
+
+/*
+ * The cloud layer of chunk (p, q) and its ring, kept apart from the
+ * terrain so that only a client that draws clouds generates them.  Bit
+ * y - WORLD_CLOUD_BOTTOM of layer[WORLD_COLUMN(dx, dz)] is set where
+ * there is cloud.
+ */
+void world_clouds(const NoiseContext *noise, int p, int q,
+                  unsigned char *layer) {
+  NoiseContext builtin;
+  if (!noise) {
+    noise_default(&builtin);
+    noise = &builtin;
+  }
+  float x[ROW], y[ROW], z[ROW], value[ROW];
+  memset(layer, 0, ROW * ROW);
+  for (int dx = -PAD; dx < CHUNK_SIZE + PAD; dx++) {
+    for (int i = 0; i < ROW; i++) {
+      x[i] = (p * CHUNK_SIZE + dx) * 0.01;
+      z[i] = (q * CHUNK_SIZE - PAD + i) * 0.01;
+    }
+    for (int b = 0; b < WORLD_CLOUD_TOP - WORLD_CLOUD_BOTTOM; b++) {
+      for (int i = 0; i < ROW; i++) {
+        y[i] = (WORLD_CLOUD_BOTTOM + b) * 0.1;
+      }
+      noise_simplex3_batch(noise, x, y, z, value, ROW, 8, 0.5, 2);
+      for (int i = 0; i < ROW; i++) {
+        if (value[i] > 0.75) {
+          layer[WORLD_COLUMN(dx, i - PAD)] |= 1 << b;
+        }
+      }
+    }
+  }
+}
+
+// Sizes the volume for `top` blocks per column, all of them empty.
+void world_chunk_clear(WorldChunk *chunk, int top) {
+  const int size = ROW * ROW * top;
+  if (chunk->capacity < size) {
+    free(chunk->blocks);
+    chunk->blocks = malloc(size);
+    chunk->capacity = size;
+  }
+  chunk->top = top;
+  memset(chunk->blocks, 0, size);
+}
+
+void world_chunk_free(WorldChunk *chunk) {
+  free(chunk->blocks);
+  chunk->blocks = NULL;
+  chunk->capacity = 0;
+}
+
+/*
+ * The generated block at (x, y, z), or 0 if there is none or it is
+ * outside the chunk and its ring.
+ */
+int world_chunk_get(const WorldChunk *chunk, int x, int y, int z) {
+  const int dx = x - chunk->p * CHUNK_SIZE;
+  const int dz = z - chunk->q * CHUNK_SIZE;
+  if (dx < -PAD || dz < -PAD || dx >= CHUNK_SIZE + PAD ||
+      dz >= CHUNK_SIZE + PAD || y < 0 || y >= chunk->top) {
+    return 0;
+  }
+  return chunk->blocks[WORLD_COLUMN(dx, dz) * chunk->top + y];
+}
+
+/*
+ * The surface height of column (x, z): the y of the lowest air block
+ * above the terrain, not counting plants and trees.
+ */
+int world_chunk_height(const WorldChunk *chunk, int x, int z) {
+  const int dx = x - chunk->p * CHUNK_SIZE;
+  const int dz = z - chunk->q * CHUNK_SIZE;
+  if (dx < -PAD || dz < -PAD || dx >= CHUNK_SIZE + PAD ||
+      dz >= CHUNK_SIZE + PAD) {
+    return 0;
+  }
+  return chunk->height[WORLD_COLUMN(dx, dz)];
+}
+
+void world_chunk_emit(const WorldChunk *chunk, world_func func, void *arg) {
+  for (int dx = -PAD; dx < CHUNK_SIZE + PAD; dx++) {
+    for (int dz = -PAD; dz < CHUNK_SIZE + PAD; dz++) {
+      const int flag = (dx < 0 || dz < 0 || dx >= CHUNK_SIZE ||
+                        dz >= CHUNK_SIZE)
+                           ? -1
+                           : 1;
+      const int x = chunk->p * CHUNK_SIZE + dx;
+      const int z = chunk->q * CHUNK_SIZE + dz;
+      const char *column = chunk->blocks + WORLD_COLUMN(dx, dz) * chunk->top;
+      for (int y = 0; y < chunk->top; y++) {
+        if (column[y]) {
+          func(x, y, z, column[y] * flag, arg);
+        }
+      }
+    }
+  }
+}
+
+void create_world(const NoiseContext *noise, int p, int q, world_func func,
+                  void *arg) {
+  WorldChunk chunk = {0};
+  world_generate(noise, NULL, p, q, &chunk);
+  world_chunk_emit(&chunk, func, arg);
+  world_chunk_free(&chunk);
 }
@@ -23,8 +23,71 @@
 #ifndef _world_h_
 #define _world_h_
 
+#include "config.h"
+#include "noise.h"
+
+#define WORLD_PAD 1
+#define WORLD_ROW (CHUNK_SIZE + WORLD_PAD * 2)
+#define WORLD_BIOME_GRASS 1
+#define WORLD_BIOME_SAND 2
+#define WORLD_CLOUD_BOTTOM 64
+#define WORLD_CLOUD_TOP 72
+
+/*
+ * The generated terrain of one chunk and the ring of columns around it.
+ * Generation runs in two passes: world_heightmap fills in the surface
+ * height and biome of every column from the terrain noise, then
+ * world_fill writes the blocks into a dense volume.  Columns are indexed
+ * by WORLD_COLUMN(dx, dz), with dx and dz relative to the chunk's
+ * corner, so the ring is at -1 and CHUNK_SIZE.
+ */
+typedef struct {
+  int p;
+  int q;
+  short height[WORLD_ROW * WORLD_ROW];  // the lowest air block
+  char biome[WORLD_ROW * WORLD_ROW];
+  int top;    // no blocks at or above this y
+  int count;  // blocks in the volume
+  int capacity;
+  char *blocks;  // WORLD_ROW * WORLD_ROW columns of `top` blocks each
+} WorldChunk;
+
+#define WORLD_COLUMN(dx, dz) \
+  (((dx) + WORLD_PAD) * WORLD_ROW + (dz) + WORLD_PAD)
+
+// A tree rooted on the surface of column (x, z), at height h.
+typedef struct {
+  int x;
+  int z;
+  int h;
+} WorldFeature;
+
+// The features of recently generated regions, shared by every thread that
+// generates chunks of one world.  NULL works too, it is just slower.
+typedef struct WorldCache WorldCache;
+
 typedef void (*world_func)(int, int, int, int, void *);
 
-void create_world(int p, int q, world_func func, void *arg);
+WorldCache *world_cache_create(void);
+void world_cache_clear(WorldCache *cache);
+void world_cache_destroy(WorldCache *cache);
+void world_heightmap(const NoiseContext *noise, int p, int q,
+                     WorldChunk *chunk);
+void world_fill(const NoiseContext *noise, WorldCache *cache,
+                WorldChunk *chunk);
+void world_generate(const NoiseContext *noise, WorldCache *cache, int p,
+                    int q, WorldChunk *chunk);
+void world_clouds(const NoiseContext *noise, int p, int q,
+                  unsigned char *layer);
+void world_chunk_clear(WorldChunk *chunk, int top);
+void world_chunk_free(WorldChunk *chunk);
+int world_chunk_get(const WorldChunk *chunk, int x, int y, int z);
+int world_chunk_height(const WorldChunk *chunk, int x, int z);
+void world_chunk_emit(const WorldChunk *chunk, world_func func, void *arg);
+
+// Generates chunk (p, q) from `noise`, or from the built-in table if NULL,
+// calling func for every block.  Blocks in the ring have negative w.
+void create_world(const NoiseContext *noise, int p, int q, world_func func,
+                  void *arg);
 
 #endif
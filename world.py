@@ -19,7 +19,7 @@
 # OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 # SOFTWARE.
 
-from ctypes import CDLL, CFUNCTYPE, c_float, c_int, c_void_p
+from ctypes import CDLL, CFUNCTYPE, c_float, c_int, c_uint, c_void_p
 from collections import OrderedDict
 
 # TODO - make this work on windows and on macos
@@ -27,14 +27,21 @@ dll = CDLL('./libworld.so')
 
 WORLD_FUNC = CFUNCTYPE(None, c_int, c_int, c_int, c_int, c_void_p)
 
-def dll_seed(x):
-    dll.seed(x)
+dll.noise_create.restype = c_void_p
+dll.noise_create.argtypes = [c_uint]
+def dll_noise_create(x):
+    return dll.noise_create(x)
 
-def dll_create_world(p, q):
+dll.noise_destroy.argtypes = [c_void_p]
+def dll_noise_destroy(noise):
+    dll.noise_destroy(noise)
+
+dll.create_world.argtypes = [c_void_p, c_int, c_int, WORLD_FUNC, c_void_p]
+def dll_create_world(noise, p, q):
     result = {}
     def world_func(x, y, z, w, arg):
         result[(x, y, z)] = w
-    dll.create_world(p, q, WORLD_FUNC(world_func), None)
+    dll.create_world(noise, p, q, WORLD_FUNC(world_func), None)
     return result
 
 dll.simplex2.restype = c_float
@@ -50,12 +57,17 @@ def dll_simplex3(x, y, z, octaves=1, persistence=0.5, lacunarity=2.0):
 class World(object):
     def __init__(self, seed=None, cache_size=64):
         self.seed = seed
+        self.noise = dll_noise_create(seed) if seed is not None else None
         self.cache = OrderedDict()
         self.cache_size = cache_size
+    def close(self):
+        if self.noise is not None:
+            dll_noise_destroy(self.noise)
+            self.noise = None
+    def __del__(self):
+        self.close()
     def create_chunk(self, p, q):
-        if self.seed is not None:
-            dll_seed(self.seed)
-        return dll_create_world(p, q)
+        return dll_create_world(self.noise, p, q)
     def get_chunk(self, p, q):
         try:
             chunk = self.cache.pop((p, q))